@@ -1,6 +1,16 @@
 #ifndef _ANIMATION_H_
 #define _ANIMATION_H_
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
 class Frame
 {
 public:
@@ -17,22 +27,205 @@ public:
     float timeInterval = 1.0f / 60.0f;
 };
 
+/* per-frame work plugged in before or after an animation's update, e.g. emitters or cache writes */
+class AnimationStage
+{
+public:
+    virtual ~AnimationStage() {}
+    virtual const char *name() const = 0;
+    virtual void process(const Frame &frame) = 0;
+};
+
+enum class StagePhase
+{
+    PreProcessing,
+    PostProcessing
+};
+
+struct StageStatistics
+{
+    std::string name;
+    StagePhase phase;
+    int group;
+    unsigned long long calls = 0;
+    double lastMilliseconds = 0.0;
+    double totalMilliseconds = 0.0;
+};
+
 class Animation
 {
 public:
+    virtual ~Animation() {}
+
     void update(const Frame &frame)
     {
-        // pre-processing
+        runStages(_preProcessingStages, frame);
         onUpdate(frame);
-        // post-processing
+        runStages(_postProcessingStages, frame);
+    }
+
+    /*
+     * Stages of a phase run in ascending group order. Stages sharing a group
+     * must be independent of each other, they run concurrently on the thread pool.
+     */
+    void addStage(StagePhase phase, std::shared_ptr<AnimationStage> stage, int group = 0)
+    {
+        std::vector<RegisteredStage> &stages = phase == StagePhase::PreProcessing ? _preProcessingStages : _postProcessingStages;
+        RegisteredStage registered;
+        registered.stage = stage;
+        registered.statistics.name = stage->name();
+        registered.statistics.phase = phase;
+        registered.statistics.group = group;
+        auto position = std::upper_bound(stages.begin(), stages.end(), group,
+                                         [](int g, const RegisteredStage &s) { return g < s.statistics.group; });
+        stages.insert(position, registered);
+    }
+
+    void removeStage(const std::shared_ptr<AnimationStage> &stage)
+    {
+        for (std::vector<RegisteredStage> *stages : {&_preProcessingStages, &_postProcessingStages})
+        {
+            stages->erase(std::remove_if(stages->begin(), stages->end(),
+                                         [&](const RegisteredStage &s) { return s.stage == stage; }),
+                          stages->end());
+        }
+    }
+
+    /* timing of every registered stage, pre-processing stages first */
+    std::vector<StageStatistics> stageStatistics() const
+    {
+        std::vector<StageStatistics> result;
+        for (const RegisteredStage &s : _preProcessingStages)
+        {
+            result.push_back(s.statistics);
+        }
+        for (const RegisteredStage &s : _postProcessingStages)
+        {
+            result.push_back(s.statistics);
+        }
+        return result;
     }
 
 protected:
     virtual void onUpdate(const Frame &frame) = 0;
+
+private:
+    struct RegisteredStage
+    {
+        std::shared_ptr<AnimationStage> stage;
+        StageStatistics statistics;
+    };
+
+    std::vector<RegisteredStage> _preProcessingStages;
+    std::vector<RegisteredStage> _postProcessingStages;
+
+    static void runStage(RegisteredStage &s, const Frame &frame)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        s.stage->process(frame);
+        auto end = std::chrono::high_resolution_clock::now();
+        double elapsed = std::chrono::duration<double, std::milli>(end - start).count();
+        s.statistics.calls++;
+        s.statistics.lastMilliseconds = elapsed;
+        s.statistics.totalMilliseconds += elapsed;
+    }
+
+    static void runStages(std::vector<RegisteredStage> &stages, const Frame &frame)
+    {
+        size_t begin = 0;
+        while (begin < stages.size())
+        {
+            size_t end = begin + 1;
+            while (end < stages.size() && stages[end].statistics.group == stages[begin].statistics.group)
+            {
+                end++;
+            }
+            if (end - begin == 1)
+            {
+                runStage(stages[begin], frame);
+            }
+            else
+            {
+                std::vector<std::function<void()>> tasks;
+                for (size_t i = begin; i < end; i++)
+                {
+                    RegisteredStage *s = &stages[i];
+                    tasks.push_back([s, &frame] { runStage(*s, frame); });
+                }
+                ThreadPool::global().run(tasks);
+            }
+            begin = end;
+        }
+    }
+};
+
+/* counters collected by PhysicsAnimation for the most recent update */
+struct SubstepStatistics
+{
+    unsigned int numberOfSubsteps = 0;
+    double elapsedMilliseconds = 0.0;
+    // simulated time thrown away because the per-frame substep cap was hit
+    double droppedTime = 0.0;
+    float smallestInterval = 0.0f;
+    float largestInterval = 0.0f;
 };
 
 class PhysicsAnimation : public Animation
 {
+public:
+    /* number of equal substeps a single frame is split into */
+    void setNumberOfSubsteps(unsigned int n)
+    {
+        _numberOfSubsteps = std::max(1u, n);
+    }
+    unsigned int numberOfSubsteps() const { return _numberOfSubsteps; }
+
+    /* fixed substep length in seconds, 0 derives it from the frame's timeInterval */
+    void setSubstepInterval(float interval)
+    {
+        _substepInterval = std::max(0.0f, interval);
+    }
+    float substepInterval() const { return _substepInterval; }
+
+    /* upper bound of substeps per update, so a slow frame can't spiral */
+    void setMaxSubstepsPerFrame(unsigned int n)
+    {
+        _maxSubstepsPerFrame = std::max(1u, n);
+    }
+    unsigned int maxSubstepsPerFrame() const { return _maxSubstepsPerFrame; }
+
+    /* let the solver pick each substep from its CFL and stability limits */
+    void setAdaptiveTimeStepping(bool enabled) { _adaptiveTimeStepping = enabled; }
+    bool adaptiveTimeStepping() const { return _adaptiveTimeStepping; }
+
+    /* fraction of characteristicLength a particle may travel per substep */
+    void setCflNumber(float cfl) { _cflNumber = std::max(0.0f, cfl); }
+    float cflNumber() const { return _cflNumber; }
+
+    /* clamps applied to the adaptive substep */
+    void setSubstepIntervalRange(float minInterval, float maxInterval)
+    {
+        _minSubstepInterval = std::max(0.0f, minInterval);
+        _maxSubstepInterval = std::max(_minSubstepInterval, maxInterval);
+    }
+    float minSubstepInterval() const { return _minSubstepInterval; }
+    float maxSubstepInterval() const { return _maxSubstepInterval; }
+
+    const SubstepStatistics &lastFrameStatistics() const { return _lastFrameStatistics; }
+    unsigned long long totalNumberOfSubsteps() const { return _totalNumberOfSubsteps; }
+    const Frame &currentFrame() const { return _currentFrame; }
+
+    /*
+     * jump to a frame whose state was restored from elsewhere, e.g. a checkpoint.
+     * The simulated time not yet stepped is kept, it belongs to the restored state.
+     */
+    void setCurrentFrame(const Frame &frame)
+    {
+        _currentFrame = frame;
+    }
+
+    /* simulated time the last update left for the next one, less than a substep */
+    double timeAccumulator() const { return _timeAccumulator; }
 
 protected:
     virtual void onUpdate(const Frame &frame) override
@@ -40,18 +233,128 @@ protected:
         if (frame.index > _currentFrame.index)
         {
             unsigned int n = frame.index - _currentFrame.index;
+            _timeAccumulator += static_cast<double>(n) * frame.timeInterval;
+
+            const double interval = _substepInterval > 0.0f
+                                        ? _substepInterval
+                                        : frame.timeInterval / _numberOfSubsteps;
+            // tolerate the rounding left over from splitting a frame into equal parts
+            const double threshold = interval * (1.0 - 1e-4);
 
-            for (int i = 0; i < n; i++)
+            const bool adaptive = _adaptiveTimeStepping && !requiresFixedSubsteps();
+            SubstepStatistics statistics;
+            auto start = std::chrono::high_resolution_clock::now();
+            if (adaptive)
+            {
+                // the time left is split into equal substeps within the limit, so the frame boundary
+                // is met without a sliver of a last step that solvers dividing by dt would blow up on
+                while (_timeAccumulator > kTimeEpsilon && statistics.numberOfSubsteps < _maxSubstepsPerFrame)
+                {
+                    const double steps = std::ceil(_timeAccumulator / adaptiveSubstepInterval() - 1e-4);
+                    const float dt = static_cast<float>(_timeAccumulator / std::max(1.0, steps));
+                    advanceTimeStep(dt);
+                    _timeAccumulator -= dt;
+                    recordInterval(statistics, dt);
+                }
+            }
+            else
+            {
+                while (_timeAccumulator >= threshold && statistics.numberOfSubsteps < _maxSubstepsPerFrame)
+                {
+                    advanceTimeStep(static_cast<float>(interval));
+                    _timeAccumulator -= interval;
+                    recordInterval(statistics, static_cast<float>(interval));
+                }
+            }
+            if (adaptive ? _timeAccumulator > kTimeEpsilon : _timeAccumulator >= threshold)
             {
-                advanceTimeStep(frame.timeInterval);
+                statistics.droppedTime = _timeAccumulator;
+                _timeAccumulator = 0.0;
             }
+            else if (_timeAccumulator < 0.0)
+            {
+                _timeAccumulator = 0.0;
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            statistics.elapsedMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+            _lastFrameStatistics = statistics;
             _currentFrame = frame;
         }
     }
     virtual void onAdvanceTimeStep(float timeInterval) = 0;
 
+    /* for solvers restoring a checkpoint */
+    void setTimeAccumulator(double time) { _timeAccumulator = std::max(0.0, time); }
+
+    /* hooks for the adaptive controller, a value of 0 means "no limit" */
+    // largest particle speed in the current state
+    virtual float maxVelocity() const { return 0.0f; }
+    // largest force magnitude per unit mass in the current state
+    virtual float maxForce() const { return 0.0f; }
+    // largest substep the integrator stays stable at, e.g. from the spring period
+    virtual float stabilityTimeStepLimit() const { return 0.0f; }
+    // length scale the CFL condition is measured in, e.g. particle spacing
+    virtual float characteristicLength() const { return 1.0f; }
+    // true while the solver needs equal substeps, e.g. because it prefactors a matrix
+    // that depends on the step, adaptive stepping is then skipped
+    virtual bool requiresFixedSubsteps() const { return false; }
+
+    /* largest substep satisfying every limit, clamped to the configured range */
+    float adaptiveSubstepInterval() const
+    {
+        float dt = _maxSubstepInterval;
+        const float h = characteristicLength();
+        const float v = maxVelocity();
+        if (v > 0.0f)
+        {
+            dt = std::min(dt, _cflNumber * h / v);
+        }
+        const float f = maxForce();
+        if (f > 0.0f)
+        {
+            dt = std::min(dt, _cflNumber * std::sqrt(h / f));
+        }
+        const float stable = stabilityTimeStepLimit();
+        if (stable > 0.0f)
+        {
+            dt = std::min(dt, stable);
+        }
+        return std::max(dt, _minSubstepInterval);
+    }
+
 private:
+    static constexpr double kTimeEpsilon = 1e-7;
+
     Frame _currentFrame;
-    void advanceTimeStep(float timeInterval){};
+    unsigned int _numberOfSubsteps = 1;
+    float _substepInterval = 0.0f;
+    unsigned int _maxSubstepsPerFrame = 64;
+    double _timeAccumulator = 0.0;
+    bool _adaptiveTimeStepping = false;
+    float _cflNumber = 0.4f;
+    float _minSubstepInterval = 1e-5f;
+    float _maxSubstepInterval = 1.0f / 60.0f;
+    SubstepStatistics _lastFrameStatistics;
+    unsigned long long _totalNumberOfSubsteps = 0;
+
+    void advanceTimeStep(float timeInterval)
+    {
+        onAdvanceTimeStep(timeInterval);
+        _totalNumberOfSubsteps++;
+    }
+    static void recordInterval(SubstepStatistics &statistics, float interval)
+    {
+        if (statistics.numberOfSubsteps == 0)
+        {
+            statistics.smallestInterval = statistics.largestInterval = interval;
+        }
+        else
+        {
+            statistics.smallestInterval = std::min(statistics.smallestInterval, interval);
+            statistics.largestInterval = std::max(statistics.largestInterval, interval);
+        }
+        statistics.numberOfSubsteps++;
+    }
 };
-#endif
\ No newline at end of file
+#endif
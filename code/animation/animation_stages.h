@@ -0,0 +1,185 @@
+#ifndef _ANIMATION_STAGES_H_
+#define _ANIMATION_STAGES_H_
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "animation.h"
+#include "particle_system_data.h"
+#include "particle_cache_writer.h"
+
+/* particle arrays of the mass spring animation, which keeps them interleaved */
+struct ParticleArrays
+{
+    std::vector<glm::vec3> *positions = nullptr;
+    std::vector<glm::vec3> *velocities = nullptr;
+    // written as a third channel when set, so readers can match particles across reorders
+    std::vector<int> *ids = nullptr;
+};
+
+/* wraps a callable, for one-off stages that don't deserve a class */
+class FunctionStage : public AnimationStage
+{
+public:
+    FunctionStage(const std::string &name, std::function<void(const Frame &)> function)
+        : _name(name), _function(function)
+    {
+    }
+    const char *name() const override { return _name.c_str(); }
+    void process(const Frame &frame) override { _function(frame); }
+
+private:
+    std::string _name;
+    std::function<void(const Frame &)> _function;
+};
+
+/*
+ * appends particles at a fixed rate from a point. Works on the particle data of
+ * the SPH, DFSPH and PBF solvers: addParticles grows every channel the solver
+ * registered, and their neighbor lists rebuild when the particle count changes.
+ */
+class PointEmitterStage : public AnimationStage
+{
+public:
+    PointEmitterStage(ParticleSystemData &particles, const glm::vec3 &origin, const glm::vec3 &velocity,
+                      float particlesPerSecond, size_t maxParticles)
+        : _particles(particles), _origin(origin), _velocity(velocity),
+          _rate(particlesPerSecond), _maxParticles(maxParticles)
+    {
+    }
+    const char *name() const override { return "emitter"; }
+    void process(const Frame &frame) override
+    {
+        _pending += _rate * frame.timeInterval;
+        size_t current = _particles.numberOfParticles();
+        size_t count = current < _maxParticles ? std::min(static_cast<size_t>(_pending), _maxParticles - current) : 0;
+        if (count > 0)
+        {
+            size_t first = _particles.addParticles(count);
+            VectorChannelView<float> positions = _particles.positions();
+            VectorChannelView<float> velocities = _particles.velocities();
+            for (size_t i = 0; i < count; i++)
+            {
+                // particles born earlier in the frame have already travelled, which also
+                // keeps the ones emitted together from sitting on top of each other
+                float age = (count - i) / _rate;
+                positions.set(first + i, _origin + age * _velocity);
+                velocities.set(first + i, _velocity);
+            }
+            _pending -= static_cast<float>(count);
+        }
+        if (_particles.numberOfParticles() >= _maxParticles)
+        {
+            _pending = 0.0f;
+        }
+    }
+
+private:
+    ParticleSystemData &_particles;
+    glm::vec3 _origin;
+    glm::vec3 _velocity;
+    float _rate;
+    size_t _maxParticles;
+    float _pending = 0.0f;
+};
+
+/*
+ * keeps particles above a horizontal plane, bouncing them off it. It runs once a
+ * frame, so particles may dip below the plane between substeps and the fluid
+ * compresses a little more against it than against a domain wall.
+ */
+class PlaneCollisionStage : public AnimationStage
+{
+public:
+    PlaneCollisionStage(ParticleSystemData &particles, float height, float restitutionCoefficient)
+        : _particles(particles), _height(height), _restitution(restitutionCoefficient)
+    {
+    }
+    const char *name() const override { return "collision"; }
+    void process(const Frame &) override
+    {
+        VectorChannelView<float> positions = _particles.positions();
+        VectorChannelView<float> velocities = _particles.velocities();
+        parallelFor(0, positions.size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                if (positions.y[i] < _height)
+                {
+                    positions.y[i] = _height;
+                    if (velocities.y[i] < 0.0f)
+                    {
+                        velocities.y[i] *= -_restitution;
+                    }
+                }
+            }
+        });
+    }
+
+private:
+    ParticleSystemData &_particles;
+    float _height;
+    float _restitution;
+};
+
+/* streams positions, velocities and optionally particle ids of every frame into a particle cache */
+class CacheWriteStage : public AnimationStage
+{
+public:
+    CacheWriteStage(ParticleArrays particles, ParticleCacheWriter &writer)
+        : _particles(particles), _writer(writer)
+    {
+    }
+    const char *name() const override { return "cache write"; }
+    void process(const Frame &frame) override
+    {
+        std::vector<const void *> channels{_particles.positions->data(), _particles.velocities->data()};
+        if (_particles.ids != nullptr)
+        {
+            channels.push_back(_particles.ids->data());
+        }
+        _writer.writeFrame(frame.index, _particles.positions->size(), channels);
+    }
+
+private:
+    ParticleArrays _particles;
+    ParticleCacheWriter &_writer;
+};
+
+/* accumulates the substep counters of a PhysicsAnimation over many frames */
+class StatisticsStage : public AnimationStage
+{
+public:
+    StatisticsStage(const PhysicsAnimation &animation) : _animation(animation) {}
+    const char *name() const override { return "statistics"; }
+    void process(const Frame &) override
+    {
+        const SubstepStatistics &statistics = _animation.lastFrameStatistics();
+        _frames++;
+        _substeps += statistics.numberOfSubsteps;
+        _solverMilliseconds += statistics.elapsedMilliseconds;
+        _maxSolverMilliseconds = std::max(_maxSolverMilliseconds, statistics.elapsedMilliseconds);
+        if (statistics.droppedTime > 0.0)
+        {
+            _framesOverBudget++;
+        }
+    }
+
+    unsigned long long frames() const { return _frames; }
+    unsigned long long substeps() const { return _substeps; }
+    unsigned long long framesOverBudget() const { return _framesOverBudget; }
+    double averageSolverMilliseconds() const { return _frames > 0 ? _solverMilliseconds / _frames : 0.0; }
+    double maxSolverMilliseconds() const { return _maxSolverMilliseconds; }
+
+private:
+    const PhysicsAnimation &_animation;
+    unsigned long long _frames = 0;
+    unsigned long long _substeps = 0;
+    unsigned long long _framesOverBudget = 0;
+    double _solverMilliseconds = 0.0;
+    double _maxSolverMilliseconds = 0.0;
+};
+#endif
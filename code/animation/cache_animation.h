@@ -0,0 +1,108 @@
+#ifndef _CACHE_ANIMATION_H_
+#define _CACHE_ANIMATION_H_
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "animation.h"
+#include "particle_cache_reader.h"
+#include "span.h"
+
+/*
+ * Plays back a baked particle cache. Any frame index can be shown directly,
+ * the data stays in the mapped file and is handed out as spans.
+ */
+class CacheAnimation : public Animation
+{
+public:
+    CacheAnimation(const std::string &path) : _reader(new ParticleCacheReader(path))
+    {
+        _positionChannel = _reader->findChannel("position");
+        if (_positionChannel < 0)
+        {
+            throw std::runtime_error(path + " has no position channel");
+        }
+    }
+
+    /* number of frames after the current one that are read ahead */
+    void setPrefetchDistance(int frames) { _prefetchDistance = frames < 0 ? 0 : frames; }
+    int prefetchDistance() const { return _prefetchDistance; }
+
+    /* show the last cached frame for frames past the end instead of nothing */
+    void setHoldLastFrame(bool hold) { _holdLastFrame = hold; }
+
+    const ParticleCacheReader &reader() const { return *_reader; }
+
+    /* frame table slot being shown, -1 if the requested frame is not cached */
+    int currentSlot() const { return _slot; }
+
+    Span<const glm::vec3> positions() const
+    {
+        return channel<glm::vec3>(_positionChannel);
+    }
+
+    template <typename T>
+    Span<const T> channel(const std::string &name) const
+    {
+        int index = _reader->findChannel(name);
+        if (index < 0)
+        {
+            return Span<const T>();
+        }
+        return channel<T>(index);
+    }
+
+    template <typename T>
+    Span<const T> channel(int index) const
+    {
+        if (_slot < 0)
+        {
+            return Span<const T>();
+        }
+        return _reader->channel<T>(_slot, index);
+    }
+
+protected:
+    void onUpdate(const Frame &frame) override
+    {
+        int slot = _reader->findFrame(frame.index);
+        if (slot < 0 && _holdLastFrame && _reader->numberOfFrames() > 0 && frame.index > _reader->lastFrameIndex())
+        {
+            slot = static_cast<int>(_reader->numberOfFrames()) - 1;
+        }
+
+        int numberOfFrames = static_cast<int>(_reader->numberOfFrames());
+        if (slot >= 0)
+        {
+            int windowEnd = std::min(slot + _prefetchDistance, numberOfFrames - 1);
+            // frames inside the previous window were requested already
+            int first = slot;
+            if (_slot >= 0 && slot > _slot && slot <= _slot + _prefetchDistance)
+            {
+                first = _slot + _prefetchDistance + 1;
+            }
+            for (int i = first; i <= windowEnd; i++)
+            {
+                _reader->prefetch(i);
+            }
+            // the frame we just left is not needed again soon, keep resident memory bounded
+            if (_slot >= 0 && (_slot < slot || _slot > windowEnd))
+            {
+                _reader->release(_slot);
+            }
+        }
+        _slot = slot;
+    }
+
+private:
+    std::unique_ptr<ParticleCacheReader> _reader;
+    int _positionChannel = -1;
+    int _slot = -1;
+    int _prefetchDistance = 4;
+    bool _holdLastFrame = true;
+};
+#endif
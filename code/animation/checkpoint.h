@@ -0,0 +1,334 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "animation.h"
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+ * Checkpoint file layout (native byte order):
+ *   CheckpointHeader, 32 bytes
+ *   payload written by Checkpointable::saveState, every value and array
+ *   starts on an 8-byte boundary, arrays are prefixed with a uint64 count
+ */
+static const char kCheckpointMagic[8] = {'A', 'N', 'I', 'M', 'C', 'K', 'P', 'T'};
+static const uint32_t kCheckpointVersion = 4;
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    int32_t frameIndex;
+    float timeInterval;
+    uint64_t payloadSize;
+};
+
+class CheckpointWriter
+{
+public:
+    template <typename T>
+    void write(const T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "checkpoint values must be trivially copyable");
+        append(&value, sizeof(T));
+    }
+
+    template <typename T>
+    void writeArray(const std::vector<T> &values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "checkpoint values must be trivially copyable");
+        write(static_cast<uint64_t>(values.size()));
+        append(values.data(), values.size() * sizeof(T));
+    }
+
+    std::vector<char> &buffer() { return _buffer; }
+
+private:
+    std::vector<char> _buffer;
+
+    void append(const void *data, size_t size)
+    {
+        size_t offset = _buffer.size();
+        size_t padded = (size + 7) & ~size_t(7);
+        _buffer.resize(offset + padded, 0);
+        if (size > 0)
+        {
+            std::memcpy(&_buffer[offset], data, size);
+        }
+    }
+};
+
+class CheckpointReader
+{
+public:
+    CheckpointReader(const char *data, size_t size) : _data(data), _size(size) {}
+
+    template <typename T>
+    T read()
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "checkpoint values must be trivially copyable");
+        T value;
+        std::memcpy(&value, consume(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void readArray(std::vector<T> &values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "checkpoint values must be trivially copyable");
+        uint64_t count = read<uint64_t>();
+        if (count > _size / sizeof(T))
+        {
+            throw std::runtime_error("corrupted checkpoint array");
+        }
+        const char *bytes = consume(static_cast<size_t>(count) * sizeof(T));
+        values.resize(static_cast<size_t>(count));
+        if (count > 0)
+        {
+            std::memcpy(values.data(), bytes, values.size() * sizeof(T));
+        }
+    }
+
+    /* bytes not consumed yet, a payload read to the end leaves none */
+    size_t remaining() const { return _size - _offset; }
+
+private:
+    const char *_data;
+    size_t _size;
+    size_t _offset = 0;
+
+    const char *consume(size_t size)
+    {
+        size_t padded = (size + 7) & ~size_t(7);
+        if (padded > _size - _offset)
+        {
+            throw std::runtime_error("truncated checkpoint");
+        }
+        const char *result = _data + _offset;
+        _offset += padded;
+        return result;
+    }
+};
+
+/* implemented by solvers whose state can be saved and restored */
+class Checkpointable
+{
+public:
+    virtual ~Checkpointable() {}
+    virtual void saveState(CheckpointWriter &writer) const = 0;
+    virtual void loadState(CheckpointReader &reader) = 0;
+};
+
+/* serialize frame and state into a complete checkpoint image */
+inline std::vector<char> makeCheckpoint(const Frame &frame, const Checkpointable &state)
+{
+    CheckpointWriter writer;
+    writer.buffer().resize(sizeof(CheckpointHeader));
+    state.saveState(writer);
+
+    std::vector<char> image;
+    image.swap(writer.buffer());
+
+    CheckpointHeader header;
+    std::memcpy(header.magic, kCheckpointMagic, sizeof(header.magic));
+    header.version = kCheckpointVersion;
+    header.headerSize = sizeof(CheckpointHeader);
+    header.frameIndex = frame.index;
+    header.timeInterval = frame.timeInterval;
+    header.payloadSize = image.size() - sizeof(CheckpointHeader);
+    std::memcpy(image.data(), &header, sizeof(header));
+    return image;
+}
+
+/* write through a temporary file so a crash never leaves a half written checkpoint */
+inline void writeCheckpointFile(const std::string &path, const std::vector<char> &image)
+{
+    std::string temporary = path + ".tmp";
+    std::FILE *file = std::fopen(temporary.c_str(), "wb");
+    if (file == nullptr)
+    {
+        throw std::runtime_error("open " + temporary + " failure");
+    }
+    bool written = std::fwrite(image.data(), 1, image.size(), file) == image.size() && std::fflush(file) == 0;
+    // the data must be on disk before the rename makes it the checkpoint
+#ifdef _WIN32
+    written = written && _commit(_fileno(file)) == 0;
+#else
+    written = written && fsync(fileno(file)) == 0;
+#endif
+    if (std::fclose(file) != 0 || !written)
+    {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("write " + temporary + " failure");
+    }
+#ifdef _WIN32
+    // rename doesn't replace an existing file on Windows, POSIX replaces it atomically
+    std::remove(path.c_str());
+#endif
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        throw std::runtime_error("rename " + temporary + " failure");
+    }
+}
+
+inline void saveCheckpoint(const std::string &path, const Frame &frame, const Checkpointable &state)
+{
+    writeCheckpointFile(path, makeCheckpoint(frame, state));
+}
+
+/* restore state from a memory mapped checkpoint, returns the frame it was taken at */
+inline Frame loadCheckpoint(const std::string &path, Checkpointable &state)
+{
+    MappedFile file(path);
+    CheckpointHeader header;
+    if (file.size() < sizeof(header))
+    {
+        throw std::runtime_error(path + " is not a checkpoint");
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, kCheckpointMagic, sizeof(header.magic)) != 0)
+    {
+        throw std::runtime_error(path + " is not a checkpoint");
+    }
+    if (header.version != kCheckpointVersion)
+    {
+        throw std::runtime_error(path + ": unsupported checkpoint version " + std::to_string(header.version));
+    }
+    if (header.headerSize < sizeof(header) || header.headerSize > file.size() ||
+        header.payloadSize > file.size() - header.headerSize)
+    {
+        throw std::runtime_error(path + ": corrupted checkpoint header");
+    }
+
+    CheckpointReader reader(file.data() + header.headerSize, static_cast<size_t>(header.payloadSize));
+    state.loadState(reader);
+    if (reader.remaining() != 0)
+    {
+        throw std::runtime_error(path + ": checkpoint payload size mismatch");
+    }
+    return Frame(header.frameIndex, header.timeInterval);
+}
+
+/*
+ * Writes checkpoints on a background thread. save() only copies the state
+ * into memory, the disk write happens later, so the step loop never waits on I/O.
+ */
+class AsyncCheckpointWriter
+{
+public:
+    AsyncCheckpointWriter() : _thread(&AsyncCheckpointWriter::loop, this) {}
+
+    ~AsyncCheckpointWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _quit = true;
+        }
+        _wakeup.notify_all();
+        _thread.join();
+    }
+
+    AsyncCheckpointWriter(const AsyncCheckpointWriter &) = delete;
+    AsyncCheckpointWriter &operator=(const AsyncCheckpointWriter &) = delete;
+
+    void save(const std::string &path, const Frame &frame, const Checkpointable &state)
+    {
+        Job job{path, makeCheckpoint(frame, state)};
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(std::move(job));
+        }
+        _wakeup.notify_all();
+    }
+
+    /* block until every queued checkpoint is on disk, rethrows the first write error */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [this] { return _jobs.empty() && !_busy; });
+        if (_error)
+        {
+            std::exception_ptr error = _error;
+            _error = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    size_t pending()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _jobs.size() + (_busy ? 1 : 0);
+    }
+
+private:
+    struct Job
+    {
+        std::string path;
+        std::vector<char> image;
+    };
+
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::condition_variable _idle;
+    std::deque<Job> _jobs;
+    bool _busy = false;
+    bool _quit = false;
+    std::exception_ptr _error;
+    std::thread _thread;
+
+    void loop()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true)
+        {
+            _wakeup.wait(lock, [this] { return _quit || !_jobs.empty(); });
+            if (_jobs.empty())
+            {
+                return;
+            }
+            Job job = std::move(_jobs.front());
+            _jobs.pop_front();
+            _busy = true;
+            lock.unlock();
+
+            std::exception_ptr error;
+            try
+            {
+                writeCheckpointFile(job.path, job.image);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            _busy = false;
+            if (error && !_error)
+            {
+                _error = error;
+            }
+            _idle.notify_all();
+        }
+    }
+};
+#endif
@@ -0,0 +1,365 @@
+#ifndef _DFSPH_SOLVER_H_
+#define _DFSPH_SOLVER_H_
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "sph_solver.h"
+
+struct DfsphStatistics
+{
+    int densityIterations = 0;
+    // average compression left after the constant density solve, relative to the rest density
+    float densityError = 0.0f;
+    int divergenceIterations = 0;
+    // average density change per step left after the divergence-free solve, relative to the rest density
+    float divergenceError = 0.0f;
+};
+
+/*
+ * Divergence-free SPH (Bender & Koschier). Pressure is solved implicitly by
+ * two Jacobi solves on the velocities, one keeping the velocity field
+ * divergence free and one pushing the predicted density back to rest density,
+ * so the step is limited by the CFL condition instead of the speed of sound.
+ * The stiffness of both solves is warm started from the previous step.
+ */
+class DfsphSolver : public SphSolver
+{
+public:
+    DfsphSolver() : SphSolver()
+    {
+        factorChannel = particles.addScalarChannel("dfsph factor", 0.0f);
+        densityStiffnessChannel = particles.addScalarChannel("density stiffness", 0.0f);
+        divergenceStiffnessChannel = particles.addScalarChannel("divergence stiffness", 0.0f);
+        _kappaChannel = particles.addScalarChannel("kappa", 0.0f);
+        kernelRadiusOverSpacing = 2.0f;
+        setTargetSpacing(targetSpacing);
+    }
+
+    const DfsphStatistics &lastStepStatistics() const { return _lastStepStatistics; }
+    unsigned long long totalDensityIterations() const { return _totalDensityIterations; }
+    unsigned long long totalDivergenceIterations() const { return _totalDivergenceIterations; }
+
+    size_t factorChannel;
+    // stiffness found by the last step's iterations, the warm start of the next one
+    size_t densityStiffnessChannel;
+    size_t divergenceStiffnessChannel;
+
+    float maxDensityError = 0.001f;
+    float maxDivergenceError = 0.001f;
+    int minDensityIterations = 2;
+    int maxDensityIterations = 100;
+    int minDivergenceIterations = 1;
+    int maxDivergenceIterations = 100;
+    int minDivergenceNeighbors = 20;
+    // Jacobi relaxation, the factor ignores the coupling between neighbors and overshoots at 1
+    float relaxation = 0.5f;
+    bool divergenceSolve = true;
+    bool warmStart = true;
+    // share of the last step's stiffness applied up front, only to particles that are compressed again
+    float warmStartFactor = 0.5f;
+    // the density solve linearizes the motion over a step. The CFL condition alone lets a fluid at
+    // rest take a whole frame, which then needs tens of Jacobi iterations instead of a few
+    float maxTimeStep = 0.005f;
+
+protected:
+    // pressure is implicit, the CFL condition and the linearization of the solve limit the step
+    float stabilityTimeStepLimit() const override { return maxTimeStep; }
+    float characteristicLength() const override { return targetSpacing; }
+
+    void onAdvanceTimeStep(float timeInterval) override
+    {
+        if (particles.numberOfParticles() == 0)
+        {
+            return;
+        }
+        updateKernels();
+        neighborLists.update(particles.positions());
+        // densities and their predicted change must come from the same kernel, or the solve chases a moving target
+        estimateDensities([this](float r2) { return cubicSpline(r2); });
+        computeFactors();
+
+        DfsphStatistics statistics;
+        if (divergenceSolve)
+        {
+            solvePressure(timeInterval, false, divergenceStiffnessChannel, maxDivergenceError,
+                          minDivergenceIterations, maxDivergenceIterations, statistics.divergenceIterations,
+                          statistics.divergenceError);
+        }
+        accumulateForces(false);
+        applyForces(timeInterval);
+        solvePressure(timeInterval, true, densityStiffnessChannel, maxDensityError, minDensityIterations,
+                      maxDensityIterations, statistics.densityIterations, statistics.densityError);
+        advectPositions(timeInterval);
+
+        _lastStepStatistics = statistics;
+        _totalDensityIterations += statistics.densityIterations;
+        _totalDivergenceIterations += statistics.divergenceIterations;
+    }
+
+    void calibrateMass() override
+    {
+        particleMass = targetDensity / latticeKernelSum([this](float r2) { return cubicSpline(r2); });
+        tabulateWalls([this](float r2) { return cubicSpline(r2); },
+                      [this](const Vec3 &r, float distance) { return kernelGradient(r, distance); });
+    }
+
+    void updateKernels() override
+    {
+        SphSolver::updateKernels();
+        _kernel = CubicSplineKernel<float>(kernelRadius);
+        if (_kernelTable.radius() != kernelRadius)
+        {
+            _kernelTable.tabulate(_kernel);
+        }
+    }
+
+    /* cubic spline kernel, smooth at the center unlike spiky, so the solve stays linear for close pairs */
+    float cubicSpline(float distanceSquared) const { return _kernelTable(distanceSquared); }
+
+    /* gradient of the cubic spline kernel with respect to x_i, r = x_i - x_j */
+    Vec3 kernelGradient(const Vec3 &r, float distance) const
+    {
+        return distance > 0.0f ? _kernel.derivative(distance) / distance * r : Vec3(0.0f);
+    }
+
+    /*
+     * alpha_i = rho_i / (|sum m grad W|^2 + sum |m grad W|^2), maps a density error
+     * to a stiffness. Adds the wall contribution to the densities and caches the
+     * pairs within the kernel radius and their kernel gradients, positions don't
+     * change during the solves.
+     */
+    void computeFactors()
+    {
+        VectorChannelView<const float> x = particles.positions();
+        Span<float> density = particles.scalarChannel(densityChannel);
+        Span<float> factor = particles.scalarChannel(factorChannel);
+        const NeighborLists &lists = neighborLists.lists();
+        const float m = particleMass;
+        const float radiusSquared = kernelRadius * kernelRadius;
+        const size_t n = x.size;
+
+        _pairs.offsets.resize(n + 1);
+        _pairs.offsets[0] = 0;
+        parallelFor(0, n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                Vec3 xi = x.get(i);
+                uint32_t count = 0;
+                for (uint32_t j : lists.neighbors(i))
+                {
+                    Vec3 r = xi - x.get(j);
+                    count += glm::dot(r, r) < radiusSquared ? 1 : 0;
+                }
+                _pairs.offsets[i + 1] = count;
+            }
+        });
+        for (size_t i = 0; i < n; i++)
+        {
+            _pairs.offsets[i + 1] += _pairs.offsets[i];
+        }
+        _pairs.indices.resize(_pairs.offsets[n]);
+        _pairGradients.resize(_pairs.offsets[n]);
+        _wallGradients.resize(n);
+
+        parallelFor(0, n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                Vec3 xi = x.get(i);
+                float wallKernel;
+                Vec3 wallGradient;
+                sampleWalls(xi, wallKernel, wallGradient);
+                density[i] += m * wallKernel;
+                _wallGradients[i] = wallGradient;
+
+                // walls don't move, they only add to the first term
+                Vec3 sumGradient = m * wallGradient;
+                float sumSquaredGradient = 0.0f;
+                uint32_t k = _pairs.offsets[i];
+                for (uint32_t j : lists.neighbors(i))
+                {
+                    Vec3 r = xi - x.get(j);
+                    float distanceSquared = glm::dot(r, r);
+                    if (distanceSquared >= radiusSquared)
+                    {
+                        continue;
+                    }
+                    Vec3 gradient = _kernelTable.derivativeOverDistance(distanceSquared) * r;
+                    _pairs.indices[k] = j;
+                    _pairGradients[k++] = gradient;
+                    sumGradient += m * gradient;
+                    sumSquaredGradient += m * m * glm::dot(gradient, gradient);
+                }
+                float denominator = glm::dot(sumGradient, sumGradient) + sumSquaredGradient;
+                factor[i] = denominator > 1e-6f ? density[i] / denominator : 0.0f;
+            }
+        });
+    }
+
+    /*
+     * Jacobi iterations on the velocities. The error of particle i is
+     * rho_i - rho_0 + dt * Drho_i/Dt for the constant density solve and
+     * dt * Drho_i/Dt for the divergence-free solve, it is corrected by
+     * v_i -= dt * sum m (kappa_i / rho_i + kappa_j / rho_j) grad W_ij.
+     * The accumulated stiffness never goes negative, so pressure only pushes.
+     */
+    void solvePressure(float timeInterval, bool constantDensity, size_t stiffnessChannel, float tolerance,
+                       int minIterations, int maxIterations, int &iterations, float &error)
+    {
+        VectorChannelView<const float> x = particles.positions();
+        VectorChannelView<float> v = particles.velocities();
+        Span<const float> density = particles.scalarChannel(densityChannel);
+        Span<const float> factor = particles.scalarChannel(factorChannel);
+        Span<float> stiffness = particles.scalarChannel(stiffnessChannel);
+        Span<float> kappa = particles.scalarChannel(_kappaChannel);
+        const float m = particleMass;
+        const float inverseDt2 = 1.0f / (timeInterval * timeInterval);
+        const size_t n = x.size;
+
+        const uint32_t *offsets = _pairs.offsets.data();
+        const uint32_t *indices = _pairs.indices.data();
+        const Vec3 *gradients = _pairGradients.data();
+        const Vec3 *wallGradients = _wallGradients.data();
+
+        auto predictError = [&](size_t i) {
+            Vec3 vi = v.get(i);
+            float densityRate = 0.0f;
+            for (uint32_t k = offsets[i]; k < offsets[i + 1]; k++)
+            {
+                densityRate += glm::dot(vi - v.get(indices[k]), gradients[k]);
+            }
+            densityRate += glm::dot(vi, wallGradients[i]);
+            int count = static_cast<int>(offsets[i + 1] - offsets[i]);
+            float e = timeInterval * m * densityRate;
+            if (constantDensity)
+            {
+                return e + density[i] - targetDensity;
+            }
+            // the divergence of a sparse neighborhood is mostly noise, solving it injects energy into splashes
+            return count >= minDivergenceNeighbors ? e : 0.0f;
+        };
+
+        auto applyKappa = [&]() {
+            parallelFor(0, n, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                {
+                    float ki = kappa[i] / density[i];
+                    // the wall pushes back with the particle's own pressure
+                    Vec3 dv = ki * wallGradients[i];
+                    for (uint32_t k = offsets[i]; k < offsets[i + 1]; k++)
+                    {
+                        uint32_t j = indices[k];
+                        dv += (ki + kappa[j] / density[j]) * gradients[k];
+                    }
+                    v.set(i, limitToDomain(x.get(i), v.get(i) - timeInterval * m * dv, timeInterval));
+                }
+            });
+        };
+
+        // the stiffness is stored times dt^2, so it carries over when the step size changes
+        if (warmStart)
+        {
+            parallelFor(0, n, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                {
+                    stiffness[i] = predictError(i) > 0.0f ? warmStartFactor * stiffness[i] : 0.0f;
+                    kappa[i] = stiffness[i] * inverseDt2;
+                }
+            });
+            applyKappa();
+        }
+        else
+        {
+            std::fill(stiffness.begin(), stiffness.end(), 0.0f);
+        }
+
+        std::mutex mutex;
+        for (iterations = 0;; iterations++)
+        {
+            double sum = 0.0;
+            parallelFor(0, n, [&](size_t begin, size_t end) {
+                double localSum = 0.0;
+                for (size_t i = begin; i < end; i++)
+                {
+                    // expansion is only corrected as far as it undoes the warm start
+                    float e = predictError(i);
+                    float scale = relaxation * factor[i];
+                    float increment = std::max(e * scale, -stiffness[i]);
+                    stiffness[i] += increment;
+                    kappa[i] = increment * inverseDt2;
+                    localSum += scale > 0.0f ? std::abs(increment) / scale : std::max(e, 0.0f);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                sum += localSum;
+            });
+            error = static_cast<float>(sum / n) / targetDensity;
+            if (iterations >= maxIterations || (iterations >= minIterations && error <= tolerance))
+            {
+                break;
+            }
+            applyKappa();
+        }
+    }
+
+    /*
+     * The wall densities only push back gradually, a velocity that would carry
+     * the particle out of the domain within the step is cut down to stop at the
+     * wall, so the predicted densities see the particles piling up against it.
+     */
+    Vec3 limitToDomain(const Vec3 &position, Vec3 velocity, float timeInterval) const
+    {
+        const float inverseDt = 1.0f / timeInterval;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            velocity[axis] = std::max(velocity[axis], (domainLower[axis] - position[axis]) * inverseDt);
+            velocity[axis] = std::min(velocity[axis], (domainUpper[axis] - position[axis]) * inverseDt);
+        }
+        return velocity;
+    }
+
+    void applyForces(float timeInterval)
+    {
+        VectorChannelView<const float> x = particles.positions();
+        VectorChannelView<float> v = particles.velocities();
+        VectorChannelView<const float> f = particles.forces();
+        const float scale = timeInterval / particleMass;
+        parallelFor(0, v.size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                v.set(i, limitToDomain(x.get(i), v.get(i) + scale * f.get(i), timeInterval));
+            }
+        });
+    }
+
+    void advectPositions(float timeInterval)
+    {
+        VectorChannelView<float> x = particles.positions();
+        VectorChannelView<float> v = particles.velocities();
+        parallelFor(0, x.size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                Vec3 velocity = v.get(i);
+                Vec3 position = x.get(i) + timeInterval * velocity;
+                resolveDomainCollision(position, velocity);
+                v.set(i, velocity);
+                x.set(i, position);
+            }
+        });
+    }
+
+private:
+    CubicSplineKernel<float> _kernel;
+    // densities and pair gradients come from the table, without a square root per pair
+    TabulatedKernel<CubicSplineKernel<float>> _kernelTable;
+    size_t _kappaChannel;
+    // pairs closer than the kernel radius, rebuilt every step
+    NeighborLists _pairs;
+    std::vector<Vec3> _pairGradients;
+    std::vector<Vec3> _wallGradients;
+
+    DfsphStatistics _lastStepStatistics;
+    unsigned long long _totalDensityIterations = 0;
+    unsigned long long _totalDivergenceIterations = 0;
+};
+#endif
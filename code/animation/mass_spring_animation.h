@@ -0,0 +1,1395 @@
+#ifndef _MASS_SPRING_ANIMATION_H_
+#define _MASS_SPRING_ANIMATION_H_
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include "animation.h"
+#include "block_tridiagonal.h"
+#include "checkpoint.h"
+#include "curl_noise_field.h"
+#include "field.h"
+#include "morton.h"
+#include "sparse_cholesky.h"
+#include "thread_pool.h"
+
+enum class MassSpringIntegrator
+{
+    SymplecticEuler,
+    // linearized backward Euler, stable at any step, solved with preconditioned conjugate gradient
+    BackwardEuler,
+    // local/global backward Euler on positions, the global matrix is factorized once per topology
+    ProjectiveDynamics
+};
+
+/* how the spring forces are summed into the particles */
+enum class SpringAssembly
+{
+    // edge by edge on one thread
+    Serial,
+    // the edges of one color share no particle and scatter in parallel without atomics
+    Colored,
+    // every particle sums its own springs in parallel, each spring is evaluated twice
+    Gather
+};
+
+struct ImplicitSolveStatistics
+{
+    // solved exactly along chains instead of iteratively
+    bool direct = false;
+    int iterations = 0;
+    // |b - A dv| / |b| when the solve stopped
+    float residual = 0.0f;
+};
+
+/*
+ * Mass-spring solver. It owns no window or GL resources, so it can be
+ * stepped headless or driven by a viewer.
+ */
+class MassSpringAnimation : public PhysicsAnimation, public Checkpointable
+{
+public:
+    using Vec3 = glm::vec3;
+
+    struct Edge
+    {
+        int first;
+        int second;
+    };
+
+    struct Constraint
+    {
+        int pointIndex;
+        Vec3 fixedPosition;
+        Vec3 fixedVelocity;
+    };
+
+    MassSpringAnimation(int num = 5) : PhysicsAnimation()
+    {
+        numberOfPoints = num;
+        setParameter();
+        makeChain();
+    }
+
+    void setParameter()
+    {
+        mass = 1.0;
+        gravity = Vec3(0.0, -9.8, 0.0);
+        stiffness = 500.0;
+        restLength = 2.0;
+        dampingCoefficient = 1.0;
+        dragCoefficient = 0.1;
+
+        floorPositionY = -10.0;
+        restitutionCoefficient = 0.3;
+
+        constraints.clear();
+        constraints.push_back(Constraint{0, Vec3(0), Vec3(0)});
+        wind = std::make_shared<ConstantVectorField>(Vec3(30.0, 0, 0));
+    }
+
+    void makeChain()
+    {
+        if (numberOfPoints == 0)
+        {
+            return;
+        }
+
+        int numberOfEdges = numberOfPoints - 1;
+
+        positions.resize(numberOfPoints);
+        velocities.resize(numberOfPoints);
+        forces.resize(numberOfPoints);
+        edges.resize(numberOfEdges);
+
+        for (int i = 0; i < numberOfPoints; ++i)
+        {
+            positions[i] = glm::vec3(-static_cast<float>(i), 0, 0);
+        }
+
+        for (int i = 0; i < numberOfEdges; ++i)
+        {
+            edges[i] = Edge{i, i + 1};
+        }
+        particleIds.resize(numberOfPoints);
+        std::iota(particleIds.begin(), particleIds.end(), 0);
+        _velocityChange.clear();
+        updateTopology();
+    }
+
+    /* width x height grid of structural springs in the horizontal plane, hung from two corners */
+    void makeCloth(int width, int height)
+    {
+        if (width <= 0 || height <= 0)
+        {
+            return;
+        }
+        numberOfPoints = width * height;
+        positions.resize(numberOfPoints);
+        velocities.assign(numberOfPoints, Vec3(0));
+        forces.resize(numberOfPoints);
+        edges.clear();
+        for (int row = 0; row < height; row++)
+        {
+            for (int column = 0; column < width; column++)
+            {
+                int i = row * width + column;
+                positions[i] = Vec3(restLength * column, 0, restLength * row);
+                if (column + 1 < width)
+                {
+                    edges.push_back(Edge{i, i + 1});
+                }
+                if (row + 1 < height)
+                {
+                    edges.push_back(Edge{i, i + width});
+                }
+            }
+        }
+        constraints.clear();
+        constraints.push_back(Constraint{0, positions[0], Vec3(0)});
+        if (width > 1)
+        {
+            constraints.push_back(Constraint{width - 1, positions[width - 1], Vec3(0)});
+        }
+        particleIds.resize(numberOfPoints);
+        std::iota(particleIds.begin(), particleIds.end(), 0);
+        _velocityChange.clear();
+        updateTopology();
+    }
+
+    /* recompute everything derived from edges, call after editing them */
+    void updateTopology()
+    {
+        buildEdgeLayout();
+        _projectiveAnalyzed = false;
+    }
+
+    /* true if the springs form disjoint paths (ropes, hair), the implicit system is then block tridiagonal */
+    bool isChainTopology() const { return _isChain; }
+    size_t numberOfChains() const { return _isChain ? _chainOffsets.size() - 1 : 0; }
+    size_t numberOfEdgeColors() const { return _colorOffsets.size() - 1; }
+
+    /*
+     * Sort particles along a Morton curve so neighbors in space are neighbors
+     * in memory, and remap edges and constraints to the new indices.
+     */
+    void reorderParticles()
+    {
+        std::vector<uint32_t> order = mortonOrder(Span<const Vec3>(positions));
+        std::vector<int> newIndex(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            newIndex[order[i]] = static_cast<int>(i);
+        }
+
+        auto gather = [&order](auto &values) {
+            std::remove_reference_t<decltype(values)> sorted(values.size());
+            for (size_t i = 0; i < order.size(); i++)
+            {
+                sorted[i] = values[order[i]];
+            }
+            values.swap(sorted);
+        };
+        gather(positions);
+        gather(velocities);
+        gather(forces);
+        gather(particleIds);
+        if (_velocityChange.size() == order.size())
+        {
+            gather(_velocityChange);
+        }
+
+        for (Edge &edge : edges)
+        {
+            edge.first = newIndex[edge.first];
+            edge.second = newIndex[edge.second];
+            if (edge.first > edge.second)
+            {
+                std::swap(edge.first, edge.second);
+            }
+        }
+        // visit springs in particle order too, so the edge loop streams through memory
+        std::sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) {
+            return a.first != b.first ? a.first < b.first : a.second < b.second;
+        });
+        for (Constraint &constraint : constraints)
+        {
+            constraint.pointIndex = newIndex[constraint.pointIndex];
+        }
+        // the springs are the same, only their numbering changed: the projective
+        // factor stays valid once its rows point at the moved particles
+        buildEdgeLayout();
+        remapProjectiveSystem(newIndex);
+        stepsSinceReorder = 0;
+    }
+
+    void saveState(CheckpointWriter &writer) const override
+    {
+        writer.write(numberOfPoints);
+        writer.write(mass);
+        writer.write(gravity);
+        writer.write(stiffness);
+        writer.write(restLength);
+        writer.write(dampingCoefficient);
+        writer.write(dragCoefficient);
+        writer.write(floorPositionY);
+        writer.write(restitutionCoefficient);
+        writer.write(wind != nullptr ? wind->getValue() : Vec3(0));
+        writer.write(static_cast<int>(turbulence != nullptr));
+        writer.write(turbulence != nullptr ? turbulence->parameters() : CurlNoiseField::Parameters());
+        writer.writeArray(positions);
+        writer.writeArray(velocities);
+        writer.writeArray(forces);
+        writer.writeArray(edges);
+        writer.writeArray(constraints);
+        // everything else the next steps depend on, so a restored run continues bit for bit
+        writer.write(timeAccumulator());
+        writer.write(reorderInterval);
+        writer.write(stepsSinceReorder);
+        writer.write(integrator);
+        writer.write(maxSolverIterations);
+        writer.write(solverTolerance);
+        writer.write(static_cast<int>(chainSolver));
+        writer.write(projectiveIterations);
+        writer.writeArray(_velocityChange);
+        writer.writeArray(particleIds);
+    }
+
+    void loadState(CheckpointReader &reader) override
+    {
+        // read and validate everything before touching the members, a bad checkpoint
+        // leaves the running animation as it was
+        int loadedPoints = reader.read<int>();
+        float loadedMass = reader.read<float>();
+        Vec3 loadedGravity = reader.read<Vec3>();
+        float loadedStiffness = reader.read<float>();
+        float loadedRestLength = reader.read<float>();
+        float loadedDamping = reader.read<float>();
+        float loadedDrag = reader.read<float>();
+        float loadedFloor = reader.read<float>();
+        float loadedRestitution = reader.read<float>();
+        Vec3 loadedWind = reader.read<Vec3>();
+        bool hasTurbulence = reader.read<int>() != 0;
+        CurlNoiseField::Parameters turbulenceParameters = reader.read<CurlNoiseField::Parameters>();
+        std::vector<Vec3> loadedPositions, loadedVelocities, loadedForces, loadedVelocityChange;
+        std::vector<Edge> loadedEdges;
+        std::vector<Constraint> loadedConstraints;
+        reader.readArray(loadedPositions);
+        reader.readArray(loadedVelocities);
+        reader.readArray(loadedForces);
+        reader.readArray(loadedEdges);
+        reader.readArray(loadedConstraints);
+        double time = reader.read<double>();
+        int loadedReorderInterval = reader.read<int>();
+        int loadedStepsSinceReorder = reader.read<int>();
+        MassSpringIntegrator loadedIntegrator = reader.read<MassSpringIntegrator>();
+        int loadedSolverIterations = reader.read<int>();
+        float loadedTolerance = reader.read<float>();
+        bool loadedChainSolver = reader.read<int>() != 0;
+        int loadedProjectiveIterations = reader.read<int>();
+        reader.readArray(loadedVelocityChange);
+        std::vector<int> loadedIds;
+        reader.readArray(loadedIds);
+
+        // trailing bytes mean the payload isn't the layout written above
+        size_t n = loadedPositions.size();
+        bool consistent = reader.remaining() == 0 && loadedPoints >= 0 && static_cast<size_t>(loadedPoints) == n &&
+                          loadedVelocities.size() == n && loadedForces.size() == n && loadedIds.size() == n &&
+                          (loadedVelocityChange.empty() || loadedVelocityChange.size() == n) &&
+                          loadedIntegrator >= MassSpringIntegrator::SymplecticEuler &&
+                          loadedIntegrator <= MassSpringIntegrator::ProjectiveDynamics &&
+                          (!hasTurbulence || (turbulenceParameters.octaves >= 0 &&
+                                              turbulenceParameters.octaves <= kMaxTurbulenceOctaves));
+        for (const Edge &edge : loadedEdges)
+        {
+            consistent = consistent && edge.first >= 0 && edge.second >= 0 &&
+                         static_cast<size_t>(edge.first) < n && static_cast<size_t>(edge.second) < n;
+        }
+        for (const Constraint &constraint : loadedConstraints)
+        {
+            consistent = consistent && constraint.pointIndex >= 0 && static_cast<size_t>(constraint.pointIndex) < n;
+        }
+        for (int id : loadedIds)
+        {
+            consistent = consistent && id >= 0 && static_cast<size_t>(id) < n;
+        }
+        if (!consistent)
+        {
+            throw std::runtime_error("inconsistent mass spring checkpoint");
+        }
+
+        numberOfPoints = loadedPoints;
+        mass = loadedMass;
+        gravity = loadedGravity;
+        stiffness = loadedStiffness;
+        restLength = loadedRestLength;
+        dampingCoefficient = loadedDamping;
+        dragCoefficient = loadedDrag;
+        floorPositionY = loadedFloor;
+        restitutionCoefficient = loadedRestitution;
+        wind = std::make_shared<ConstantVectorField>(loadedWind);
+        turbulence = hasTurbulence ? std::make_shared<CurlNoiseField>(turbulenceParameters) : nullptr;
+        positions.swap(loadedPositions);
+        velocities.swap(loadedVelocities);
+        forces.swap(loadedForces);
+        edges.swap(loadedEdges);
+        constraints.swap(loadedConstraints);
+        reorderInterval = loadedReorderInterval;
+        stepsSinceReorder = loadedStepsSinceReorder;
+        integrator = loadedIntegrator;
+        maxSolverIterations = loadedSolverIterations;
+        solverTolerance = loadedTolerance;
+        chainSolver = loadedChainSolver;
+        projectiveIterations = loadedProjectiveIterations;
+        _velocityChange.swap(loadedVelocityChange);
+        particleIds.swap(loadedIds);
+        setTimeAccumulator(time);
+        updateTopology();
+    }
+
+    int numberOfPoints;
+    float mass;
+    Vec3 gravity;
+    float stiffness;
+    float restLength;
+    float dampingCoefficient;
+    float dragCoefficient;
+
+    float floorPositionY;
+    float restitutionCoefficient;
+
+    std::vector<Vec3> positions;
+    std::vector<Vec3> velocities;
+    std::vector<Vec3> forces;
+    std::vector<Edge> edges;
+    int maxDegree = 0;
+    // substeps between Morton reorders, 0 never reorders
+    int reorderInterval = 0;
+    int stepsSinceReorder = 0;
+    // particle each slot holds, in creation order. Reorders move the ids along, so caches
+    // and snapshots written with them can follow a particle across frames
+    std::vector<int> particleIds;
+
+    std::shared_ptr<ConstantVectorField> wind;
+    // gusts added to the wind, none by default
+    std::shared_ptr<CurlNoiseField> turbulence;
+    std::vector<Constraint> constraints;
+
+    SpringAssembly springAssembly = SpringAssembly::Colored;
+    MassSpringIntegrator integrator = MassSpringIntegrator::SymplecticEuler;
+    // limits of the conjugate gradient solve of the implicit integrator
+    int maxSolverIterations = 200;
+    float solverTolerance = 1e-5f;
+    // solve chain topologies directly in linear time instead of with conjugate gradient
+    bool chainSolver = true;
+
+    // local/global rounds per step of projective dynamics
+    int projectiveIterations = 10;
+
+    const ImplicitSolveStatistics &lastSolveStatistics() const { return _lastSolve; }
+    unsigned long long totalSolverIterations() const { return _totalSolverIterations; }
+    unsigned long long numberOfImplicitSteps() const { return _implicitSteps; }
+    // symbolic analyses and numeric factorizations of the projective dynamics matrix so far
+    unsigned long long numberOfAnalyses() const { return _analyses; }
+    unsigned long long numberOfFactorizations() const { return _factorizations; }
+    const SparseCholesky &projectiveFactor() const { return _projectiveFactor; }
+
+protected:
+    float maxVelocity() const override
+    {
+        float result = 0.0f;
+        for (const Vec3 &v : velocities)
+        {
+            result = std::max(result, glm::length(v));
+        }
+        return result;
+    }
+    float maxForce() const override
+    {
+        float result = 0.0f;
+        for (const Vec3 &f : forces)
+        {
+            result = std::max(result, glm::length(f));
+        }
+        return result / mass;
+    }
+    float stabilityTimeStepLimit() const override
+    {
+        // Gershgorin bound on the highest spring mode: omega^2 <= 2 * degree * k / m,
+        // symplectic Euler needs dt < 2 / omega, keep half of that as margin
+        if (maxDegree == 0 || stiffness <= 0)
+        {
+            return 0.0f;
+        }
+        if (integrator != MassSpringIntegrator::SymplecticEuler)
+        {
+            return 0.0f;
+        }
+        float omega = std::sqrt(2.0f * maxDegree * stiffness / mass);
+        return 0.5f * (2.0f / omega);
+    }
+    float characteristicLength() const override
+    {
+        return restLength;
+    }
+    bool requiresFixedSubsteps() const override
+    {
+        // the projective system depends on h, every new step length would refactorize it
+        return integrator == MassSpringIntegrator::ProjectiveDynamics;
+    }
+
+    void onAdvanceTimeStep(float timeInterval) override
+    {
+        if (reorderInterval > 0 && ++stepsSinceReorder >= reorderInterval)
+        {
+            reorderParticles();
+        }
+
+        if (integrator == MassSpringIntegrator::ProjectiveDynamics)
+        {
+            solveProjectiveDynamics(timeInterval);
+        }
+        else
+        {
+            accumulateForces();
+            if (integrator == MassSpringIntegrator::BackwardEuler)
+            {
+                solveBackwardEuler(timeInterval);
+            }
+            else
+            {
+                for (size_t i = 0; i < positions.size(); i++)
+                {
+                    velocities[i] += timeInterval * (forces[i] * (1.0f / mass));
+                }
+            }
+        }
+        advancePositions(timeInterval);
+    }
+
+    /* gravity, drag and spring forces at the current state */
+    void accumulateForces()
+    {
+        // the wind velocities go into the force array first, one batched call instead of one per particle
+        sampleWind();
+        for (int i = 0; i < positions.size(); i++)
+        {
+            // Air drag
+            Vec3 relativeVel = velocities[i] - forces[i];
+            // Gravity
+            forces[i] = gravity * float(mass) - dragCoefficient * relativeVel;
+        }
+
+        switch (springAssembly)
+        {
+        case SpringAssembly::Serial:
+            // spring and damping are added one after the other as they always were, so this
+            // path keeps the rounding of the explicit integrator the other assemblies reorder
+            for (size_t e = 0; e < edges.size(); e++)
+            {
+                int pid0 = edges[e].first, pid1 = edges[e].second;
+                Vec3 force = elasticForce(edges[e]);
+                forces[pid0] += force;
+                forces[pid1] -= force;
+                Vec3 damping = dampingForce(edges[e]);
+                forces[pid0] += damping;
+                forces[pid1] -= damping;
+            }
+            break;
+        case SpringAssembly::Colored:
+            for (size_t color = 0; color + 1 < _colorOffsets.size(); color++)
+            {
+                parallelFor(_colorOffsets[color], _colorOffsets[color + 1], [this](size_t begin, size_t end) {
+                    for (size_t k = begin; k < end; k++)
+                    {
+                        const Edge &edge = edges[_coloredEdges[k]];
+                        Vec3 force = springForce(edge);
+                        forces[edge.first] += force;
+                        forces[edge.second] -= force;
+                    }
+                });
+            }
+            break;
+        case SpringAssembly::Gather:
+            parallelFor(0, positions.size(), [this](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                {
+                    Vec3 sum(0.0f);
+                    for (uint32_t k = _incidenceOffsets[i]; k < _incidenceOffsets[i + 1]; k++)
+                    {
+                        const Edge &edge = edges[_incidentEdges[k]];
+                        Vec3 force = springForce(edge);
+                        sum += edge.first == static_cast<int>(i) ? force : -force;
+                    }
+                    forces[i] += sum;
+                }
+            });
+            break;
+        }
+    }
+
+    /* spring and damping force of an edge on its first particle, the second gets the negative */
+    Vec3 springForce(const Edge &edge) const
+    {
+        return dampingForce(edge) + elasticForce(edge);
+    }
+
+    /* Hooke's law on the first particle of the edge */
+    Vec3 elasticForce(const Edge &edge) const
+    {
+        Vec3 r = positions[edge.first] - positions[edge.second];
+        float distance = glm::length(r);
+        return distance > 0 ? -stiffness * (distance - restLength) * glm::normalize(r) : Vec3(0);
+    }
+
+    /* damping of the relative velocity on the first particle of the edge */
+    Vec3 dampingForce(const Edge &edge) const
+    {
+        return -dampingCoefficient * (velocities[edge.first] - velocities[edge.second]);
+    }
+
+    /* wind and turbulence velocities at the particles, stored in the force array */
+    void sampleWind()
+    {
+        if (wind != nullptr)
+        {
+            wind->sample(Span<const Vec3>(positions), Span<Vec3>(forces));
+        }
+        else
+        {
+            std::fill(forces.begin(), forces.end(), Vec3(0));
+        }
+        if (turbulence != nullptr)
+        {
+            _gusts.resize(positions.size());
+            turbulence->sample(Span<const Vec3>(positions), Span<Vec3>(_gusts));
+            for (size_t i = 0; i < positions.size(); i++)
+            {
+                forces[i] += _gusts[i];
+            }
+        }
+    }
+
+    /* x += dt v with the floor collision, then the constraints */
+    void advancePositions(float timeInterval)
+    {
+        // Update states
+        for (int i = 0; i < positions.size(); ++i)
+        {
+            // Compute new states
+            Vec3 newVelocity = velocities[i];
+            Vec3 newPosition = positions[i] + timeInterval * newVelocity;
+
+            // Collision
+            if (newPosition.y < floorPositionY)
+            {
+                newPosition.y = floorPositionY;
+
+                if (newVelocity.y < 0.0)
+                {
+                    newVelocity.y *= -restitutionCoefficient;
+                    newPosition.y += timeInterval * newVelocity.y;
+                }
+            }
+
+            // Update states
+            velocities[i] = newVelocity;
+            positions[i] = newPosition;
+        }
+
+        // Apply constraints
+        for (int i = 0; i < constraints.size(); ++i)
+        {
+            size_t pointIndex = constraints[i].pointIndex;
+            positions[pointIndex] = constraints[i].fixedPosition;
+            velocities[pointIndex] = constraints[i].fixedVelocity;
+        }
+    }
+
+    /*
+     * One Newton step of backward Euler (Baraff & Witkin):
+     *   (M - h df/dv - h^2 df/dx) dv = h (f + h df/dx v)
+     * The system is applied matrix free and solved with block Jacobi
+     * preconditioned conjugate gradient. Constrained particles keep their
+     * prescribed velocity, the solve filters them out of the residual.
+     */
+    void solveBackwardEuler(float timeInterval)
+    {
+        const size_t n = positions.size();
+        const float h = timeInterval;
+        updateSpringJacobians();
+        _constrained.assign(n, 0);
+        _rhs.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            _rhs[i] = h * forces[i];
+        }
+        // h^2 df/dx v
+        for (size_t e = 0; e < edges.size(); e++)
+        {
+            int i = edges[e].first, j = edges[e].second;
+            Vec3 term = (h * h) * springJacobianProduct(e, velocities[i] - velocities[j]);
+            _rhs[i] += term;
+            _rhs[j] -= term;
+        }
+        // warm start from the last velocity change, the motion of a rope changes little between steps
+        if (_velocityChange.size() != n)
+        {
+            _velocityChange.assign(n, Vec3(0.0f));
+        }
+        for (const Constraint &constraint : constraints)
+        {
+            size_t i = constraint.pointIndex;
+            _constrained[i] = 1;
+            _velocityChange[i] = constraint.fixedVelocity - velocities[i];
+        }
+
+        if (chainSolver && _isChain)
+        {
+            solveChains(h);
+            for (size_t i = 0; i < n; i++)
+            {
+                velocities[i] += _velocityChange[i];
+            }
+            _lastSolve = ImplicitSolveStatistics();
+            _lastSolve.direct = true;
+            _implicitSteps++;
+            return;
+        }
+
+        buildPreconditioner(h);
+        _residual.resize(n);
+        _product.resize(n);
+        _preconditioned.resize(n);
+        _direction.resize(n);
+        applySystem(h, _velocityChange, _product);
+        double rhsNorm = 0.0;
+        for (size_t i = 0; i < n; i++)
+        {
+            _residual[i] = _constrained[i] ? Vec3(0.0f) : _rhs[i] - _product[i];
+            rhsNorm += _constrained[i] ? 0.0 : glm::dot(_rhs[i], _rhs[i]);
+        }
+        rhsNorm = std::sqrt(rhsNorm);
+        precondition(_residual, _preconditioned);
+        _direction = _preconditioned;
+        double rz = dot(_residual, _preconditioned);
+        double residualNorm = std::sqrt(dot(_residual, _residual));
+
+        int iteration = 0;
+        while (iteration < maxSolverIterations && residualNorm > solverTolerance * rhsNorm)
+        {
+            applySystem(h, _direction, _product);
+            filter(_product);
+            double pq = dot(_direction, _product);
+            if (pq <= 0.0)
+            {
+                break;
+            }
+            float alpha = static_cast<float>(rz / pq);
+            for (size_t i = 0; i < n; i++)
+            {
+                _velocityChange[i] += alpha * _direction[i];
+                _residual[i] -= alpha * _product[i];
+            }
+            iteration++;
+            residualNorm = std::sqrt(dot(_residual, _residual));
+            precondition(_residual, _preconditioned);
+            double rzNext = dot(_residual, _preconditioned);
+            float beta = static_cast<float>(rzNext / rz);
+            rz = rzNext;
+            for (size_t i = 0; i < n; i++)
+            {
+                _direction[i] = _preconditioned[i] + beta * _direction[i];
+            }
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            velocities[i] += _velocityChange[i];
+        }
+        _lastSolve.direct = false;
+        _lastSolve.iterations = iteration;
+        _lastSolve.residual = rhsNorm > 0.0 ? static_cast<float>(residualNorm / rhsNorm) : 0.0f;
+        _totalSolverIterations += iteration;
+        _implicitSteps++;
+    }
+
+    /*
+     * Projective dynamics (Liu et al., fast simulation of mass-spring systems):
+     * backward Euler as the minimization over positions x of
+     *   m / 2h^2 |x - x0 - h v0|^2 + sum k / 2 |x_i - x_j - d_ij|^2 - m g x
+     * with every d_ij a vector of rest length. The local step fits d_ij to x
+     * spring by spring, the global step solves for x with d_ij fixed, against
+     *   (m / h^2 + c_drag / h) I + (k + c_damp / h) L
+     * where L is the graph Laplacian of the springs. Drag and damping are
+     * linear in x and join the matrix, which only changes with the topology,
+     * the constraints or the parameters. One factorization serves all three
+     * axes and every round is two sparse triangular solves.
+     */
+    void solveProjectiveDynamics(float timeInterval)
+    {
+        const size_t n = positions.size();
+        const float h = timeInterval;
+        const float springWeight = stiffness + dampingCoefficient / h;
+        updateProjectiveSystem(h);
+        const size_t rows = _projectiveParticles.size();
+        // the wind velocities go into the force array
+        sampleWind();
+
+        // right hand side without the spring directions, x0 is still in positions
+        _projectiveBase.resize(rows);
+        for (size_t row = 0; row < rows; row++)
+        {
+            const int i = _projectiveParticles[row];
+            _projectiveBase[row] = (mass / (h * h)) * (positions[i] + h * velocities[i]) +
+                                   (dragCoefficient / h) * (positions[i] + h * forces[i]) + mass * gravity;
+        }
+        _projectivePositions.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            _projectivePositions[i] = positions[i] + h * velocities[i];
+        }
+        for (const Constraint &constraint : constraints)
+        {
+            _projectivePositions[constraint.pointIndex] = constraint.fixedPosition;
+        }
+        for (const Edge &edge : edges)
+        {
+            int a = _projectiveRow[edge.first], b = _projectiveRow[edge.second];
+            Vec3 damping = (dampingCoefficient / h) * (positions[edge.first] - positions[edge.second]);
+            if (a >= 0)
+            {
+                _projectiveBase[a] += damping;
+                if (b < 0)
+                {
+                    _projectiveBase[a] += springWeight * _projectivePositions[edge.second];
+                }
+            }
+            if (b >= 0)
+            {
+                _projectiveBase[b] -= damping;
+                if (a < 0)
+                {
+                    _projectiveBase[b] += springWeight * _projectivePositions[edge.first];
+                }
+            }
+        }
+
+        _projections.resize(edges.size());
+        _projectiveRhs.resize(3 * rows);
+        for (int iteration = 0; iteration < projectiveIterations; iteration++)
+        {
+            // local step, every spring on its own
+            parallelFor(0, edges.size(), [&](size_t begin, size_t end) {
+                for (size_t e = begin; e < end; e++)
+                {
+                    Vec3 r = _projectivePositions[edges[e].first] - _projectivePositions[edges[e].second];
+                    float distance = glm::length(r);
+                    _projections[e] = distance > 0.0f ? (restLength / distance) * r : r;
+                }
+            });
+            // global step
+            for (size_t row = 0; row < rows; row++)
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    _projectiveRhs[3 * row + axis] = _projectiveBase[row][axis];
+                }
+            }
+            for (size_t e = 0; e < edges.size(); e++)
+            {
+                int a = _projectiveRow[edges[e].first], b = _projectiveRow[edges[e].second];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    if (a >= 0)
+                    {
+                        _projectiveRhs[3 * a + axis] += stiffness * _projections[e][axis];
+                    }
+                    if (b >= 0)
+                    {
+                        _projectiveRhs[3 * b + axis] -= stiffness * _projections[e][axis];
+                    }
+                }
+            }
+            _projectiveFactor.solve(Span<double>(_projectiveRhs), 3);
+            for (size_t row = 0; row < rows; row++)
+            {
+                _projectivePositions[_projectiveParticles[row]] =
+                    Vec3(_projectiveRhs[3 * row], _projectiveRhs[3 * row + 1], _projectiveRhs[3 * row + 2]);
+            }
+        }
+
+        // advancePositions moves the particles along these velocities and handles the floor
+        for (size_t i = 0; i < n; i++)
+        {
+            Vec3 velocity = (_projectivePositions[i] - positions[i]) / h;
+            forces[i] = (mass / h) * (velocity - velocities[i]);
+            velocities[i] = velocity;
+        }
+    }
+
+private:
+    // a checkpoint asking for more octaves than this is corrupted, not a real setting
+    static const int kMaxTurbulenceOctaves = 16;
+
+    /*
+     * df_i/dx_i of a spring, -k (c I + (1 - c) d d^T) with c = max(1 - L / l, 0).
+     * Dropping the compressed part of c keeps the system positive definite.
+     */
+    struct SpringJacobian
+    {
+        Vec3 direction;
+        float isotropic;
+    };
+
+    void updateSpringJacobians()
+    {
+        _springJacobians.resize(edges.size());
+        for (size_t e = 0; e < edges.size(); e++)
+        {
+            Vec3 r = positions[edges[e].first] - positions[edges[e].second];
+            float distance = glm::length(r);
+            SpringJacobian &jacobian = _springJacobians[e];
+            jacobian.direction = distance > 0.0f ? r / distance : Vec3(0.0f);
+            jacobian.isotropic = distance > 0.0f ? std::max(1.0f - restLength / distance, 0.0f) : 0.0f;
+        }
+    }
+
+    /* df_i/dx_i times the relative vector */
+    Vec3 springJacobianProduct(size_t e, const Vec3 &relative) const
+    {
+        const SpringJacobian &jacobian = _springJacobians[e];
+        return -stiffness * (jacobian.isotropic * relative +
+                             (1.0f - jacobian.isotropic) * glm::dot(jacobian.direction, relative) * jacobian.direction);
+    }
+
+    /* (M - h df/dv - h^2 df/dx) p */
+    void applySystem(float h, const std::vector<Vec3> &p, std::vector<Vec3> &result) const
+    {
+        const float diagonal = mass + h * dragCoefficient;
+        for (size_t i = 0; i < p.size(); i++)
+        {
+            result[i] = diagonal * p[i];
+        }
+        for (size_t e = 0; e < edges.size(); e++)
+        {
+            int i = edges[e].first, j = edges[e].second;
+            Vec3 relative = p[i] - p[j];
+            Vec3 term = (h * dampingCoefficient) * relative - (h * h) * springJacobianProduct(e, relative);
+            result[i] += term;
+            result[j] -= term;
+        }
+    }
+
+    /* what spring e adds to the diagonal blocks of its particles, the off diagonal block is its negative */
+    glm::mat3 springBlock(size_t e, float h) const
+    {
+        const SpringJacobian &jacobian = _springJacobians[e];
+        return (h * dampingCoefficient + h * h * stiffness * jacobian.isotropic) * glm::mat3(1.0f) +
+               (h * h * stiffness * (1.0f - jacobian.isotropic)) *
+                   glm::outerProduct(jacobian.direction, jacobian.direction);
+    }
+
+    /* inverses of the 3x3 diagonal blocks of the system */
+    void buildPreconditioner(float h)
+    {
+        _preconditioner.assign(positions.size(), (mass + h * dragCoefficient) * glm::mat3(1.0f));
+        for (size_t e = 0; e < edges.size(); e++)
+        {
+            glm::mat3 block = springBlock(e, h);
+            _preconditioner[edges[e].first] += block;
+            _preconditioner[edges[e].second] += block;
+        }
+        for (glm::mat3 &block : _preconditioner)
+        {
+            block = glm::inverse(block);
+        }
+    }
+
+    void precondition(const std::vector<Vec3> &r, std::vector<Vec3> &z) const
+    {
+        for (size_t i = 0; i < r.size(); i++)
+        {
+            z[i] = _constrained[i] ? Vec3(0.0f) : _preconditioner[i] * r[i];
+        }
+    }
+
+    void filter(std::vector<Vec3> &v) const
+    {
+        for (size_t i = 0; i < v.size(); i++)
+        {
+            if (_constrained[i])
+            {
+                v[i] = Vec3(0.0f);
+            }
+        }
+    }
+
+    /*
+     * Walk the paths formed by the springs. Every particle has at most two
+     * springs and no path closes into a loop, otherwise the topology is no chain.
+     * Isolated particles are chains of one.
+     */
+    void findChains()
+    {
+        const int n = static_cast<int>(positions.size());
+        _isChain = maxDegree <= 2;
+        _chainOrder.clear();
+        _chainEdges.clear();
+        _chainOffsets.assign(1, 0);
+        // the two springs of every particle, -1 if missing
+        std::vector<glm::ivec2> springsOf(_isChain ? n : 0, glm::ivec2(-1));
+        for (int e = 0; _isChain && e < static_cast<int>(edges.size()); e++)
+        {
+            if (edges[e].first == edges[e].second)
+            {
+                _isChain = false;
+                break;
+            }
+            for (int end : {edges[e].first, edges[e].second})
+            {
+                glm::ivec2 &springs = springsOf[end];
+                (springs.x < 0 ? springs.x : springs.y) = e;
+            }
+        }
+        if (!_isChain)
+        {
+            return;
+        }
+        std::vector<char> visited(n, 0);
+        for (int start = 0; start < n; start++)
+        {
+            if (visited[start] || springsOf[start].y >= 0)
+            {
+                continue;
+            }
+            int current = start, previousSpring = -1;
+            while (true)
+            {
+                visited[current] = 1;
+                _chainOrder.push_back(current);
+                const glm::ivec2 &springs = springsOf[current];
+                int next = springs.x != previousSpring ? springs.x : springs.y;
+                _chainEdges.push_back(next);
+                if (next < 0)
+                {
+                    break;
+                }
+                current = edges[next].first != current ? edges[next].first : edges[next].second;
+                previousSpring = next;
+            }
+            _chainOffsets.push_back(static_cast<uint32_t>(_chainOrder.size()));
+        }
+        // particles left over lie on loops
+        if (_chainOrder.size() != positions.size())
+        {
+            _isChain = false;
+            _chainOrder.clear();
+            _chainEdges.clear();
+            _chainOffsets.assign(1, 0);
+        }
+    }
+
+    /*
+     * Backward Euler along every chain with the block Thomas algorithm, chains
+     * are independent and solved in parallel. Constrained particles keep the
+     * velocity change already in _velocityChange, their columns move to the
+     * right hand side of their neighbors.
+     */
+    void solveChains(float h)
+    {
+        const size_t n = positions.size();
+        _chainLower.resize(n);
+        _chainDiagonal.resize(n);
+        _chainUpper.resize(n);
+        _chainValues.resize(n);
+        parallelFor(0, numberOfChains(), [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++)
+            {
+                const size_t first = _chainOffsets[c], last = _chainOffsets[c + 1];
+                for (size_t k = first; k < last; k++)
+                {
+                    _chainDiagonal[k] = (mass + h * dragCoefficient) * glm::mat3(1.0f);
+                    _chainLower[k] = glm::mat3(0.0f);
+                    _chainUpper[k] = glm::mat3(0.0f);
+                    _chainValues[k] = _rhs[_chainOrder[k]];
+                }
+                for (size_t k = first; k + 1 < last; k++)
+                {
+                    glm::mat3 block = springBlock(_chainEdges[k], h);
+                    _chainDiagonal[k] += block;
+                    _chainDiagonal[k + 1] += block;
+                    _chainUpper[k] = -block;
+                    _chainLower[k + 1] = -block;
+                }
+                for (size_t k = first; k < last; k++)
+                {
+                    if (!_constrained[_chainOrder[k]])
+                    {
+                        continue;
+                    }
+                    const Vec3 known = _velocityChange[_chainOrder[k]];
+                    if (k > first && !_constrained[_chainOrder[k - 1]])
+                    {
+                        _chainValues[k - 1] -= _chainUpper[k - 1] * known;
+                        _chainUpper[k - 1] = glm::mat3(0.0f);
+                    }
+                    if (k + 1 < last && !_constrained[_chainOrder[k + 1]])
+                    {
+                        _chainValues[k + 1] -= _chainLower[k + 1] * known;
+                        _chainLower[k + 1] = glm::mat3(0.0f);
+                    }
+                }
+                for (size_t k = first; k < last; k++)
+                {
+                    if (_constrained[_chainOrder[k]])
+                    {
+                        _chainDiagonal[k] = glm::mat3(1.0f);
+                        _chainLower[k] = glm::mat3(0.0f);
+                        _chainUpper[k] = glm::mat3(0.0f);
+                        _chainValues[k] = _velocityChange[_chainOrder[k]];
+                    }
+                }
+                const size_t length = last - first;
+                solveBlockTridiagonal(Span<const glm::mat3>(_chainLower.data() + first, length),
+                                      Span<glm::mat3>(_chainDiagonal.data() + first, length),
+                                      Span<glm::mat3>(_chainUpper.data() + first, length),
+                                      Span<Vec3>(_chainValues.data() + first, length));
+                for (size_t k = first; k < last; k++)
+                {
+                    _velocityChange[_chainOrder[k]] = _chainValues[k];
+                }
+            }
+        }, 16);
+    }
+
+    /*
+     * Keep the projective dynamics matrix current. Constrained particles are
+     * known and have no row. A new topology or constraint set needs a new
+     * ordering and pattern, new parameters or step only a new factorization.
+     */
+    void updateProjectiveSystem(float h)
+    {
+        const size_t n = positions.size();
+        std::vector<int> constrained;
+        for (const Constraint &constraint : constraints)
+        {
+            constrained.push_back(constraint.pointIndex);
+        }
+        std::sort(constrained.begin(), constrained.end());
+        constrained.erase(std::unique(constrained.begin(), constrained.end()), constrained.end());
+        if (!_projectiveAnalyzed || constrained != _projectiveConstrained || _projectiveRow.size() != n)
+        {
+            _projectiveConstrained = constrained;
+            _projectiveRow.assign(n, 0);
+            for (int i : constrained)
+            {
+                _projectiveRow[i] = -1;
+            }
+            _projectiveParticles.clear();
+            for (size_t i = 0; i < n; i++)
+            {
+                if (_projectiveRow[i] >= 0)
+                {
+                    _projectiveRow[i] = static_cast<int>(_projectiveParticles.size());
+                    _projectiveParticles.push_back(static_cast<int>(i));
+                }
+            }
+            const size_t rows = _projectiveParticles.size();
+            std::vector<std::vector<uint32_t>> columns(rows);
+            for (size_t row = 0; row < rows; row++)
+            {
+                columns[row].push_back(static_cast<uint32_t>(row));
+            }
+            for (const Edge &edge : edges)
+            {
+                int a = _projectiveRow[edge.first], b = _projectiveRow[edge.second];
+                if (a >= 0 && b >= 0 && a != b)
+                {
+                    columns[a].push_back(b);
+                    columns[b].push_back(a);
+                }
+            }
+            SparseMatrix &matrix = _projectiveMatrix;
+            matrix.size = rows;
+            matrix.offsets.assign(1, 0);
+            matrix.indices.clear();
+            for (std::vector<uint32_t> &row : columns)
+            {
+                std::sort(row.begin(), row.end());
+                row.erase(std::unique(row.begin(), row.end()), row.end());
+                matrix.indices.insert(matrix.indices.end(), row.begin(), row.end());
+                matrix.offsets.push_back(static_cast<uint32_t>(matrix.indices.size()));
+            }
+            matrix.values.resize(matrix.indices.size());
+            buildProjectiveSlots();
+            _projectiveFactor.analyze(matrix);
+            _projectiveAnalyzed = true;
+            _projectiveFactorized = false;
+            _analyses++;
+        }
+
+        const glm::vec4 parameters(h, mass, stiffness + dampingCoefficient / h, dragCoefficient);
+        if (_projectiveFactorized && parameters == _projectiveParameters)
+        {
+            return;
+        }
+        SparseMatrix &matrix = _projectiveMatrix;
+        std::fill(matrix.values.begin(), matrix.values.end(), 0.0);
+        for (size_t row = 0; row < matrix.size; row++)
+        {
+            auto first = matrix.indices.begin() + matrix.offsets[row];
+            auto last = matrix.indices.begin() + matrix.offsets[row + 1];
+            matrix.values[std::lower_bound(first, last, static_cast<uint32_t>(row)) - matrix.indices.begin()] =
+                mass / (h * h) + dragCoefficient / h;
+        }
+        const double springWeight = parameters.z;
+        for (size_t e = 0; e < edges.size(); e++)
+        {
+            const glm::ivec4 &slots = _projectiveSlots[e];
+            if (edges[e].first == edges[e].second)
+            {
+                continue;
+            }
+            for (int k = 0; k < 2; k++)
+            {
+                if (slots[k] >= 0)
+                {
+                    matrix.values[slots[k]] += springWeight;
+                }
+            }
+            for (int k = 2; k < 4; k++)
+            {
+                if (slots[k] >= 0)
+                {
+                    matrix.values[slots[k]] -= springWeight;
+                }
+            }
+        }
+        _projectiveFactor.factorize(matrix);
+        _projectiveParameters = parameters;
+        _projectiveFactorized = true;
+        _factorizations++;
+    }
+
+    /* where every spring adds into the projective matrix, (a, a), (b, b), (a, b) and (b, a), -1 for a constrained end */
+    void buildProjectiveSlots()
+    {
+        const SparseMatrix &matrix = _projectiveMatrix;
+        auto slot = [&matrix](int row, int column) -> int {
+            auto first = matrix.indices.begin() + matrix.offsets[row];
+            auto last = matrix.indices.begin() + matrix.offsets[row + 1];
+            return static_cast<int>(std::lower_bound(first, last, static_cast<uint32_t>(column)) -
+                                    matrix.indices.begin());
+        };
+        _projectiveSlots.resize(edges.size());
+        for (size_t e = 0; e < edges.size(); e++)
+        {
+            int a = _projectiveRow[edges[e].first], b = _projectiveRow[edges[e].second];
+            _projectiveSlots[e] = glm::ivec4(a >= 0 ? slot(a, a) : -1, b >= 0 ? slot(b, b) : -1,
+                                             a >= 0 && b >= 0 ? slot(a, b) : -1,
+                                             a >= 0 && b >= 0 ? slot(b, a) : -1);
+        }
+    }
+
+    /*
+     * Follow a renumbering of the particles, newIndex[old] is the new index. Every
+     * matrix row keeps its particle, so pattern, ordering and factor stay as they are
+     * and only the row lookups and the slots of the re-sorted springs are redone.
+     */
+    void remapProjectiveSystem(const std::vector<int> &newIndex)
+    {
+        if (!_projectiveAnalyzed || _projectiveRow.size() != newIndex.size())
+        {
+            _projectiveAnalyzed = false;
+            return;
+        }
+        std::vector<int> row(_projectiveRow.size());
+        for (size_t i = 0; i < newIndex.size(); i++)
+        {
+            row[newIndex[i]] = _projectiveRow[i];
+        }
+        _projectiveRow.swap(row);
+        for (int &particle : _projectiveParticles)
+        {
+            particle = newIndex[particle];
+        }
+        for (int &particle : _projectiveConstrained)
+        {
+            particle = newIndex[particle];
+        }
+        std::sort(_projectiveConstrained.begin(), _projectiveConstrained.end());
+        buildProjectiveSlots();
+    }
+
+    /* degree, chains, incidence, coloring and SIMD batches, everything derived from the edge list */
+    void buildEdgeLayout()
+    {
+        std::vector<int> degree(positions.size(), 0);
+        for (const Edge &edge : edges)
+        {
+            degree[edge.first]++;
+            degree[edge.second]++;
+        }
+        maxDegree = degree.empty() ? 0 : *std::max_element(degree.begin(), degree.end());
+        findChains();
+        buildIncidence();
+        colorEdges();
+    }
+
+    /* the springs of every particle, in edge order */
+    void buildIncidence()
+    {
+        const size_t n = positions.size();
+        _incidenceOffsets.assign(n + 1, 0);
+        for (const Edge &edge : edges)
+        {
+            _incidenceOffsets[edge.first + 1]++;
+            if (edge.second != edge.first)
+            {
+                _incidenceOffsets[edge.second + 1]++;
+            }
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            _incidenceOffsets[i + 1] += _incidenceOffsets[i];
+        }
+        _incidentEdges.resize(_incidenceOffsets[n]);
+        std::vector<uint32_t> next(_incidenceOffsets.begin(), _incidenceOffsets.end() - 1);
+        for (size_t e = 0; e < edges.size(); e++)
+        {
+            _incidentEdges[next[edges[e].first]++] = static_cast<uint32_t>(e);
+            if (edges[e].second != edges[e].first)
+            {
+                _incidentEdges[next[edges[e].second]++] = static_cast<uint32_t>(e);
+            }
+        }
+    }
+
+    /*
+     * Greedy edge coloring, every edge takes the lowest color none of the
+     * springs at its ends has. At most 2 * maxDegree - 1 colors, edges are
+     * grouped by color and keep their order inside a color.
+     */
+    void colorEdges()
+    {
+        const size_t m = edges.size();
+        std::vector<int> colors(m, -1);
+        // forbidden[c] == e if color c is taken at an end of edge e
+        std::vector<size_t> forbidden;
+        int numberOfColors = 0;
+        for (size_t e = 0; e < m; e++)
+        {
+            for (int end : {edges[e].first, edges[e].second})
+            {
+                for (uint32_t k = _incidenceOffsets[end]; k < _incidenceOffsets[end + 1]; k++)
+                {
+                    int color = colors[_incidentEdges[k]];
+                    if (color >= 0)
+                    {
+                        forbidden[color] = e;
+                    }
+                }
+            }
+            int color = 0;
+            while (color < numberOfColors && forbidden[color] == e)
+            {
+                color++;
+            }
+            if (color == numberOfColors)
+            {
+                numberOfColors++;
+                forbidden.push_back(m);
+            }
+            colors[e] = color;
+        }
+        _colorOffsets.assign(numberOfColors + 1, 0);
+        for (int color : colors)
+        {
+            _colorOffsets[color + 1]++;
+        }
+        for (int c = 0; c < numberOfColors; c++)
+        {
+            _colorOffsets[c + 1] += _colorOffsets[c];
+        }
+        _coloredEdges.resize(m);
+        std::vector<uint32_t> next(_colorOffsets.begin(), _colorOffsets.end() - 1);
+        for (size_t e = 0; e < m; e++)
+        {
+            _coloredEdges[next[colors[e]]++] = static_cast<uint32_t>(e);
+        }
+    }
+
+    static double dot(const std::vector<Vec3> &a, const std::vector<Vec3> &b)
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < a.size(); i++)
+        {
+            sum += glm::dot(a[i], b[i]);
+        }
+        return sum;
+    }
+
+    // turbulence velocities, kept between steps to avoid reallocation
+    std::vector<Vec3> _gusts;
+
+    // springs of particle i are _incidentEdges[_incidenceOffsets[i] .. _incidenceOffsets[i + 1]),
+    // springs of color c are _coloredEdges[_colorOffsets[c] .. _colorOffsets[c + 1])
+    std::vector<uint32_t> _incidenceOffsets{0};
+    std::vector<uint32_t> _incidentEdges;
+    std::vector<uint32_t> _colorOffsets{0};
+    std::vector<uint32_t> _coloredEdges;
+
+    // implicit integrator state, the velocity change is kept as the next initial guess
+    std::vector<SpringJacobian> _springJacobians;
+    std::vector<glm::mat3> _preconditioner;
+    std::vector<char> _constrained;
+    std::vector<Vec3> _rhs;
+    std::vector<Vec3> _velocityChange;
+    std::vector<Vec3> _residual;
+    std::vector<Vec3> _product;
+    std::vector<Vec3> _preconditioned;
+    std::vector<Vec3> _direction;
+    ImplicitSolveStatistics _lastSolve;
+
+    // particles of every chain in path order, chain c is _chainOrder[_chainOffsets[c] .. _chainOffsets[c + 1]),
+    // _chainEdges[k] joins _chainOrder[k] and _chainOrder[k + 1], -1 at the end of a chain
+    bool _isChain = false;
+    std::vector<int> _chainOrder;
+    std::vector<int> _chainEdges;
+    std::vector<uint32_t> _chainOffsets;
+    std::vector<glm::mat3> _chainLower;
+    std::vector<glm::mat3> _chainDiagonal;
+    std::vector<glm::mat3> _chainUpper;
+    std::vector<Vec3> _chainValues;
+    unsigned long long _totalSolverIterations = 0;
+    unsigned long long _implicitSteps = 0;
+
+    // projective dynamics: row of every particle in the global matrix, -1 if constrained,
+    // and the matrix slots of every spring (diagonal of each end, then the two couplings)
+    bool _projectiveAnalyzed = false;
+    bool _projectiveFactorized = false;
+    std::vector<int> _projectiveConstrained;
+    std::vector<int> _projectiveRow;
+    std::vector<int> _projectiveParticles;
+    std::vector<glm::ivec4> _projectiveSlots;
+    // step, mass, spring weight and drag the factor was computed with
+    glm::vec4 _projectiveParameters{0.0f};
+    SparseMatrix _projectiveMatrix;
+    SparseCholesky _projectiveFactor;
+    std::vector<Vec3> _projectiveBase;
+    std::vector<Vec3> _projectivePositions;
+    std::vector<Vec3> _projections;
+    std::vector<double> _projectiveRhs;
+    unsigned long long _analyses = 0;
+    unsigned long long _factorizations = 0;
+};
+#endif
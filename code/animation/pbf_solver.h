@@ -0,0 +1,279 @@
+#ifndef _PBF_SOLVER_H_
+#define _PBF_SOLVER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "sph_solver.h"
+
+/*
+ * Position based fluids (Macklin & Mueller). Positions are predicted from the
+ * external forces, then a few Jacobi iterations project them onto the density
+ * constraints rho_i / rho_0 - 1 <= 0, velocities follow from the corrected
+ * positions. Stays stable at frame sized steps, trading accuracy for speed.
+ */
+class PbfSolver : public SphSolver
+{
+public:
+    PbfSolver() : SphSolver()
+    {
+        predictedPositionChannel = particles.addVectorChannel("predicted position");
+        correctionChannel = particles.addVectorChannel("position correction");
+        lambdaChannel = particles.addScalarChannel("lambda", 0.0f);
+        setTargetSpacing(targetSpacing);
+    }
+
+    size_t predictedPositionChannel;
+    // displacement from the predicted position accumulated by the iterations
+    size_t correctionChannel;
+    size_t lambdaChannel;
+
+    int iterations = 4;
+    // Jacobi relaxation, each particle ignores that its neighbors move too and overshoots at 1
+    float relaxation = 0.5f;
+    // regularizes the constraints, relative to a particle inside a lattice at rest
+    float constraintRelaxation = 0.01f;
+    // artificial pressure against particle clustering as a share of the rest density, 0 disables it
+    float tensileCorrection = 0.01f;
+    float tensileCorrectionExponent = 4.0f;
+    float tensileCorrectionDistance = 0.2f;
+    // XSPH velocity smoothing, replaces the Laplacian viscosity
+    float xsphCoefficient = 0.01f;
+
+protected:
+    // constraints are unconditionally stable, only the CFL condition limits adaptive steps
+    float stabilityTimeStepLimit() const override { return 0.0f; }
+    float characteristicLength() const override { return targetSpacing; }
+
+    void onAdvanceTimeStep(float timeInterval) override
+    {
+        if (particles.numberOfParticles() == 0)
+        {
+            return;
+        }
+        updateKernels();
+        predictPositions(timeInterval);
+        neighborLists.update(particles.vectorChannel(predictedPositionChannel));
+        resetCorrections();
+        for (int i = 0; i < iterations; i++)
+        {
+            computeLambdas();
+            applyCorrections();
+        }
+        updateParticles(timeInterval);
+    }
+
+    void calibrateMass() override
+    {
+        particleMass = targetDensity / latticeKernelSum([this](float r2) { return _kernelTable(r2); });
+        tabulateWalls([this](float r2) { return spiky(r2); },
+                      [this](const Vec3 &r, float distance) { return kernelGradient(r, distance); });
+        // sum of |grad C|^2 for a particle inside a lattice, the gradients of its neighbors cancel
+        const int extent = static_cast<int>(std::ceil(kernelRadiusOverSpacing));
+        const float scale = particleMass / targetDensity;
+        float sum = 0.0f;
+        for (int k = -extent; k <= extent; k++)
+        {
+            for (int j = -extent; j <= extent; j++)
+            {
+                for (int i = -extent; i <= extent; i++)
+                {
+                    float distance = targetSpacing * std::sqrt(static_cast<float>(i * i + j * j + k * k));
+                    float gradient = scale * spikyGradient(distance);
+                    sum += distance > 0.0f ? gradient * gradient : 0.0f;
+                }
+            }
+        }
+        _latticeGradientSum = sum;
+    }
+
+    void updateKernels() override
+    {
+        SphSolver::updateKernels();
+        if (_kernelTable.radius() != kernelRadius)
+        {
+            _kernelTable.tabulate(SpikyKernel<float>(kernelRadius));
+        }
+    }
+
+    /* gradient of the spiky kernel with respect to x_i, r = x_i - x_j */
+    Vec3 kernelGradient(const Vec3 &r, float distance) const
+    {
+        return distance > 0.0f ? -spikyGradient(distance) / distance * r : Vec3(0.0f);
+    }
+
+    /* gravity and drag, then p = x + dt v clamped to the domain */
+    void predictPositions(float timeInterval)
+    {
+        VectorChannelView<const float> x = particles.positions();
+        VectorChannelView<float> v = particles.velocities();
+        VectorChannelView<float> p = particles.vectorChannel(predictedPositionChannel);
+        VectorChannelView<float> f = particles.forces();
+        const float scale = timeInterval / particleMass;
+        // the forces hold the wind velocities until they are replaced by the external forces
+        sampleWind(f);
+        parallelFor(0, x.size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                Vec3 xi = x.get(i), vi = v.get(i);
+                Vec3 force = gravity * particleMass - dragCoefficient * (vi - f.get(i));
+                f.set(i, force);
+                vi += scale * force;
+                Vec3 position = xi + timeInterval * vi;
+                resolveDomainCollision(position, vi);
+                v.set(i, vi);
+                p.set(i, position);
+            }
+        });
+    }
+
+    /* starts the iterations from the predicted positions */
+    void resetCorrections()
+    {
+        VectorChannelView<float> correction = particles.vectorChannel(correctionChannel);
+        const size_t pairs = neighborLists.lists().indices.size();
+        std::fill(correction.x, correction.x + correction.size, 0.0f);
+        std::fill(correction.y, correction.y + correction.size, 0.0f);
+        std::fill(correction.z, correction.z + correction.size, 0.0f);
+        _pairWeights.assign(pairs, 0.0f);
+        _pairGradients.assign(pairs, Vec3(0.0f));
+        _wallGradients.assign(correction.size, Vec3(0.0f));
+    }
+
+    /*
+     * lambda_i = -C_i / (sum |grad C_i|^2 + epsilon) at the corrected positions.
+     * The pairs come from the neighbor lists built once per step, the kernel
+     * weights and gradients evaluated here are cached for the corrections and
+     * the velocity smoothing. Both come from the spiky kernel: a poly6 density
+     * would not move the way the spiky gradient predicts.
+     */
+    void computeLambdas()
+    {
+        VectorChannelView<const float> p = particles.vectorChannel(predictedPositionChannel);
+        VectorChannelView<const float> correction = particles.vectorChannel(correctionChannel);
+        Span<float> density = particles.scalarChannel(densityChannel);
+        Span<float> lambda = particles.scalarChannel(lambdaChannel);
+        const NeighborLists &lists = neighborLists.lists();
+        const float scale = particleMass / targetDensity;
+        const float epsilon = constraintRelaxation * _latticeGradientSum;
+        const float self = _kernelTable(0.0f);
+        parallelFor(0, p.size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                Vec3 pi = p.get(i) + correction.get(i);
+                float wallKernel;
+                Vec3 wallGradient;
+                sampleWalls(pi, wallKernel, wallGradient);
+                _wallGradients[i] = wallGradient;
+
+                float sum = self + wallKernel;
+                // walls don't move, they only add to the first term
+                Vec3 sumGradient = scale * wallGradient;
+                float sumSquaredGradient = 0.0f;
+                for (uint32_t k = lists.offsets[i]; k < lists.offsets[i + 1]; k++)
+                {
+                    uint32_t j = lists.indices[k];
+                    Vec3 r = pi - p.get(j) - correction.get(j);
+                    float distanceSquared = glm::dot(r, r);
+                    Vec3 gradient = _kernelTable.derivativeOverDistance(distanceSquared) * r;
+                    _pairWeights[k] = _kernelTable(distanceSquared);
+                    _pairGradients[k] = gradient;
+                    sum += _pairWeights[k];
+                    sumGradient += scale * gradient;
+                    sumSquaredGradient += scale * scale * glm::dot(gradient, gradient);
+                }
+                density[i] = particleMass * sum;
+                // only compression is corrected, free surfaces would otherwise pull particles together
+                float constraint = std::max(density[i] / targetDensity - 1.0f, 0.0f);
+                lambda[i] = -constraint / (glm::dot(sumGradient, sumGradient) + sumSquaredGradient + epsilon);
+            }
+        });
+    }
+
+    /* dp_i = m / rho_0 sum (lambda_i + lambda_j + s_corr) grad W_ij, kept inside the domain */
+    void applyCorrections()
+    {
+        VectorChannelView<const float> p = particles.vectorChannel(predictedPositionChannel);
+        VectorChannelView<float> correction = particles.vectorChannel(correctionChannel);
+        Span<const float> lambda = particles.scalarChannel(lambdaChannel);
+        const float scale = relaxation * particleMass / targetDensity;
+        const float inverseReferenceWeight =
+            1.0f / spiky(tensileCorrectionDistance * tensileCorrectionDistance * kernelRadius * kernelRadius);
+        // lambda carries length^2, the correction is scaled like the lambda of a lattice particle
+        const float tensileLambda = -tensileCorrection / _latticeGradientSum;
+        const uint32_t *offsets = neighborLists.lists().offsets.data();
+        const uint32_t *indices = neighborLists.lists().indices.data();
+        const float *weights = _pairWeights.data();
+        const Vec3 *gradients = _pairGradients.data();
+        const Vec3 *wallGradients = _wallGradients.data();
+        parallelFor(0, p.size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                Vec3 delta = lambda[i] * wallGradients[i];
+                for (uint32_t k = offsets[i]; k < offsets[i + 1]; k++)
+                {
+                    float tensile = 0.0f;
+                    if (tensileCorrection > 0.0f)
+                    {
+                        tensile = tensileLambda * std::pow(weights[k] * inverseReferenceWeight, tensileCorrectionExponent);
+                    }
+                    delta += (lambda[i] + lambda[indices[k]] + tensile) * gradients[k];
+                }
+                Vec3 pi = p.get(i);
+                Vec3 position = glm::clamp(pi + correction.get(i) + scale * delta, domainLower, domainUpper);
+                correction.set(i, position - pi);
+            }
+        });
+    }
+
+    /* v = (p - x) / dt with XSPH smoothing, then x = p */
+    void updateParticles(float timeInterval)
+    {
+        VectorChannelView<float> x = particles.positions();
+        VectorChannelView<float> v = particles.velocities();
+        VectorChannelView<const float> p = particles.vectorChannel(predictedPositionChannel);
+        VectorChannelView<const float> correction = particles.vectorChannel(correctionChannel);
+        Span<const float> density = particles.scalarChannel(densityChannel);
+        const float inverseDt = 1.0f / timeInterval;
+        const size_t n = x.size;
+        _velocities.resize(n);
+        parallelFor(0, n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                _velocities[i] = (p.get(i) + correction.get(i) - x.get(i)) * inverseDt;
+            }
+        });
+
+        const uint32_t *offsets = neighborLists.lists().offsets.data();
+        const uint32_t *indices = neighborLists.lists().indices.data();
+        const float *weights = _pairWeights.data();
+        // without iterations no weights or densities were evaluated this step
+        const bool smooth = iterations > 0 && xsphCoefficient > 0.0f;
+        parallelFor(0, n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                Vec3 vi = _velocities[i];
+                Vec3 smoothing(0.0f);
+                for (uint32_t k = offsets[i]; smooth && k < offsets[i + 1]; k++)
+                {
+                    uint32_t j = indices[k];
+                    smoothing += (_velocities[j] - vi) * (weights[k] / density[j]);
+                }
+                v.set(i, vi + xsphCoefficient * particleMass * smoothing);
+                x.set(i, p.get(i) + correction.get(i));
+            }
+        });
+    }
+
+private:
+    // weights and gradients of the iterations come from the table, without a square root per pair
+    TabulatedKernel<SpikyKernel<float>> _kernelTable;
+    float _latticeGradientSum = 0.0f;
+    // kernel weights and gradients of the neighbor list pairs from the last iteration
+    std::vector<float> _pairWeights;
+    std::vector<Vec3> _pairGradients;
+    std::vector<Vec3> _wallGradients;
+    std::vector<Vec3> _velocities;
+};
+#endif
@@ -0,0 +1,141 @@
+#ifndef _SIMULATION_THREAD_H_
+#define _SIMULATION_THREAD_H_
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "animation.h"
+#include "triple_buffer.h"
+
+/*
+ * Steps a PhysicsAnimation on a dedicated thread, paced by the wall clock.
+ * After every update the publish callback copies whatever the renderer needs
+ * into a Snapshot, which is handed over through a lock-free triple buffer.
+ */
+template <typename Snapshot>
+class SimulationThread
+{
+public:
+    using PublishFunction = std::function<void(const PhysicsAnimation &, Snapshot &)>;
+
+    SimulationThread(PhysicsAnimation &animation, PublishFunction publish, float timeInterval = 1.0f / 60.0f)
+        : _animation(animation), _publish(publish), _timeInterval(timeInterval)
+    {
+    }
+
+    ~SimulationThread()
+    {
+        stop();
+    }
+
+    SimulationThread(const SimulationThread &) = delete;
+    SimulationThread &operator=(const SimulationThread &) = delete;
+
+    void start()
+    {
+        if (_running)
+        {
+            return;
+        }
+        // the thread does not exist yet, so the caller may act as the producer once
+        _publish(_animation, _snapshots.writeBuffer());
+        _snapshots.publish();
+
+        _running = true;
+        _thread = std::thread(&SimulationThread::loop, this);
+    }
+
+    void stop()
+    {
+        if (!_running)
+        {
+            return;
+        }
+        _running = false;
+        _thread.join();
+        runCommands();
+    }
+
+    bool running() const { return _running; }
+
+    /* run a function on the simulation thread between two updates, e.g. to edit parameters */
+    void submit(std::function<void()> command)
+    {
+        if (!_running)
+        {
+            command();
+            return;
+        }
+        std::lock_guard<std::mutex> lock(_commandMutex);
+        _commands.push_back(std::move(command));
+        _hasCommands = true;
+    }
+
+    /* render thread side: latest finished snapshot */
+    const Snapshot &latest()
+    {
+        _snapshots.fetch();
+        return _snapshots.readBuffer();
+    }
+
+private:
+    PhysicsAnimation &_animation;
+    PublishFunction _publish;
+    float _timeInterval;
+
+    TripleBuffer<Snapshot> _snapshots;
+    std::thread _thread;
+    std::atomic<bool> _running{false};
+
+    std::mutex _commandMutex;
+    std::vector<std::function<void()>> _commands;
+    std::atomic<bool> _hasCommands{false};
+
+    void runCommands()
+    {
+        std::vector<std::function<void()>> commands;
+        {
+            std::lock_guard<std::mutex> lock(_commandMutex);
+            commands.swap(_commands);
+            _hasCommands = false;
+        }
+        for (auto &command : commands)
+        {
+            command();
+        }
+    }
+
+    void loop()
+    {
+        using Clock = std::chrono::steady_clock;
+        const int startIndex = _animation.currentFrame().index;
+        const auto startTime = Clock::now();
+        const auto frameDuration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(_timeInterval));
+        Frame frame(startIndex, _timeInterval);
+
+        while (_running)
+        {
+            if (_hasCommands)
+            {
+                runCommands();
+            }
+
+            int target = startIndex + static_cast<int>((Clock::now() - startTime) / frameDuration);
+            if (target <= frame.index)
+            {
+                std::this_thread::sleep_until(startTime + (frame.index - startIndex + 1) * frameDuration);
+                continue;
+            }
+            frame.index = target;
+            _animation.update(frame);
+
+            _publish(_animation, _snapshots.writeBuffer());
+            _snapshots.publish();
+        }
+    }
+};
+#endif
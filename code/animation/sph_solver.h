@@ -0,0 +1,392 @@
+#ifndef _SPH_SOLVER_H_
+#define _SPH_SOLVER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "animation.h"
+#include "field.h"
+#include "particle_system_data.h"
+#include "point_neighbor_searcher.h"
+#include "sph_kernels.h"
+#include "thread_pool.h"
+
+/*
+ * Weakly compressible SPH: densities from a poly6 kernel, pressure from the
+ * Tait equation of state, spiky pressure gradient and Laplacian viscosity.
+ * Every pass gathers over neighbor lists, so it runs in parallel without atomics.
+ */
+class SphSolver : public PhysicsAnimation
+{
+public:
+    using Vec3 = glm::vec3;
+
+    SphSolver() : particles(), neighborLists(1.0f, 0.1f)
+    {
+        densityChannel = particles.addScalarChannel("density", 0.0f);
+        pressureChannel = particles.addScalarChannel("pressure", 0.0f);
+        setTargetSpacing(0.1f);
+    }
+
+    /* particle spacing at rest density, derives the kernel radius and the particle mass */
+    void setTargetSpacing(float spacing)
+    {
+        targetSpacing = spacing;
+        kernelRadius = kernelRadiusOverSpacing * spacing;
+        neighborLists.setRadius(kernelRadius, skinOverRadius * kernelRadius);
+        updateKernels();
+        calibrateMass();
+    }
+
+    /* fill the axis aligned box [lower, upper] with particles on a grid at the target spacing */
+    void addBlock(const Vec3 &lower, const Vec3 &upper)
+    {
+        glm::ivec3 count = glm::max(glm::ivec3((upper - lower) / targetSpacing), glm::ivec3(1));
+        size_t first = particles.addParticles(static_cast<size_t>(count.x) * count.y * count.z);
+        VectorChannelView<float> x = particles.positions();
+        size_t i = first;
+        for (int k = 0; k < count.z; k++)
+        {
+            for (int j = 0; j < count.y; j++)
+            {
+                for (int l = 0; l < count.x; l++)
+                {
+                    x.set(i++, lower + targetSpacing * (Vec3(l, j, k) + 0.5f));
+                }
+            }
+        }
+        neighborLists.invalidate();
+    }
+
+    ParticleSystemData particles;
+    size_t densityChannel;
+    size_t pressureChannel;
+
+    float targetDensity = 1000.0f;
+    float targetSpacing;
+    float kernelRadiusOverSpacing = 1.8f;
+    float kernelRadius;
+    float particleMass;
+    float skinOverRadius = 0.2f;
+
+    float speedOfSound = 100.0f;
+    float eosExponent = 7.0f;
+    // scales negative pressure, 0 ignores the attraction of under-dense regions
+    float negativePressureScale = 0.0f;
+    // kinematic viscosity
+    float viscosityCoefficient = 0.01f;
+    Vec3 gravity = Vec3(0.0f, -9.8f, 0.0f);
+    float dragCoefficient = 0.0f;
+    std::shared_ptr<VectorField> wind;
+
+    Vec3 domainLower = Vec3(-1.0f);
+    Vec3 domainUpper = Vec3(1.0f);
+    float restitutionCoefficient = 0.0f;
+
+    VerletNeighborLists neighborLists;
+
+protected:
+    float maxVelocity() const override { return maxMagnitude(particles.velocities()); }
+    float maxForce() const override { return maxMagnitude(particles.forces()) / particleMass; }
+    float stabilityTimeStepLimit() const override
+    {
+        // pressure waves must not cross more than a fraction of a kernel per step
+        return 0.4f * kernelRadius / speedOfSound;
+    }
+    float characteristicLength() const override { return kernelRadius; }
+
+    void onAdvanceTimeStep(float timeInterval) override
+    {
+        if (particles.numberOfParticles() == 0)
+        {
+            return;
+        }
+        updateKernels();
+        neighborLists.update(particles.positions());
+        computeDensities();
+        computePressures();
+        accumulateForces();
+        integrate(timeInterval);
+    }
+
+    static float maxMagnitude(VectorChannelView<const float> v)
+    {
+        std::atomic<float> result(0.0f);
+        parallelFor(0, v.size, [&](size_t begin, size_t end) {
+            float local = 0.0f;
+            for (size_t i = begin; i < end; i++)
+            {
+                local = std::max(local, v.x[i] * v.x[i] + v.y[i] * v.y[i] + v.z[i] * v.z[i]);
+            }
+            float current = result.load();
+            while (local > current && !result.compare_exchange_weak(current, local))
+            {
+            }
+        });
+        return std::sqrt(result.load());
+    }
+
+    virtual void updateKernels()
+    {
+        _poly6Kernel = Poly6Kernel<float>(kernelRadius);
+        _spikyKernel = SpikyKernel<float>(kernelRadius);
+    }
+
+    /* poly6 kernel, takes the squared distance */
+    float poly6(float distanceSquared) const { return _poly6Kernel.fromSquared(distanceSquared); }
+
+    /* spiky kernel, takes the squared distance */
+    float spiky(float distanceSquared) const { return _spikyKernel(std::sqrt(distanceSquared)); }
+
+    /* magnitude of the spiky kernel gradient, pointing towards the center */
+    float spikyGradient(float distance) const { return -_spikyKernel.derivative(distance); }
+
+    /* Laplacian of the viscosity kernel of Mueller et al., half the second derivative of spiky */
+    float viscosityLaplacian(float distance) const { return 0.5f * _spikyKernel.secondDerivative(distance); }
+
+    /* choose the mass so a particle inside a lattice at the target spacing has exactly the rest density */
+    virtual void calibrateMass()
+    {
+        particleMass = targetDensity / latticeKernelSum([this](float r2) { return poly6(r2); });
+    }
+
+    template <typename Kernel>
+    float latticeKernelSum(const Kernel &kernel) const
+    {
+        const int extent = static_cast<int>(std::ceil(kernelRadiusOverSpacing));
+        const float spacing2 = targetSpacing * targetSpacing;
+        float sum = 0.0f;
+        for (int k = -extent; k <= extent; k++)
+        {
+            for (int j = -extent; j <= extent; j++)
+            {
+                for (int i = -extent; i <= extent; i++)
+                {
+                    sum += kernel(spacing2 * static_cast<float>(i * i + j * j + k * k));
+                }
+            }
+        }
+        return sum;
+    }
+
+    /*
+     * The domain walls act like a lattice of resting particles continuing the
+     * fluid past the wall. Their summed kernel and gradient only depend on the
+     * distance to the wall, so both are tabulated once per spacing. Kernel takes
+     * the squared distance, gradient takes r = x_i - x_j and its length.
+     */
+    template <typename Kernel, typename Gradient>
+    void tabulateWalls(const Kernel &kernel, const Gradient &gradient)
+    {
+        const int extent = static_cast<int>(std::ceil(kernelRadiusOverSpacing));
+        const float s = targetSpacing;
+        _wallKernel.assign(kWallTableSize + 1, 0.0f);
+        _wallGradient.assign(kWallTableSize + 1, 0.0f);
+        for (int t = 0; t <= kWallTableSize; t++)
+        {
+            float d = kernelRadius * t / kWallTableSize;
+            for (int c = 0; c <= extent; c++)
+            {
+                for (int b = -extent; b <= extent; b++)
+                {
+                    for (int a = -extent; a <= extent; a++)
+                    {
+                        Vec3 r(a * s, d + (c + 0.5f) * s, b * s);
+                        float distance = glm::length(r);
+                        _wallKernel[t] += kernel(distance * distance);
+                        _wallGradient[t] += gradient(r, distance).y;
+                    }
+                }
+            }
+        }
+    }
+
+    /* kernel sum of the walls within the kernel radius of a position and its gradient, pointing into the walls */
+    void sampleWalls(const Vec3 &position, float &kernel, Vec3 &gradient) const
+    {
+        kernel = 0.0f;
+        gradient = Vec3(0.0f);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float w, g;
+            if (position[axis] - domainLower[axis] < kernelRadius)
+            {
+                sampleWall(position[axis] - domainLower[axis], w, g);
+                kernel += w;
+                gradient[axis] += g;
+            }
+            if (domainUpper[axis] - position[axis] < kernelRadius)
+            {
+                sampleWall(domainUpper[axis] - position[axis], w, g);
+                kernel += w;
+                gradient[axis] -= g;
+            }
+        }
+    }
+
+    /* kernel sum and gradient along the inward normal of a wall at the given distance */
+    void sampleWall(float distance, float &kernel, float &gradient) const
+    {
+        float u = std::max(distance, 0.0f) / kernelRadius * kWallTableSize;
+        int t = std::min(static_cast<int>(u), kWallTableSize - 1);
+        float w = std::min(u - t, 1.0f);
+        kernel = _wallKernel[t] + w * (_wallKernel[t + 1] - _wallKernel[t]);
+        gradient = _wallGradient[t] + w * (_wallGradient[t + 1] - _wallGradient[t]);
+    }
+
+    void computeDensities()
+    {
+        estimateDensities([this](float r2) { return poly6(r2); });
+    }
+
+    /* kernel takes the squared distance */
+    template <typename Kernel>
+    void estimateDensities(const Kernel &kernel)
+    {
+        VectorChannelView<const float> x = particles.positions();
+        Span<float> density = particles.scalarChannel(densityChannel);
+        const NeighborLists &lists = neighborLists.lists();
+        const float self = kernel(0.0f);
+        parallelFor(0, x.size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                float sum = self;
+                for (uint32_t j : lists.neighbors(i))
+                {
+                    float dx = x.x[i] - x.x[j], dy = x.y[i] - x.y[j], dz = x.z[i] - x.z[j];
+                    sum += kernel(dx * dx + dy * dy + dz * dz);
+                }
+                density[i] = particleMass * sum;
+            }
+        });
+    }
+
+    void computePressures()
+    {
+        Span<const float> density = particles.scalarChannel(densityChannel);
+        Span<float> pressure = particles.scalarChannel(pressureChannel);
+        // Tait equation of state, B chosen so the speed of sound at rest density matches
+        const float stiffness = targetDensity * speedOfSound * speedOfSound / eosExponent;
+        parallelFor(0, density.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                float p = stiffness * (std::pow(density[i] / targetDensity, eosExponent) - 1.0f);
+                pressure[i] = p < 0.0f ? p * negativePressureScale : p;
+            }
+        });
+    }
+
+    /* wind velocity at every particle, zero without wind, sampled in one batch per thread */
+    void sampleWind(VectorChannelView<float> output) const
+    {
+        VectorChannelView<const float> x = particles.positions();
+        parallelFor(0, x.size, [&](size_t begin, size_t end) {
+            VectorChannelView<float> chunk = output.subview(begin, end - begin);
+            if (wind != nullptr)
+            {
+                wind->sample(x.subview(begin, end - begin), chunk);
+            }
+            else
+            {
+                std::fill(chunk.x, chunk.x + chunk.size, 0.0f);
+                std::fill(chunk.y, chunk.y + chunk.size, 0.0f);
+                std::fill(chunk.z, chunk.z + chunk.size, 0.0f);
+            }
+        });
+    }
+
+    /* gravity, drag and viscosity, plus the equation of state pressure unless includePressure is false */
+    void accumulateForces(bool includePressure = true)
+    {
+        VectorChannelView<const float> x = particles.positions();
+        VectorChannelView<const float> v = particles.velocities();
+        VectorChannelView<float> f = particles.forces();
+        Span<const float> density = particles.scalarChannel(densityChannel);
+        Span<const float> pressure = particles.scalarChannel(pressureChannel);
+        const NeighborLists &lists = neighborLists.lists();
+        const float m = particleMass;
+
+        sampleWind(f);
+        parallelFor(0, x.size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                Vec3 xi = x.get(i), vi = v.get(i);
+                Vec3 force = gravity * m - dragCoefficient * (vi - f.get(i));
+
+                float pressureTerm = pressure[i] / (density[i] * density[i]);
+                Vec3 pressureForce(0.0f), viscosityForce(0.0f);
+                for (uint32_t j : lists.neighbors(i))
+                {
+                    Vec3 r = xi - x.get(j);
+                    float distance = glm::length(r);
+                    if (distance >= kernelRadius || distance <= 0.0f)
+                    {
+                        continue;
+                    }
+                    if (includePressure)
+                    {
+                        pressureForce += (pressureTerm + pressure[j] / (density[j] * density[j])) *
+                                         spikyGradient(distance) * (r / distance);
+                    }
+                    viscosityForce += (v.get(j) - vi) / density[j] * viscosityLaplacian(distance);
+                }
+                force += m * m * pressureForce + viscosityCoefficient * m * m * viscosityForce;
+                f.set(i, force);
+            }
+        });
+    }
+
+    void integrate(float timeInterval)
+    {
+        VectorChannelView<float> x = particles.positions();
+        VectorChannelView<float> v = particles.velocities();
+        VectorChannelView<const float> f = particles.forces();
+        const float inverseMass = 1.0f / particleMass;
+        parallelFor(0, x.size, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                Vec3 velocity = v.get(i) + timeInterval * inverseMass * f.get(i);
+                Vec3 position = x.get(i) + timeInterval * velocity;
+                resolveDomainCollision(position, velocity);
+                v.set(i, velocity);
+                x.set(i, position);
+            }
+        });
+    }
+
+    void resolveDomainCollision(Vec3 &position, Vec3 &velocity) const
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (position[axis] < domainLower[axis])
+            {
+                position[axis] = domainLower[axis];
+                if (velocity[axis] < 0.0f)
+                {
+                    velocity[axis] *= -restitutionCoefficient;
+                }
+            }
+            else if (position[axis] > domainUpper[axis])
+            {
+                position[axis] = domainUpper[axis];
+                if (velocity[axis] > 0.0f)
+                {
+                    velocity[axis] *= -restitutionCoefficient;
+                }
+            }
+        }
+    }
+
+private:
+    Poly6Kernel<float> _poly6Kernel;
+    SpikyKernel<float> _spikyKernel;
+
+    static const int kWallTableSize = 64;
+    std::vector<float> _wallKernel;
+    std::vector<float> _wallGradient;
+};
+#endif
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+/*
+ * @brief allocate size bytes aligned to alignment (a power of two), throws std::bad_alloc
+ */
+inline void* alignedAlloc(size_t size, size_t alignment) {
+	if (size == 0) {
+		size = alignment;
+	}
+#ifdef _WIN32
+	void* ptr = _aligned_malloc(size, alignment);
+#else
+	void* ptr = nullptr;
+	if (posix_memalign(&ptr, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) != 0) {
+		ptr = nullptr;
+	}
+#endif
+	if (ptr == nullptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+/*
+ * @brief release memory returned by alignedAlloc
+ */
+inline void alignedFree(void* ptr) {
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+inline size_t alignUp(size_t value, size_t alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+/*
+ * growable array of trivially copyable elements whose storage is aligned for
+ * SIMD loads, capacity is rounded up so whole vector registers never read past it
+ */
+template <typename T, size_t Alignment = 64>
+class AlignedArray {
+public:
+	AlignedArray() = default;
+
+	explicit AlignedArray(size_t size, const T& value = T()) {
+		resize(size, value);
+	}
+
+	~AlignedArray() {
+		if (_data != nullptr) {
+			alignedFree(_data);
+		}
+	}
+
+	AlignedArray(const AlignedArray& other) {
+		*this = other;
+	}
+
+	AlignedArray(AlignedArray&& other) noexcept {
+		swap(other);
+	}
+
+	AlignedArray& operator=(const AlignedArray& other) {
+		if (this != &other) {
+			_size = 0;
+			reserve(other._size);
+			if (other._size > 0) {
+				std::memcpy(_data, other._data, other._size * sizeof(T));
+			}
+			_size = other._size;
+		}
+		return *this;
+	}
+
+	AlignedArray& operator=(AlignedArray&& other) noexcept {
+		swap(other);
+		return *this;
+	}
+
+	void swap(AlignedArray& other) noexcept {
+		std::swap(_data, other._data);
+		std::swap(_size, other._size);
+		std::swap(_capacity, other._capacity);
+	}
+
+	void reserve(size_t capacity) {
+		if (capacity <= _capacity) {
+			return;
+		}
+		capacity = alignUp(capacity * sizeof(T), Alignment) / sizeof(T);
+		T* data = static_cast<T*>(alignedAlloc(capacity * sizeof(T), Alignment));
+		if (_data != nullptr) {
+			if (_size > 0) {
+				std::memcpy(data, _data, _size * sizeof(T));
+			}
+			alignedFree(_data);
+		}
+		_data = data;
+		_capacity = capacity;
+	}
+
+	void resize(size_t size, const T& value = T()) {
+		if (size > _capacity) {
+			reserve(std::max(size, _capacity * 2));
+		}
+		for (size_t i = _size; i < size; ++i) {
+			_data[i] = value;
+		}
+		_size = size;
+	}
+
+	void fill(const T& value) {
+		std::fill(_data, _data + _size, value);
+	}
+
+	void clear() { _size = 0; }
+
+	T* data() { return _data; }
+
+	const T* data() const { return _data; }
+
+	size_t size() const { return _size; }
+
+	size_t capacity() const { return _capacity; }
+
+	bool empty() const { return _size == 0; }
+
+	T& operator[](size_t i) { return _data[i]; }
+
+	const T& operator[](size_t i) const { return _data[i]; }
+
+	T* begin() { return _data; }
+
+	T* end() { return _data + _size; }
+
+	const T* begin() const { return _data; }
+
+	const T* end() const { return _data + _size; }
+
+private:
+	static_assert(std::is_trivially_copyable<T>::value, "AlignedArray holds trivially copyable elements");
+
+	T* _data = nullptr;
+	size_t _size = 0;
+	size_t _capacity = 0;
+};
@@ -0,0 +1,22 @@
+#include "block_tridiagonal.h"
+
+void solveBlockTridiagonal(Span<const glm::mat3> lower, Span<glm::mat3> diagonal, Span<glm::mat3> upper,
+	Span<glm::vec3> values) {
+	const size_t n = values.size();
+	if (n == 0) {
+		return;
+	}
+	// forward elimination, upper[i] becomes the coupling to x[i + 1] left after normalizing row i
+	glm::mat3 inverse = glm::inverse(diagonal[0]);
+	upper[0] = inverse * upper[0];
+	values[0] = inverse * values[0];
+	for (size_t i = 1; i < n; i++) {
+		diagonal[i] -= lower[i] * upper[i - 1];
+		inverse = glm::inverse(diagonal[i]);
+		upper[i] = inverse * upper[i];
+		values[i] = inverse * (values[i] - lower[i] * values[i - 1]);
+	}
+	for (size_t i = n - 1; i > 0; i--) {
+		values[i - 1] -= upper[i - 1] * values[i];
+	}
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "span.h"
+
+/*
+ * @brief solve A x = values in place with the block Thomas algorithm, O(n) for 3x3 blocks.
+ * Row i of A is lower[i], diagonal[i], upper[i] at columns i - 1, i and i + 1, lower[0] and
+ * upper[n - 1] are ignored. diagonal and upper are overwritten with the elimination and values
+ * with x. There is no pivoting, A must be symmetric positive definite or block diagonally dominant.
+ */
+void solveBlockTridiagonal(Span<const glm::mat3> lower, Span<glm::mat3> diagonal, Span<glm::mat3> upper,
+	Span<glm::vec3> values);
@@ -0,0 +1,67 @@
+#include "cpu_features.h"
+
+#if defined(_MSC_VER) && !defined(__clang__) && (defined(_M_X64) || defined(_M_IX86))
+#define CPU_FEATURES_CPUID
+#include <intrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_FEATURES_BUILTIN
+#endif
+
+namespace {
+
+SimdLevel detect() {
+#if defined(CPU_FEATURES_CPUID)
+	int info[4];
+	__cpuid(info, 0);
+	const int maxLeaf = info[0];
+	__cpuid(info, 1);
+	const bool sse2 = (info[3] & (1 << 26)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	// the wide registers are only usable if the operating system saves them on context switches
+	const unsigned long long enabled = osxsave ? _xgetbv(0) : 0;
+	if (maxLeaf >= 7) {
+		__cpuidex(info, 7, 0);
+		if ((info[1] & (1 << 16)) != 0 && (enabled & 0xe6) == 0xe6) {
+			return SimdLevel::AVX512;
+		}
+		if ((info[1] & (1 << 5)) != 0 && (enabled & 0x6) == 0x6) {
+			return SimdLevel::AVX2;
+		}
+	}
+	if (sse2) {
+		return SimdLevel::SSE2;
+	}
+#elif defined(CPU_FEATURES_BUILTIN)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return SimdLevel::AVX512;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return SimdLevel::AVX2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return SimdLevel::SSE2;
+	}
+#endif
+	return SimdLevel::Scalar;
+}
+
+}
+
+SimdLevel detectSimdLevel() {
+	static const SimdLevel level = detect();
+	return level;
+}
+
+const char* simdLevelName(SimdLevel level) {
+	switch (level) {
+	case SimdLevel::SSE2:
+		return "SSE2";
+	case SimdLevel::AVX2:
+		return "AVX2";
+	case SimdLevel::AVX512:
+		return "AVX-512";
+	default:
+		return "scalar";
+	}
+}
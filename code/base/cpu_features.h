@@ -0,0 +1,18 @@
+#pragma once
+
+/*
+ * vector instruction sets a kernel can dispatch to at run time, narrowest first
+ */
+enum class SimdLevel {
+	Scalar,
+	SSE2,
+	AVX2,
+	AVX512
+};
+
+/*
+ * @brief widest level supported by both the CPU and the operating system, detected once
+ */
+SimdLevel detectSimdLevel();
+
+const char* simdLevelName(SimdLevel level);
@@ -0,0 +1,362 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "curl_noise_field.h"
+#include "thread_pool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CURL_NOISE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const uint32_t kPrimeX = 0x8da6b343u;
+const uint32_t kPrimeY = 0xd8163841u;
+const uint32_t kPrimeZ = 0xcb1ab31fu;
+const uint32_t kOctaveSeedStep = 0x9e3779b9u;
+
+/*
+ * @brief hash of a lattice corner, 4 bits of it pick the gradient of each potential component
+ */
+uint32_t hashCorner(int32_t x, int32_t y, int32_t z, uint32_t seed) {
+	uint32_t h = seed ^ (static_cast<uint32_t>(x) * kPrimeX) ^ (static_cast<uint32_t>(y) * kPrimeY) ^
+		(static_cast<uint32_t>(z) * kPrimeZ);
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+/*
+ * @brief the 12 edge directions of a cube, four of them repeated, picked by 4 hash bits as in improved Perlin noise
+ */
+const float kGradients[16][3] = {
+	{1, 1, 0}, {-1, 1, 0}, {1, -1, 0}, {-1, -1, 0},
+	{1, 0, 1}, {-1, 0, 1}, {1, 0, -1}, {-1, 0, -1},
+	{0, 1, 1}, {0, -1, 1}, {0, 1, -1}, {0, -1, -1},
+	{1, 1, 0}, {0, -1, 1}, {-1, 1, 0}, {0, -1, -1}};
+
+glm::vec3 cornerGradient(uint32_t h) {
+	// a table instead of the branches of the reference implementation, the hash bits are random
+	const float* g = kGradients[h & 15];
+	return glm::vec3(g[0], g[1], g[2]);
+}
+
+/*
+ * @brief quintic fade and its derivative, the noise is C2 so the velocity is C1
+ */
+glm::vec3 fade(const glm::vec3& t) {
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+glm::vec3 fadeDerivative(const glm::vec3& t) {
+	return 30.0f * t * t * (t * (t - 2.0f) + 1.0f);
+}
+
+/*
+ * @brief curl of three gradient noise potentials at q, in lattice units
+ */
+glm::vec3 octaveCurl(const glm::vec3& q, uint32_t seed) {
+	glm::vec3 cell = glm::floor(q);
+	glm::ivec3 c(cell);
+	glm::vec3 f = q - cell;
+	glm::vec3 w = fade(f), dw = fadeDerivative(f);
+	// jacobian[a] is the gradient of potential component a
+	glm::vec3 jacobian[3] = {glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f)};
+	for (int corner = 0; corner < 8; corner++) {
+		glm::ivec3 o(corner & 1, (corner >> 1) & 1, corner >> 2);
+		uint32_t h = hashCorner(c.x + o.x, c.y + o.y, c.z + o.z, seed);
+		glm::vec3 d = f - glm::vec3(o);
+		glm::vec3 wc(o.x ? w.x : 1.0f - w.x, o.y ? w.y : 1.0f - w.y, o.z ? w.z : 1.0f - w.z);
+		glm::vec3 dwc(o.x ? dw.x : -dw.x, o.y ? dw.y : -dw.y, o.z ? dw.z : -dw.z);
+		float weight = wc.x * wc.y * wc.z;
+		glm::vec3 weightGradient(dwc.x * wc.y * wc.z, wc.x * dwc.y * wc.z, wc.x * wc.y * dwc.z);
+		for (int a = 0; a < 3; a++) {
+			glm::vec3 g = cornerGradient(h >> (8 * a));
+			jacobian[a] += weightGradient * glm::dot(g, d) + weight * g;
+		}
+	}
+	return glm::vec3(jacobian[2].y - jacobian[1].z, jacobian[0].z - jacobian[2].x, jacobian[1].x - jacobian[0].y);
+}
+
+/*
+ * @brief frequency and velocity scale of every octave. The potential of octave o is
+ * persistence^o N(lacunarity^o x / lengthScale), its curl grows with (persistence * lacunarity)^o,
+ * normalized so amplitude is the scale of the sum
+ */
+struct Octave {
+	float frequency;
+	float scale;
+	uint32_t seed;
+};
+
+std::vector<Octave> octavesOf(const CurlNoiseField::Parameters& parameters) {
+	std::vector<Octave> octaves;
+	float frequency = 1.0f / parameters.lengthScale, weight = 1.0f, total = 0.0f;
+	for (int o = 0; o < parameters.octaves; o++) {
+		octaves.push_back(Octave{frequency, weight, parameters.seed + static_cast<uint32_t>(o) * kOctaveSeedStep});
+		total += weight;
+		frequency *= parameters.lacunarity;
+		weight *= parameters.persistence * parameters.lacunarity;
+	}
+	for (Octave& octave : octaves) {
+		octave.scale *= parameters.amplitude / total;
+	}
+	return octaves;
+}
+
+#ifdef CURL_NOISE_SSE2
+/*
+ * @brief 32-bit multiply keeping the low half, SSE2 only multiplies even lanes to 64 bits
+ */
+inline __m128i multiplyLow(__m128i a, __m128i b) {
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/*
+ * @brief hashCorner for four corners
+ */
+inline __m128i hashCorner4(__m128i x, __m128i y, __m128i z, __m128i seed) {
+	__m128i h = _mm_xor_si128(seed, multiplyLow(x, _mm_set1_epi32(static_cast<int>(kPrimeX))));
+	h = _mm_xor_si128(h, multiplyLow(y, _mm_set1_epi32(static_cast<int>(kPrimeY))));
+	h = _mm_xor_si128(h, multiplyLow(z, _mm_set1_epi32(static_cast<int>(kPrimeZ))));
+	h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+	h = multiplyLow(h, _mm_set1_epi32(0x7feb352d));
+	h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+	h = multiplyLow(h, _mm_set1_epi32(static_cast<int>(0x846ca68bu)));
+	return _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+}
+
+/*
+ * @brief cornerGradient for four hashes, the selection of the reference implementation as masks
+ */
+inline void cornerGradient4(__m128i h, __m128& gx, __m128& gy, __m128& gz) {
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128i bits = _mm_and_si128(h, _mm_set1_epi32(15));
+	// flipping the sign bit of 1.0 gives the -1 of set bits 0 and 1
+	__m128 su = _mm_xor_ps(one, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(bits, _mm_set1_epi32(1)), 31)));
+	__m128 sv = _mm_xor_ps(one, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(bits, _mm_set1_epi32(2)), 30)));
+	__m128 ux = _mm_castsi128_ps(_mm_cmplt_epi32(bits, _mm_set1_epi32(8)));
+	__m128 vy = _mm_castsi128_ps(_mm_cmplt_epi32(bits, _mm_set1_epi32(4)));
+	__m128 vx = _mm_andnot_ps(vy, _mm_castsi128_ps(_mm_or_si128(_mm_cmpeq_epi32(bits, _mm_set1_epi32(12)),
+		_mm_cmpeq_epi32(bits, _mm_set1_epi32(14)))));
+	gx = _mm_add_ps(_mm_and_ps(ux, su), _mm_and_ps(vx, sv));
+	gy = _mm_add_ps(_mm_andnot_ps(ux, su), _mm_and_ps(vy, sv));
+	gz = _mm_andnot_ps(_mm_or_ps(vy, vx), sv);
+}
+
+/*
+ * @brief floor of four floats within the int32 range, SSE2 only truncates
+ */
+inline __m128 floor4(__m128 x) {
+	__m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+	return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+}
+
+/*
+ * @brief octaveCurl for four points
+ */
+void octaveCurl4(const __m128 q[3], uint32_t seed, __m128 curl[3]) {
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128i seedV = _mm_set1_epi32(static_cast<int>(seed));
+	__m128i c[3], cNext[3];
+	__m128 f[3], w[3], dw[3];
+	for (int axis = 0; axis < 3; axis++) {
+		__m128 cell = floor4(q[axis]);
+		c[axis] = _mm_cvttps_epi32(cell);
+		cNext[axis] = _mm_add_epi32(c[axis], _mm_set1_epi32(1));
+		f[axis] = _mm_sub_ps(q[axis], cell);
+		__m128 t = f[axis];
+		__m128 t2 = _mm_mul_ps(t, t);
+		// t^3 (t (6t - 15) + 10) and 30 t^2 (t (t - 2) + 1)
+		w[axis] = _mm_mul_ps(_mm_mul_ps(t2, t), _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)),
+			_mm_set1_ps(15.0f))), _mm_set1_ps(10.0f)));
+		dw[axis] = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(30.0f), t2), _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(t,
+			_mm_set1_ps(2.0f))), one));
+	}
+	__m128 jacobian[3][3];
+	for (int a = 0; a < 3; a++) {
+		for (int axis = 0; axis < 3; axis++) {
+			jacobian[a][axis] = _mm_setzero_ps();
+		}
+	}
+	for (int corner = 0; corner < 8; corner++) {
+		__m128 d[3], wc[3], dwc[3];
+		__m128i index[3];
+		for (int axis = 0; axis < 3; axis++) {
+			if ((corner >> axis) & 1) {
+				index[axis] = cNext[axis];
+				d[axis] = _mm_sub_ps(f[axis], one);
+				wc[axis] = w[axis];
+				dwc[axis] = dw[axis];
+			} else {
+				index[axis] = c[axis];
+				d[axis] = f[axis];
+				wc[axis] = _mm_sub_ps(one, w[axis]);
+				dwc[axis] = _mm_sub_ps(_mm_setzero_ps(), dw[axis]);
+			}
+		}
+		__m128i h = hashCorner4(index[0], index[1], index[2], seedV);
+		__m128 weight = _mm_mul_ps(_mm_mul_ps(wc[0], wc[1]), wc[2]);
+		__m128 weightGradient[3] = {_mm_mul_ps(_mm_mul_ps(dwc[0], wc[1]), wc[2]),
+			_mm_mul_ps(_mm_mul_ps(wc[0], dwc[1]), wc[2]), _mm_mul_ps(_mm_mul_ps(wc[0], wc[1]), dwc[2])};
+		// shift counts must be immediates, one shifted hash per potential component
+		__m128i hashes[3] = {h, _mm_srli_epi32(h, 8), _mm_srli_epi32(h, 16)};
+		for (int a = 0; a < 3; a++) {
+			__m128 g[3];
+			cornerGradient4(hashes[a], g[0], g[1], g[2]);
+			__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(g[0], d[0]), _mm_mul_ps(g[1], d[1])), _mm_mul_ps(g[2], d[2]));
+			for (int axis = 0; axis < 3; axis++) {
+				jacobian[a][axis] = _mm_add_ps(jacobian[a][axis],
+					_mm_add_ps(_mm_mul_ps(weightGradient[axis], dot), _mm_mul_ps(weight, g[axis])));
+			}
+		}
+	}
+	curl[0] = _mm_sub_ps(jacobian[2][1], jacobian[1][2]);
+	curl[1] = _mm_sub_ps(jacobian[0][2], jacobian[2][0]);
+	curl[2] = _mm_sub_ps(jacobian[1][0], jacobian[0][1]);
+}
+#endif
+
+}
+
+CurlNoiseField::CurlNoiseField(const Parameters& parameters) : _parameters(parameters) {}
+
+void CurlNoiseField::setParameters(const Parameters& parameters) {
+	_parameters = parameters;
+	_version++;
+}
+
+void CurlNoiseField::setBakeRegion(const glm::vec3& lower, const glm::vec3& upper, float spacing) {
+	glm::vec3 extent = glm::max(upper - lower, glm::vec3(spacing));
+	_bakeResolution = glm::max(glm::ivec3(glm::ceil(extent / spacing)), glm::ivec3(1));
+	// cells are stretched a little so the grid covers the region exactly
+	_bakeSpacing = extent / glm::vec3(_bakeResolution);
+	_bakeOrigin = lower;
+	_bakingEnabled = true;
+	_version++;
+}
+
+void CurlNoiseField::disableBaking() {
+	_bakingEnabled = false;
+	_grid = VectorGrid3();
+	_bakedVersion.store(0);
+}
+
+const VectorGrid3& CurlNoiseField::bakedGrid() const {
+	ensureBaked();
+	return _grid;
+}
+
+glm::vec3 CurlNoiseField::evaluate(const glm::vec3& x) const {
+	glm::vec3 velocity = _parameters.baseVelocity;
+	for (const Octave& octave : octavesOf(_parameters)) {
+		velocity += octave.scale * octaveCurl(x * octave.frequency, octave.seed);
+	}
+	return velocity;
+}
+
+void CurlNoiseField::evaluate(VectorChannelView<const float> points, VectorChannelView<float> values) const {
+	const std::vector<Octave> octaves = octavesOf(_parameters);
+	const glm::vec3 base = _parameters.baseVelocity;
+	size_t p = 0;
+#ifdef CURL_NOISE_SSE2
+	const float* coordinates[3] = {points.x, points.y, points.z};
+	float* outputs[3] = {values.x, values.y, values.z};
+	for (; p + 4 <= points.size; p += 4) {
+		__m128 x[3], velocity[3];
+		for (int axis = 0; axis < 3; axis++) {
+			x[axis] = _mm_loadu_ps(coordinates[axis] + p);
+			velocity[axis] = _mm_set1_ps(base[axis]);
+		}
+		for (const Octave& octave : octaves) {
+			__m128 frequency = _mm_set1_ps(octave.frequency), scale = _mm_set1_ps(octave.scale);
+			__m128 q[3] = {_mm_mul_ps(x[0], frequency), _mm_mul_ps(x[1], frequency), _mm_mul_ps(x[2], frequency)};
+			__m128 curl[3];
+			octaveCurl4(q, octave.seed, curl);
+			for (int axis = 0; axis < 3; axis++) {
+				velocity[axis] = _mm_add_ps(velocity[axis], _mm_mul_ps(scale, curl[axis]));
+			}
+		}
+		for (int axis = 0; axis < 3; axis++) {
+			_mm_storeu_ps(outputs[axis] + p, velocity[axis]);
+		}
+	}
+#endif
+	for (; p < points.size; p++) {
+		glm::vec3 velocity = base;
+		for (const Octave& octave : octaves) {
+			velocity += octave.scale * octaveCurl(points.get(p) * octave.frequency, octave.seed);
+		}
+		values.set(p, velocity);
+	}
+}
+
+glm::vec3 CurlNoiseField::sample(const glm::vec3& x) const {
+	if (_bakingEnabled) {
+		ensureBaked();
+		return _grid.sample(x);
+	}
+	return evaluate(x);
+}
+
+void CurlNoiseField::sample(Span<const glm::vec3> points, Span<glm::vec3> values) const {
+	if (_bakingEnabled) {
+		ensureBaked();
+		_grid.sample(points, values);
+		return;
+	}
+	for (size_t i = 0; i < points.size(); i++) {
+		values[i] = evaluate(points[i]);
+	}
+}
+
+void CurlNoiseField::sample(VectorChannelView<const float> points, VectorChannelView<float> values) const {
+	if (_bakingEnabled) {
+		ensureBaked();
+		_grid.sample(points, values);
+		return;
+	}
+	evaluate(points, values);
+}
+
+void CurlNoiseField::ensureBaked() const {
+	if (_bakedVersion.load(std::memory_order_acquire) == _version) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(_bakeMutex);
+	if (_bakedVersion.load(std::memory_order_relaxed) != _version) {
+		bake();
+		_bakedVersion.store(_version, std::memory_order_release);
+	}
+}
+
+void CurlNoiseField::bake() const {
+	_grid.resize(_bakeResolution, _bakeSpacing, _bakeOrigin);
+	const glm::ivec3 n = _bakeResolution;
+	parallelFor(0, n.z, [&](size_t begin, size_t end) {
+		// one row of cell centers at a time, written straight into the component arrays
+		std::vector<float> x(n.x), y(n.x), z(n.x);
+		for (int i = 0; i < n.x; i++) {
+			x[i] = _grid.dataPosition(i, 0, 0).x;
+		}
+		for (int k = static_cast<int>(begin); k < static_cast<int>(end); k++) {
+			for (int j = 0; j < n.y; j++) {
+				glm::vec3 rowStart = _grid.dataPosition(0, j, k);
+				std::fill(y.begin(), y.end(), rowStart.y);
+				std::fill(z.begin(), z.end(), rowStart.z);
+				size_t row = _grid.component(0).index(0, j, k);
+				evaluate(VectorChannelView<const float>{x.data(), y.data(), z.data(), static_cast<size_t>(n.x)},
+					VectorChannelView<float>{_grid.component(0).data() + row, _grid.component(1).data() + row,
+					_grid.component(2).data() + row, static_cast<size_t>(n.x)});
+			}
+		}
+	}, 1);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include <glm/glm.hpp>
+
+#include "field.h"
+#include "grid3.h"
+#include "particle_system_data.h"
+#include "span.h"
+
+/*
+ * Turbulent wind (Bridson et al., curl noise for procedural fluid flow). The
+ * velocity is the curl of a vector potential built from three gradient noise
+ * fields summed over octaves, so it is divergence free by construction and
+ * the wind swirls without sources or sinks.
+ *
+ * The analytic evaluation is exact but costs dozens of hashes per point. For
+ * per-particle sampling, setBakeRegion stores the field in a VectorGrid3 that is
+ * sampled trilinearly, rebaked on the next sample after the parameters change.
+ */
+class CurlNoiseField : public VectorField {
+public:
+	struct Parameters {
+		// mean wind the turbulence is added to
+		glm::vec3 baseVelocity{0.0f};
+		// typical speed of the turbulence
+		float amplitude = 1.0f;
+		// size of the largest eddies
+		float lengthScale = 1.0f;
+		int octaves = 3;
+		// frequency ratio between successive octaves
+		float lacunarity = 2.0f;
+		// potential ratio between successive octaves
+		float persistence = 0.5f;
+		uint32_t seed = 0;
+	};
+
+	CurlNoiseField() = default;
+
+	explicit CurlNoiseField(const Parameters& parameters);
+
+	const Parameters& parameters() const { return _parameters; }
+
+	/*
+	 * @brief not safe while other threads sample, the bake is refreshed by the next sample
+	 */
+	void setParameters(const Parameters& parameters);
+
+	/*
+	 * @brief sample from a grid covering [lower, upper] with cells of about spacing,
+	 * points outside are clamped to the region
+	 */
+	void setBakeRegion(const glm::vec3& lower, const glm::vec3& upper, float spacing);
+
+	/*
+	 * @brief go back to the analytic evaluation
+	 */
+	void disableBaking();
+
+	bool bakingEnabled() const { return _bakingEnabled; }
+
+	/*
+	 * @brief the baked grid, baked first if it is out of date
+	 */
+	const VectorGrid3& bakedGrid() const;
+
+	/*
+	 * @brief analytic velocity, ignores the bake
+	 */
+	glm::vec3 evaluate(const glm::vec3& x) const;
+
+	/*
+	 * @brief analytic velocities of a batch, four points at a time with SSE2 where available
+	 */
+	void evaluate(VectorChannelView<const float> points, VectorChannelView<float> values) const;
+
+	glm::vec3 sample(const glm::vec3& x) const override;
+
+	void sample(Span<const glm::vec3> points, Span<glm::vec3> values) const override;
+
+	void sample(VectorChannelView<const float> points, VectorChannelView<float> values) const override;
+
+private:
+	/*
+	 * @brief bake if the grid is older than the parameters, safe to call from several threads
+	 */
+	void ensureBaked() const;
+
+	void bake() const;
+
+	Parameters _parameters;
+	bool _bakingEnabled = false;
+	glm::ivec3 _bakeResolution{0};
+	glm::vec3 _bakeSpacing{1.0f};
+	glm::vec3 _bakeOrigin{0.0f};
+	// bumped by every change of the parameters or the region, the grid holds _bakedVersion
+	uint64_t _version = 1;
+	mutable std::atomic<uint64_t> _bakedVersion{0};
+	mutable std::mutex _bakeMutex;
+	mutable VectorGrid3 _grid;
+};
@@ -1,9 +1,20 @@
 #ifndef _FIELD_H_
 #define _FIELD_H_
 
+#include <algorithm>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
+#include "particle_system_data.h"
+#include "span.h"
+
+/*
+ * Every field can be sampled one point at a time or in batches. The batched
+ * overloads loop over the single point sample by default, fields that are
+ * sampled for many particles override them to pay for one virtual call per
+ * batch instead of one per point. Subclasses that override only some overloads
+ * need a using declaration to keep the others visible.
+ */
 class Field
 {
 public:
@@ -16,6 +27,21 @@ public:
     ScalarField() {}
     virtual ~ScalarField() {}
     virtual double sample(const glm::vec3 x) const = 0;
+    /* values[i] is the field at points[i] */
+    virtual void sample(Span<const glm::vec3> points, Span<double> values) const
+    {
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            values[i] = sample(points[i]);
+        }
+    }
+    virtual void sample(VectorChannelView<const float> points, Span<double> values) const
+    {
+        for (size_t i = 0; i < points.size; i++)
+        {
+            values[i] = sample(points.get(i));
+        }
+    }
 };
 class VectorField : public Field
 {
@@ -23,9 +49,25 @@ public:
     VectorField() {}
     virtual ~VectorField() {}
     virtual glm::vec3 sample(const glm::vec3 &x) const = 0;
+    /* values[i] is the field at points[i] */
+    virtual void sample(Span<const glm::vec3> points, Span<glm::vec3> values) const
+    {
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            values[i] = sample(points[i]);
+        }
+    }
+    virtual void sample(VectorChannelView<const float> points, VectorChannelView<float> values) const
+    {
+        for (size_t i = 0; i < points.size; i++)
+        {
+            values.set(i, sample(points.get(i)));
+        }
+    }
 };
 
-class ConstantVectorField : public VectorField
+/* final, so calls through a ConstantVectorField pointer are resolved and inlined at compile time */
+class ConstantVectorField final : public VectorField
 {
 public:
     ConstantVectorField(const glm::vec3 &v) : value(v)
@@ -35,12 +77,26 @@ public:
     {
         return value;
     }
+    void sample(Span<const glm::vec3> points, Span<glm::vec3> values) const override
+    {
+        std::fill(values.begin(), values.begin() + points.size(), value);
+    }
+    void sample(VectorChannelView<const float> points, VectorChannelView<float> values) const override
+    {
+        std::fill(values.x, values.x + points.size, value.x);
+        std::fill(values.y, values.y + points.size, value.y);
+        std::fill(values.z, values.z + points.size, value.z);
+    }
     void setValue(const glm::vec3 &x)
     {
         value = x;
     }
+    const glm::vec3 &getValue() const
+    {
+        return value;
+    }
 
 private:
     glm::vec3 value;
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,434 @@
+#include <algorithm>
+
+#include "grid3.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GRID3_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+/*
+ * @brief Catmull-Rom weights of the lattice points at -1, 0, 1 and 2 for a position t in [0, 1]
+ */
+void catmullRomWeights(float t, float weights[4]) {
+	float t2 = t * t, t3 = t2 * t;
+	weights[0] = 0.5f * (-t3 + 2.0f * t2 - t);
+	weights[1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+	weights[2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+	weights[3] = 0.5f * (t3 - t2);
+}
+
+/*
+ * @brief trilinear samples of several arrays on the same lattice, the stencil is found once per point
+ */
+template <typename Output>
+void sampleLinearBatch(const GridArray3* const* arrays, Output* const* outputs, int count,
+	VectorChannelView<const float> points) {
+	const GridArray3& lattice = *arrays[0];
+	size_t p = 0;
+#ifdef GRID3_SSE2
+	const glm::ivec3 n = lattice.resolution();
+	const glm::vec3 origin = lattice.dataOrigin();
+	const glm::vec3 inverseSpacing = 1.0f / lattice.gridSpacing();
+	const size_t dx = n.x > 1 ? 1 : 0;
+	const size_t dy = n.y > 1 ? static_cast<size_t>(n.x) : 0;
+	const size_t dz = n.z > 1 ? static_cast<size_t>(n.x) * n.y : 0;
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128 originV[3], inverseV[3], lastV[3], lastBaseV[3];
+	for (int axis = 0; axis < 3; axis++) {
+		originV[axis] = _mm_set1_ps(origin[axis]);
+		inverseV[axis] = _mm_set1_ps(inverseSpacing[axis]);
+		lastV[axis] = _mm_set1_ps(static_cast<float>(n[axis] - 1));
+		lastBaseV[axis] = _mm_set1_ps(static_cast<float>(std::max(n[axis] - 2, 0)));
+	}
+	const float* coordinates[3] = {points.x, points.y, points.z};
+
+	for (; p + 4 <= points.size; p += 4) {
+		__m128 t[3];
+		alignas(16) int base[3][4];
+		for (int axis = 0; axis < 3; axis++) {
+			__m128 g = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(coordinates[axis] + p), originV[axis]), inverseV[axis]);
+			g = _mm_min_ps(_mm_max_ps(g, zero), lastV[axis]);
+			// g is not negative, truncation is floor
+			__m128 b = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(g)), lastBaseV[axis]);
+			t[axis] = _mm_sub_ps(g, b);
+			_mm_store_si128(reinterpret_cast<__m128i*>(base[axis]), _mm_cvttps_epi32(b));
+		}
+		size_t index[4];
+		for (int lane = 0; lane < 4; lane++) {
+			index[lane] = lattice.index(base[0][lane], base[1][lane], base[2][lane]);
+		}
+		for (int a = 0; a < count; a++) {
+			const float* data = arrays[a]->data();
+			// SSE2 has no gather, the corners are loaded per lane and blended four points at a time
+			alignas(16) float corner[8][4];
+			for (int lane = 0; lane < 4; lane++) {
+				const float* c = data + index[lane];
+				corner[0][lane] = c[0];
+				corner[1][lane] = c[dx];
+				corner[2][lane] = c[dy];
+				corner[3][lane] = c[dx + dy];
+				corner[4][lane] = c[dz];
+				corner[5][lane] = c[dx + dz];
+				corner[6][lane] = c[dy + dz];
+				corner[7][lane] = c[dx + dy + dz];
+			}
+			__m128 sx = _mm_sub_ps(one, t[0]);
+			__m128 c00 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(corner[0]), sx), _mm_mul_ps(_mm_load_ps(corner[1]), t[0]));
+			__m128 c10 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(corner[2]), sx), _mm_mul_ps(_mm_load_ps(corner[3]), t[0]));
+			__m128 c01 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(corner[4]), sx), _mm_mul_ps(_mm_load_ps(corner[5]), t[0]));
+			__m128 c11 = _mm_add_ps(_mm_mul_ps(_mm_load_ps(corner[6]), sx), _mm_mul_ps(_mm_load_ps(corner[7]), t[0]));
+			__m128 sy = _mm_sub_ps(one, t[1]);
+			__m128 c0 = _mm_add_ps(_mm_mul_ps(c00, sy), _mm_mul_ps(c10, t[1]));
+			__m128 c1 = _mm_add_ps(_mm_mul_ps(c01, sy), _mm_mul_ps(c11, t[1]));
+			__m128 value = _mm_add_ps(_mm_mul_ps(c0, _mm_sub_ps(one, t[2])), _mm_mul_ps(c1, t[2]));
+			alignas(16) float result[4];
+			_mm_store_ps(result, value);
+			for (int lane = 0; lane < 4; lane++) {
+				outputs[a][p + lane] = static_cast<Output>(result[lane]);
+			}
+		}
+	}
+#endif
+	for (; p < points.size; p++) {
+		GridArray3::LinearStencil stencil = lattice.linearStencil(points.get(p));
+		for (int a = 0; a < count; a++) {
+			outputs[a][p] = static_cast<Output>(arrays[a]->interpolate(stencil));
+		}
+	}
+}
+
+/*
+ * @brief resize output to the cells of a grid unless it matches already
+ */
+template <typename Grid, typename Output>
+void matchCells(const Grid& grid, Output& output) {
+	if (output.resolution() != grid.resolution() || output.gridSpacing() != grid.gridSpacing() ||
+		output.origin() != grid.origin()) {
+		output.resize(grid.resolution(), grid.gridSpacing(), grid.origin());
+	}
+}
+
+/*
+ * @brief run body(i, j, k) for every cell, in parallel over z slices
+ */
+template <typename Body>
+void forEachCell(const glm::ivec3& resolution, const Body& body) {
+	parallelFor(0, resolution.z, [&](size_t begin, size_t end) {
+		for (int k = static_cast<int>(begin); k < static_cast<int>(end); k++) {
+			for (int j = 0; j < resolution.y; j++) {
+				for (int i = 0; i < resolution.x; i++) {
+					body(i, j, k);
+				}
+			}
+		}
+	}, 1);
+}
+
+}
+
+GridArray3::GridArray3(const glm::ivec3& resolution, const glm::vec3& gridSpacing, const glm::vec3& dataOrigin,
+	float initialValue)
+	: _resolution(glm::max(resolution, glm::ivec3(1))), _gridSpacing(gridSpacing),
+	_inverseGridSpacing(1.0f / gridSpacing), _dataOrigin(dataOrigin) {
+	_data.resize(static_cast<size_t>(_resolution.x) * _resolution.y * _resolution.z, initialValue);
+}
+
+GridArray3::LinearStencil GridArray3::linearStencil(const glm::vec3& x) const {
+	glm::vec3 g = glm::clamp((x - _dataOrigin) * _inverseGridSpacing, glm::vec3(0.0f), glm::vec3(_resolution - 1));
+	glm::ivec3 base = glm::min(glm::ivec3(g), glm::max(_resolution - 2, glm::ivec3(0)));
+	LinearStencil stencil;
+	stencil.base = index(base.x, base.y, base.z);
+	stencil.dx = _resolution.x > 1 ? 1 : 0;
+	stencil.dy = _resolution.y > 1 ? static_cast<size_t>(_resolution.x) : 0;
+	stencil.dz = _resolution.z > 1 ? static_cast<size_t>(_resolution.x) * _resolution.y : 0;
+	stencil.t = g - glm::vec3(base);
+	return stencil;
+}
+
+float GridArray3::interpolate(const LinearStencil& s) const {
+	const float* c = _data.data() + s.base;
+	float c00 = c[0] + s.t.x * (c[s.dx] - c[0]);
+	float c10 = c[s.dy] + s.t.x * (c[s.dx + s.dy] - c[s.dy]);
+	float c01 = c[s.dz] + s.t.x * (c[s.dx + s.dz] - c[s.dz]);
+	float c11 = c[s.dy + s.dz] + s.t.x * (c[s.dx + s.dy + s.dz] - c[s.dy + s.dz]);
+	float c0 = c00 + s.t.y * (c10 - c00);
+	float c1 = c01 + s.t.y * (c11 - c01);
+	return c0 + s.t.z * (c1 - c0);
+}
+
+float GridArray3::sampleCubic(const glm::vec3& x) const {
+	glm::vec3 g = glm::clamp((x - _dataOrigin) * _inverseGridSpacing, glm::vec3(0.0f), glm::vec3(_resolution - 1));
+	glm::ivec3 base = glm::min(glm::ivec3(g), glm::max(_resolution - 2, glm::ivec3(0)));
+	glm::vec3 t = g - glm::vec3(base);
+	float wx[4], wy[4], wz[4];
+	catmullRomWeights(t.x, wx);
+	catmullRomWeights(t.y, wy);
+	catmullRomWeights(t.z, wz);
+
+	bool interior = glm::all(glm::greaterThanEqual(base, glm::ivec3(1))) &&
+		glm::all(glm::lessThan(base + 2, _resolution));
+	if (interior) {
+#ifdef GRID3_SSE2
+		// the four x neighbors of a row are contiguous, one load and multiply per row
+		const __m128 weightsX = _mm_loadu_ps(wx);
+		__m128 sum = _mm_setzero_ps();
+		for (int c = 0; c < 4; c++) {
+			for (int r = 0; r < 4; r++) {
+				__m128 row = _mm_loadu_ps(_data.data() + index(base.x - 1, base.y - 1 + r, base.z - 1 + c));
+				sum = _mm_add_ps(sum, _mm_mul_ps(row, _mm_set1_ps(wy[r] * wz[c])));
+			}
+		}
+		sum = _mm_mul_ps(sum, weightsX);
+		sum = _mm_add_ps(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtss_f32(sum);
+#else
+		float sum = 0.0f;
+		for (int c = 0; c < 4; c++) {
+			for (int r = 0; r < 4; r++) {
+				const float* row = _data.data() + index(base.x - 1, base.y - 1 + r, base.z - 1 + c);
+				sum += wy[r] * wz[c] * (wx[0] * row[0] + wx[1] * row[1] + wx[2] * row[2] + wx[3] * row[3]);
+			}
+		}
+		return sum;
+#endif
+	}
+
+	float sum = 0.0f;
+	for (int c = 0; c < 4; c++) {
+		for (int r = 0; r < 4; r++) {
+			float row = 0.0f;
+			for (int q = 0; q < 4; q++) {
+				row += wx[q] * at(base.x - 1 + q, base.y - 1 + r, base.z - 1 + c);
+			}
+			sum += wy[r] * wz[c] * row;
+		}
+	}
+	return sum;
+}
+
+void GridArray3::sampleLinear(VectorChannelView<const float> points, float* values) const {
+	const GridArray3* arrays[1] = {this};
+	float* outputs[1] = {values};
+	sampleLinearBatch(arrays, outputs, 1, points);
+}
+
+void GridArray3::sampleLinear(VectorChannelView<const float> points, double* values) const {
+	const GridArray3* arrays[1] = {this};
+	double* outputs[1] = {values};
+	sampleLinearBatch(arrays, outputs, 1, points);
+}
+
+float GridArray3::difference(int axis, int i, int j, int k) const {
+	glm::ivec3 lower(i, j, k), upper(i, j, k);
+	lower[axis] = std::max(lower[axis] - 1, 0);
+	upper[axis] = std::min(upper[axis] + 1, _resolution[axis] - 1);
+	int span = upper[axis] - lower[axis];
+	if (span == 0) {
+		return 0.0f;
+	}
+	return ((*this)(upper.x, upper.y, upper.z) - (*this)(lower.x, lower.y, lower.z)) * _inverseGridSpacing[axis] / span;
+}
+
+float GridArray3::laplacian(int i, int j, int k) const {
+	float center = (*this)(i, j, k);
+	glm::vec3 inverseSpacing2 = _inverseGridSpacing * _inverseGridSpacing;
+	return (at(i + 1, j, k) + at(i - 1, j, k) - 2.0f * center) * inverseSpacing2.x +
+		(at(i, j + 1, k) + at(i, j - 1, k) - 2.0f * center) * inverseSpacing2.y +
+		(at(i, j, k + 1) + at(i, j, k - 1) - 2.0f * center) * inverseSpacing2.z;
+}
+
+ScalarGrid3::ScalarGrid3(const glm::ivec3& resolution, const glm::vec3& gridSpacing, const glm::vec3& origin,
+	float initialValue) {
+	resize(resolution, gridSpacing, origin, initialValue);
+}
+
+void ScalarGrid3::resize(const glm::ivec3& resolution, const glm::vec3& gridSpacing, const glm::vec3& origin,
+	float initialValue) {
+	_origin = origin;
+	_data = GridArray3(resolution, gridSpacing, origin + 0.5f * gridSpacing, initialValue);
+}
+
+void ScalarGrid3::sample(Span<const glm::vec3> points, Span<double> values) const {
+	for (size_t i = 0; i < points.size(); i++) {
+		values[i] = _data.sampleLinear(points[i]);
+	}
+}
+
+void ScalarGrid3::sample(VectorChannelView<const float> points, Span<double> values) const {
+	_data.sampleLinear(points, values.data());
+}
+
+glm::vec3 ScalarGrid3::gradient(int i, int j, int k) const {
+	return glm::vec3(_data.difference(0, i, j, k), _data.difference(1, i, j, k), _data.difference(2, i, j, k));
+}
+
+void ScalarGrid3::gradient(VectorGrid3& output) const {
+	matchCells(*this, output);
+	forEachCell(resolution(), [&](int i, int j, int k) { output.set(i, j, k, gradient(i, j, k)); });
+}
+
+void ScalarGrid3::laplacian(ScalarGrid3& output) const {
+	matchCells(*this, output);
+	forEachCell(resolution(), [&](int i, int j, int k) { output(i, j, k) = laplacian(i, j, k); });
+}
+
+VectorGrid3::VectorGrid3(const glm::ivec3& resolution, const glm::vec3& gridSpacing, const glm::vec3& origin,
+	const glm::vec3& initialValue) {
+	resize(resolution, gridSpacing, origin, initialValue);
+}
+
+void VectorGrid3::resize(const glm::ivec3& resolution, const glm::vec3& gridSpacing, const glm::vec3& origin,
+	const glm::vec3& initialValue) {
+	_origin = origin;
+	for (int axis = 0; axis < 3; axis++) {
+		_components[axis] = GridArray3(resolution, gridSpacing, origin + 0.5f * gridSpacing, initialValue[axis]);
+	}
+}
+
+void VectorGrid3::fill(const glm::vec3& value) {
+	for (int axis = 0; axis < 3; axis++) {
+		_components[axis].fill(value[axis]);
+	}
+}
+
+glm::vec3 VectorGrid3::sample(const glm::vec3& x) const {
+	// the components share the lattice, the stencil is found once
+	GridArray3::LinearStencil stencil = _components[0].linearStencil(x);
+	return glm::vec3(_components[0].interpolate(stencil), _components[1].interpolate(stencil),
+		_components[2].interpolate(stencil));
+}
+
+void VectorGrid3::sample(Span<const glm::vec3> points, Span<glm::vec3> values) const {
+	for (size_t i = 0; i < points.size(); i++) {
+		values[i] = sample(points[i]);
+	}
+}
+
+void VectorGrid3::sample(VectorChannelView<const float> points, VectorChannelView<float> values) const {
+	const GridArray3* arrays[3] = {&_components[0], &_components[1], &_components[2]};
+	float* outputs[3] = {values.x, values.y, values.z};
+	sampleLinearBatch(arrays, outputs, 3, points);
+}
+
+glm::vec3 VectorGrid3::sampleCubic(const glm::vec3& x) const {
+	return glm::vec3(_components[0].sampleCubic(x), _components[1].sampleCubic(x), _components[2].sampleCubic(x));
+}
+
+float VectorGrid3::divergence(int i, int j, int k) const {
+	return _components[0].difference(0, i, j, k) + _components[1].difference(1, i, j, k) +
+		_components[2].difference(2, i, j, k);
+}
+
+glm::vec3 VectorGrid3::curl(int i, int j, int k) const {
+	return glm::vec3(_components[2].difference(1, i, j, k) - _components[1].difference(2, i, j, k),
+		_components[0].difference(2, i, j, k) - _components[2].difference(0, i, j, k),
+		_components[1].difference(0, i, j, k) - _components[0].difference(1, i, j, k));
+}
+
+glm::vec3 VectorGrid3::laplacian(int i, int j, int k) const {
+	return glm::vec3(_components[0].laplacian(i, j, k), _components[1].laplacian(i, j, k),
+		_components[2].laplacian(i, j, k));
+}
+
+void VectorGrid3::divergence(ScalarGrid3& output) const {
+	matchCells(*this, output);
+	forEachCell(resolution(), [&](int i, int j, int k) { output(i, j, k) = divergence(i, j, k); });
+}
+
+void VectorGrid3::curl(VectorGrid3& output) const {
+	matchCells(*this, output);
+	forEachCell(resolution(), [&](int i, int j, int k) { output.set(i, j, k, curl(i, j, k)); });
+}
+
+FaceCenteredGrid3::FaceCenteredGrid3(const glm::ivec3& resolution, const glm::vec3& gridSpacing,
+	const glm::vec3& origin, const glm::vec3& initialValue) {
+	resize(resolution, gridSpacing, origin, initialValue);
+}
+
+void FaceCenteredGrid3::resize(const glm::ivec3& resolution, const glm::vec3& gridSpacing, const glm::vec3& origin,
+	const glm::vec3& initialValue) {
+	_resolution = glm::max(resolution, glm::ivec3(1));
+	_origin = origin;
+	for (int axis = 0; axis < 3; axis++) {
+		glm::ivec3 faces = _resolution;
+		faces[axis]++;
+		glm::vec3 offset(0.5f);
+		offset[axis] = 0.0f;
+		_components[axis] = GridArray3(faces, gridSpacing, origin + offset * gridSpacing, initialValue[axis]);
+	}
+}
+
+void FaceCenteredGrid3::fill(const glm::vec3& value) {
+	for (int axis = 0; axis < 3; axis++) {
+		_components[axis].fill(value[axis]);
+	}
+}
+
+glm::vec3 FaceCenteredGrid3::valueAtCellCenter(int i, int j, int k) const {
+	return 0.5f * glm::vec3(_components[0](i, j, k) + _components[0](i + 1, j, k),
+		_components[1](i, j, k) + _components[1](i, j + 1, k),
+		_components[2](i, j, k) + _components[2](i, j, k + 1));
+}
+
+glm::vec3 FaceCenteredGrid3::sample(const glm::vec3& x) const {
+	return glm::vec3(_components[0].sampleLinear(x), _components[1].sampleLinear(x), _components[2].sampleLinear(x));
+}
+
+void FaceCenteredGrid3::sample(Span<const glm::vec3> points, Span<glm::vec3> values) const {
+	for (size_t i = 0; i < points.size(); i++) {
+		values[i] = sample(points[i]);
+	}
+}
+
+void FaceCenteredGrid3::sample(VectorChannelView<const float> points, VectorChannelView<float> values) const {
+	// every component sits on its own lattice
+	_components[0].sampleLinear(points, values.x);
+	_components[1].sampleLinear(points, values.y);
+	_components[2].sampleLinear(points, values.z);
+}
+
+glm::vec3 FaceCenteredGrid3::sampleCubic(const glm::vec3& x) const {
+	return glm::vec3(_components[0].sampleCubic(x), _components[1].sampleCubic(x), _components[2].sampleCubic(x));
+}
+
+float FaceCenteredGrid3::divergence(int i, int j, int k) const {
+	glm::vec3 inverseSpacing = 1.0f / gridSpacing();
+	return (_components[0](i + 1, j, k) - _components[0](i, j, k)) * inverseSpacing.x +
+		(_components[1](i, j + 1, k) - _components[1](i, j, k)) * inverseSpacing.y +
+		(_components[2](i, j, k + 1) - _components[2](i, j, k)) * inverseSpacing.z;
+}
+
+glm::vec3 FaceCenteredGrid3::curl(int i, int j, int k) const {
+	// central differences of the cell center velocities, one sided at the border
+	glm::vec3 inverseSpacing = 1.0f / gridSpacing();
+	glm::ivec3 cell(i, j, k);
+	glm::mat3 derivatives(0.0f);
+	for (int axis = 0; axis < 3; axis++) {
+		glm::ivec3 lower = cell, upper = cell;
+		lower[axis] = std::max(lower[axis] - 1, 0);
+		upper[axis] = std::min(upper[axis] + 1, _resolution[axis] - 1);
+		int span = upper[axis] - lower[axis];
+		if (span > 0) {
+			// column axis holds d(velocity)/d(axis)
+			derivatives[axis] = (valueAtCellCenter(upper.x, upper.y, upper.z) -
+				valueAtCellCenter(lower.x, lower.y, lower.z)) * (inverseSpacing[axis] / span);
+		}
+	}
+	return glm::vec3(derivatives[1].z - derivatives[2].y, derivatives[2].x - derivatives[0].z,
+		derivatives[0].y - derivatives[1].x);
+}
+
+void FaceCenteredGrid3::divergence(ScalarGrid3& output) const {
+	matchCells(*this, output);
+	forEachCell(_resolution, [&](int i, int j, int k) { output(i, j, k) = divergence(i, j, k); });
+}
+
+void FaceCenteredGrid3::curl(VectorGrid3& output) const {
+	matchCells(*this, output);
+	forEachCell(_resolution, [&](int i, int j, int k) { output.set(i, j, k, curl(i, j, k)); });
+}
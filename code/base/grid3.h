@@ -0,0 +1,322 @@
+#pragma once
+
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+#include "aligned_memory.h"
+#include "field.h"
+#include "particle_system_data.h"
+#include "span.h"
+#include "thread_pool.h"
+
+/*
+ * @brief floats on a regular lattice, x varies fastest. Sample (0, 0, 0) sits at dataOrigin,
+ * lookups outside the lattice are clamped to its border
+ */
+class GridArray3 {
+public:
+	GridArray3() = default;
+
+	GridArray3(const glm::ivec3& resolution, const glm::vec3& gridSpacing, const glm::vec3& dataOrigin,
+		float initialValue = 0.0f);
+
+	const glm::ivec3& resolution() const { return _resolution; }
+
+	const glm::vec3& gridSpacing() const { return _gridSpacing; }
+
+	const glm::vec3& dataOrigin() const { return _dataOrigin; }
+
+	float* data() { return _data.data(); }
+
+	const float* data() const { return _data.data(); }
+
+	size_t size() const { return _data.size(); }
+
+	size_t index(int i, int j, int k) const {
+		return (static_cast<size_t>(k) * _resolution.y + j) * _resolution.x + i;
+	}
+
+	float& operator()(int i, int j, int k) { return _data[index(i, j, k)]; }
+
+	float operator()(int i, int j, int k) const { return _data[index(i, j, k)]; }
+
+	/*
+	 * @brief value at a lattice point, indices outside the lattice are clamped
+	 */
+	float at(int i, int j, int k) const {
+		return (*this)(glm::clamp(i, 0, _resolution.x - 1), glm::clamp(j, 0, _resolution.y - 1),
+			glm::clamp(k, 0, _resolution.z - 1));
+	}
+
+	glm::vec3 position(int i, int j, int k) const { return _dataOrigin + _gridSpacing * glm::vec3(i, j, k); }
+
+	void fill(float value) { _data.fill(value); }
+
+	/*
+	 * @brief set every lattice point to function(position), in parallel over z slices
+	 */
+	template <typename Function>
+	void fill(const Function& function) {
+		parallelFor(0, _resolution.z, [&](size_t begin, size_t end) {
+			for (int k = static_cast<int>(begin); k < static_cast<int>(end); k++) {
+				for (int j = 0; j < _resolution.y; j++) {
+					for (int i = 0; i < _resolution.x; i++) {
+						(*this)(i, j, k) = function(position(i, j, k));
+					}
+				}
+			}
+		}, 1);
+	}
+
+	/*
+	 * @brief the eight lattice points around a position and the interpolation weights between them
+	 */
+	struct LinearStencil {
+		size_t base;
+		size_t dx, dy, dz;
+		glm::vec3 t;
+	};
+
+	LinearStencil linearStencil(const glm::vec3& x) const;
+
+	float interpolate(const LinearStencil& stencil) const;
+
+	float sampleLinear(const glm::vec3& x) const { return interpolate(linearStencil(x)); }
+
+	/*
+	 * @brief tricubic Catmull-Rom interpolation, passes through the lattice values and may overshoot between them
+	 */
+	float sampleCubic(const glm::vec3& x) const;
+
+	/*
+	 * @brief trilinear samples of a batch of points, four at a time with SSE2 where available
+	 */
+	void sampleLinear(VectorChannelView<const float> points, float* values) const;
+
+	void sampleLinear(VectorChannelView<const float> points, double* values) const;
+
+	/*
+	 * @brief central difference along axis, one sided at the border
+	 */
+	float difference(int axis, int i, int j, int k) const;
+
+	/*
+	 * @brief 7-point Laplacian, the border is treated as zero gradient
+	 */
+	float laplacian(int i, int j, int k) const;
+
+private:
+	glm::ivec3 _resolution{0};
+	glm::vec3 _gridSpacing{1.0f};
+	glm::vec3 _inverseGridSpacing{1.0f};
+	glm::vec3 _dataOrigin{0.0f};
+	AlignedArray<float> _data;
+};
+
+class VectorGrid3;
+
+/*
+ * @brief cell-centered scalar grid, the cells span [origin, origin + resolution * gridSpacing]
+ */
+class ScalarGrid3 : public ScalarField {
+public:
+	ScalarGrid3() = default;
+
+	ScalarGrid3(const glm::ivec3& resolution, const glm::vec3& gridSpacing = glm::vec3(1.0f),
+		const glm::vec3& origin = glm::vec3(0.0f), float initialValue = 0.0f);
+
+	void resize(const glm::ivec3& resolution, const glm::vec3& gridSpacing, const glm::vec3& origin,
+		float initialValue = 0.0f);
+
+	const glm::ivec3& resolution() const { return _data.resolution(); }
+
+	const glm::vec3& gridSpacing() const { return _data.gridSpacing(); }
+
+	const glm::vec3& origin() const { return _origin; }
+
+	GridArray3& data() { return _data; }
+
+	const GridArray3& data() const { return _data; }
+
+	float& operator()(int i, int j, int k) { return _data(i, j, k); }
+
+	float operator()(int i, int j, int k) const { return _data(i, j, k); }
+
+	glm::vec3 dataPosition(int i, int j, int k) const { return _data.position(i, j, k); }
+
+	void fill(float value) { _data.fill(value); }
+
+	template <typename Function>
+	void fill(const Function& function) {
+		_data.fill(function);
+	}
+
+	double sample(const glm::vec3 x) const override { return _data.sampleLinear(x); }
+
+	void sample(Span<const glm::vec3> points, Span<double> values) const override;
+
+	void sample(VectorChannelView<const float> points, Span<double> values) const override;
+
+	float sampleCubic(const glm::vec3& x) const { return _data.sampleCubic(x); }
+
+	glm::vec3 gradient(int i, int j, int k) const;
+
+	float laplacian(int i, int j, int k) const { return _data.laplacian(i, j, k); }
+
+	/*
+	 * @brief gradient at every cell center, output is resized to match
+	 */
+	void gradient(VectorGrid3& output) const;
+
+	void laplacian(ScalarGrid3& output) const;
+
+private:
+	glm::vec3 _origin{0.0f};
+	GridArray3 _data;
+};
+
+/*
+ * @brief cell-centered vector grid, the components are stored as three separate arrays
+ */
+class VectorGrid3 : public VectorField {
+public:
+	VectorGrid3() = default;
+
+	VectorGrid3(const glm::ivec3& resolution, const glm::vec3& gridSpacing = glm::vec3(1.0f),
+		const glm::vec3& origin = glm::vec3(0.0f), const glm::vec3& initialValue = glm::vec3(0.0f));
+
+	void resize(const glm::ivec3& resolution, const glm::vec3& gridSpacing, const glm::vec3& origin,
+		const glm::vec3& initialValue = glm::vec3(0.0f));
+
+	const glm::ivec3& resolution() const { return _components[0].resolution(); }
+
+	const glm::vec3& gridSpacing() const { return _components[0].gridSpacing(); }
+
+	const glm::vec3& origin() const { return _origin; }
+
+	GridArray3& component(int axis) { return _components[axis]; }
+
+	const GridArray3& component(int axis) const { return _components[axis]; }
+
+	glm::vec3 operator()(int i, int j, int k) const {
+		return glm::vec3(_components[0](i, j, k), _components[1](i, j, k), _components[2](i, j, k));
+	}
+
+	void set(int i, int j, int k, const glm::vec3& value) {
+		_components[0](i, j, k) = value.x;
+		_components[1](i, j, k) = value.y;
+		_components[2](i, j, k) = value.z;
+	}
+
+	glm::vec3 dataPosition(int i, int j, int k) const { return _components[0].position(i, j, k); }
+
+	void fill(const glm::vec3& value);
+
+	template <typename Function>
+	void fill(const Function& function) {
+		parallelFor(0, resolution().z, [&](size_t begin, size_t end) {
+			for (int k = static_cast<int>(begin); k < static_cast<int>(end); k++) {
+				for (int j = 0; j < resolution().y; j++) {
+					for (int i = 0; i < resolution().x; i++) {
+						set(i, j, k, function(dataPosition(i, j, k)));
+					}
+				}
+			}
+		}, 1);
+	}
+
+	glm::vec3 sample(const glm::vec3& x) const override;
+
+	void sample(Span<const glm::vec3> points, Span<glm::vec3> values) const override;
+
+	void sample(VectorChannelView<const float> points, VectorChannelView<float> values) const override;
+
+	glm::vec3 sampleCubic(const glm::vec3& x) const;
+
+	float divergence(int i, int j, int k) const;
+
+	glm::vec3 curl(int i, int j, int k) const;
+
+	glm::vec3 laplacian(int i, int j, int k) const;
+
+	/*
+	 * @brief divergence at every cell center, output is resized to match
+	 */
+	void divergence(ScalarGrid3& output) const;
+
+	void curl(VectorGrid3& output) const;
+
+private:
+	glm::vec3 _origin{0.0f};
+	GridArray3 _components[3];
+};
+
+/*
+ * @brief staggered (MAC) grid, each velocity component lives on the centers of the cell faces
+ * normal to it. Divergence per cell is exact, the usual layout for pressure projection
+ */
+class FaceCenteredGrid3 : public VectorField {
+public:
+	FaceCenteredGrid3() = default;
+
+	FaceCenteredGrid3(const glm::ivec3& resolution, const glm::vec3& gridSpacing = glm::vec3(1.0f),
+		const glm::vec3& origin = glm::vec3(0.0f), const glm::vec3& initialValue = glm::vec3(0.0f));
+
+	void resize(const glm::ivec3& resolution, const glm::vec3& gridSpacing, const glm::vec3& origin,
+		const glm::vec3& initialValue = glm::vec3(0.0f));
+
+	/*
+	 * @brief number of cells, the component arrays have one more face along their own axis
+	 */
+	const glm::ivec3& resolution() const { return _resolution; }
+
+	const glm::vec3& gridSpacing() const { return _components[0].gridSpacing(); }
+
+	const glm::vec3& origin() const { return _origin; }
+
+	GridArray3& u() { return _components[0]; }
+
+	GridArray3& v() { return _components[1]; }
+
+	GridArray3& w() { return _components[2]; }
+
+	GridArray3& component(int axis) { return _components[axis]; }
+
+	const GridArray3& component(int axis) const { return _components[axis]; }
+
+	void fill(const glm::vec3& value);
+
+	/*
+	 * @brief each face takes the component of function(face center) normal to it
+	 */
+	template <typename Function>
+	void fill(const Function& function) {
+		for (int axis = 0; axis < 3; axis++) {
+			_components[axis].fill([&](const glm::vec3& x) { return function(x)[axis]; });
+		}
+	}
+
+	glm::vec3 valueAtCellCenter(int i, int j, int k) const;
+
+	glm::vec3 sample(const glm::vec3& x) const override;
+
+	void sample(Span<const glm::vec3> points, Span<glm::vec3> values) const override;
+
+	void sample(VectorChannelView<const float> points, VectorChannelView<float> values) const override;
+
+	glm::vec3 sampleCubic(const glm::vec3& x) const;
+
+	float divergence(int i, int j, int k) const;
+
+	glm::vec3 curl(int i, int j, int k) const;
+
+	void divergence(ScalarGrid3& output) const;
+
+	void curl(VectorGrid3& output) const;
+
+private:
+	glm::ivec3 _resolution{0};
+	glm::vec3 _origin{0.0f};
+	GridArray3 _components[3];
+};
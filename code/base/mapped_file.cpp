@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& path): _path(path) {
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("open " + path + " failure");
+	}
+	_fileHandle = file;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		throw std::runtime_error("stat " + path + " failure");
+	}
+	_size = static_cast<size_t>(size.QuadPart);
+	if (_size == 0) {
+		return;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		throw std::runtime_error("map " + path + " failure");
+	}
+	_mappingHandle = mapping;
+
+	_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (_data == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		throw std::runtime_error("map " + path + " failure");
+	}
+}
+
+void MappedFile::prefetch(size_t, size_t) const {
+	// file mappings on windows are read ahead by the memory manager
+}
+
+void MappedFile::release(size_t, size_t) const {
+}
+
+MappedFile::~MappedFile() {
+	if (_data != nullptr) {
+		UnmapViewOfFile(_data);
+	}
+	if (_mappingHandle != nullptr) {
+		CloseHandle(_mappingHandle);
+	}
+	if (_fileHandle != nullptr) {
+		CloseHandle(_fileHandle);
+	}
+}
+#else
+MappedFile::MappedFile(const std::string& path): _path(path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("open " + path + " failure");
+	}
+
+	struct stat status;
+	if (fstat(fd, &status) != 0) {
+		close(fd);
+		throw std::runtime_error("stat " + path + " failure");
+	}
+	_size = static_cast<size_t>(status.st_size);
+	if (_size == 0) {
+		close(fd);
+		return;
+	}
+
+	void* address = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping keeps its own reference to the file
+	close(fd);
+	if (address == MAP_FAILED) {
+		throw std::runtime_error("map " + path + " failure");
+	}
+	_data = static_cast<const char*>(address);
+}
+
+static bool pageRange(const char* data, size_t size, size_t offset, size_t length, char*& begin, size_t& bytes) {
+	if (data == nullptr || offset >= size) {
+		return false;
+	}
+	length = std::min(length, size - offset);
+	size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t first = offset & ~(page - 1);
+	begin = const_cast<char*>(data) + first;
+	bytes = offset + length - first;
+	return bytes > 0;
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) const {
+	char* begin = nullptr;
+	size_t bytes = 0;
+	if (pageRange(_data, _size, offset, length, begin, bytes)) {
+		madvise(begin, bytes, MADV_WILLNEED);
+	}
+}
+
+void MappedFile::release(size_t offset, size_t length) const {
+	char* begin = nullptr;
+	size_t bytes = 0;
+	if (pageRange(_data, _size, offset, length, begin, bytes)) {
+		// the mapping is read-only, dropped pages are simply read from the file again
+		madvise(begin, bytes, MADV_DONTNEED);
+	}
+}
+
+MappedFile::~MappedFile() {
+	if (_data != nullptr) {
+		munmap(const_cast<char*>(_data), _size);
+		_data = nullptr;
+	}
+}
+#endif
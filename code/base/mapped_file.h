@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/*
+ * read-only memory mapping of a whole file, pages are loaded on first access
+ */
+class MappedFile {
+public:
+	MappedFile(const std::string& path);
+
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data() const { return _data; }
+
+	size_t size() const { return _size; }
+
+	const std::string& path() const { return _path; }
+
+	/*
+	 * @brief hint that a range will be read soon so the kernel starts reading it ahead
+	 */
+	void prefetch(size_t offset, size_t length) const;
+
+	/*
+	 * @brief hint that a range is no longer needed so its pages can be dropped
+	 */
+	void release(size_t offset, size_t length) const;
+
+private:
+	std::string _path;
+	const char* _data = nullptr;
+	size_t _size = 0;
+#ifdef _WIN32
+	void* _fileHandle = nullptr;
+	void* _mappingHandle = nullptr;
+#endif
+};
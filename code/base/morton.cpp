@@ -0,0 +1,49 @@
+#include <algorithm>
+#include <numeric>
+
+#include "morton.h"
+#include "radix_sort.h"
+#include "thread_pool.h"
+
+namespace {
+
+template <typename Points>
+std::vector<uint32_t> mortonOrderOf(const Points& points, size_t n) {
+	std::vector<uint32_t> order(n);
+	std::iota(order.begin(), order.end(), 0u);
+	if (n <= 1) {
+		return order;
+	}
+
+	glm::vec3 lower = points(0), upper = points(0);
+	for (size_t i = 1; i < n; ++i) {
+		glm::vec3 p = points(i);
+		lower = glm::min(lower, p);
+		upper = glm::max(upper, p);
+	}
+	glm::vec3 extent = glm::max(upper - lower, glm::vec3(1e-6f));
+	// cubic cells keep the curve isotropic for elongated domains
+	float scale = 1023.0f / std::max(extent.x, std::max(extent.y, extent.z));
+
+	std::vector<uint32_t> codes(n);
+	parallelFor(0, n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			glm::vec3 cell = (points(i) - lower) * scale;
+			codes[i] = mortonCode(static_cast<uint32_t>(cell.x), static_cast<uint32_t>(cell.y),
+				static_cast<uint32_t>(cell.z));
+		}
+	}, 1 << 14);
+
+	parallelRadixSort(codes, order);
+	return order;
+}
+
+}
+
+std::vector<uint32_t> mortonOrder(Span<const glm::vec3> points) {
+	return mortonOrderOf([&points](size_t i) { return points[i]; }, points.size());
+}
+
+std::vector<uint32_t> mortonOrder(VectorChannelView<const float> points) {
+	return mortonOrderOf([&points](size_t i) { return points.get(i); }, points.size);
+}
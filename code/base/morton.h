@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "particle_system_data.h"
+#include "span.h"
+
+/*
+ * @brief spread the lower 10 bits of v so there are two zero bits between each of them
+ */
+inline uint32_t expandBits(uint32_t v) {
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+/*
+ * @brief 30-bit Morton code of a cell with coordinates in [0, 1024)
+ */
+inline uint32_t mortonCode(uint32_t x, uint32_t y, uint32_t z) {
+	return (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+}
+
+/*
+ * @brief permutation that sorts points along a Morton curve over their bounding box,
+ * order[newIndex] is the old index of the point that moves there
+ */
+std::vector<uint32_t> mortonOrder(Span<const glm::vec3> points);
+
+std::vector<uint32_t> mortonOrder(VectorChannelView<const float> points);
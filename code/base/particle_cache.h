@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "aligned_memory.h"
+
+/*
+ * On-disk particle cache, native byte order:
+ *
+ *   block 0      ParticleCacheHeader followed by one ParticleCacheChannel per channel
+ *   frame chunk  ParticleCacheFrameHeader, then every channel's data, one chunk per frame,
+ *                each chunk starts on a block boundary and every channel on a 64-byte boundary
+ *   frame table  ParticleCacheFrameEntry per frame sorted by frame index, written on close
+ *
+ * Block alignment allows O_DIRECT writes and page aligned mappings for playback.
+ */
+static const char kParticleCacheMagic[8] = {'P', 'T', 'C', 'L', 'C', 'A', 'C', 'H'};
+static const char kParticleCacheFrameMagic[4] = {'F', 'R', 'A', 'M'};
+static const uint32_t kParticleCacheVersion = 1;
+static const uint32_t kParticleCacheBlockSize = 4096;
+static const uint32_t kParticleCacheChannelAlignment = 64;
+
+enum class ParticleChannelType : uint32_t {
+	Float32 = 0,
+	Int32 = 1,
+};
+
+struct ParticleChannelDescription {
+	std::string name;
+	ParticleChannelType type = ParticleChannelType::Float32;
+	uint32_t components = 1;
+
+	size_t elementSize() const { return 4 * components; }
+};
+
+struct ParticleCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t blockSize;
+	uint32_t channelCount;
+	uint32_t reserved;
+	uint64_t frameCount;
+	// 0 while the cache is being written
+	uint64_t frameTableOffset;
+	uint8_t padding[24];
+};
+
+struct ParticleCacheChannel {
+	char name[32];
+	uint32_t type;
+	uint32_t components;
+	uint64_t reserved;
+};
+
+struct ParticleCacheFrameHeader {
+	char magic[4];
+	int32_t frameIndex;
+	uint64_t particleCount;
+	uint64_t chunkSize;
+	uint8_t padding[40];
+};
+
+struct ParticleCacheFrameEntry {
+	int64_t frameIndex;
+	uint64_t offset;
+	uint64_t chunkSize;
+	uint64_t particleCount;
+};
+
+static_assert(sizeof(ParticleCacheHeader) == 64, "unexpected cache header size");
+static_assert(sizeof(ParticleCacheChannel) == 48, "unexpected cache channel size");
+static_assert(sizeof(ParticleCacheFrameHeader) == 64, "unexpected cache frame header size");
+
+static const size_t kParticleCacheMaxChannels =
+	(kParticleCacheBlockSize - sizeof(ParticleCacheHeader)) / sizeof(ParticleCacheChannel);
+
+/*
+ * @brief byte offsets of every channel inside a frame chunk, the last element is the unpadded chunk size
+ */
+inline std::vector<size_t> particleCacheChannelOffsets(
+	const std::vector<ParticleChannelDescription>& channels, size_t particleCount) {
+	std::vector<size_t> offsets;
+	offsets.reserve(channels.size() + 1);
+	size_t offset = sizeof(ParticleCacheFrameHeader);
+	for (const auto& channel : channels) {
+		offset = alignUp(offset, kParticleCacheChannelAlignment);
+		offsets.push_back(offset);
+		offset += particleCount * channel.elementSize();
+	}
+	offsets.push_back(offset);
+	return offsets;
+}
@@ -0,0 +1,139 @@
+#include <algorithm>
+
+#include "particle_cache_reader.h"
+
+ParticleCacheReader::ParticleCacheReader(const std::string& path) {
+	_file.reset(new MappedFile(path));
+
+	ParticleCacheHeader header;
+	if (_file->size() < kParticleCacheBlockSize) {
+		throw std::runtime_error(path + " is not a particle cache");
+	}
+	std::memcpy(&header, _file->data(), sizeof(header));
+	if (std::memcmp(header.magic, kParticleCacheMagic, sizeof(header.magic)) != 0) {
+		throw std::runtime_error(path + " is not a particle cache");
+	}
+	if (header.version != kParticleCacheVersion) {
+		throw std::runtime_error(path + ": unsupported particle cache version " + std::to_string(header.version));
+	}
+	if (header.blockSize != kParticleCacheBlockSize || header.channelCount == 0 ||
+		header.channelCount > kParticleCacheMaxChannels) {
+		throw std::runtime_error(path + ": corrupted particle cache header");
+	}
+
+	for (uint32_t i = 0; i < header.channelCount; ++i) {
+		ParticleCacheChannel channel;
+		std::memcpy(&channel, _file->data() + sizeof(header) + i * sizeof(channel), sizeof(channel));
+		channel.name[sizeof(channel.name) - 1] = '\0';
+		ParticleChannelDescription description;
+		description.name = channel.name;
+		description.type = static_cast<ParticleChannelType>(channel.type);
+		description.components = channel.components;
+		_channels.push_back(description);
+	}
+
+	if (header.frameTableOffset != 0) {
+		uint64_t tableBytes = header.frameCount * sizeof(ParticleCacheFrameEntry);
+		if (header.frameTableOffset > _file->size() || tableBytes > _file->size() - header.frameTableOffset) {
+			throw std::runtime_error(path + ": corrupted particle cache frame table");
+		}
+		_frames.resize(static_cast<size_t>(header.frameCount));
+		if (!_frames.empty()) {
+			std::memcpy(_frames.data(), _file->data() + header.frameTableOffset, static_cast<size_t>(tableBytes));
+		}
+	} else {
+		// the writer did not get to close the file, recover the frames from the chunk headers
+		scanFrames();
+	}
+
+	for (const auto& frame : _frames) {
+		std::vector<size_t> offsets = particleCacheChannelOffsets(_channels, static_cast<size_t>(frame.particleCount));
+		if (frame.offset > _file->size() || offsets.back() > frame.chunkSize ||
+			frame.chunkSize > _file->size() - frame.offset) {
+			throw std::runtime_error(path + ": corrupted particle cache frame " + std::to_string(frame.frameIndex));
+		}
+	}
+
+	_contiguous = true;
+	for (size_t i = 1; i < _frames.size(); ++i) {
+		if (_frames[i].frameIndex != _frames[i - 1].frameIndex + 1) {
+			_contiguous = false;
+			break;
+		}
+	}
+}
+
+void ParticleCacheReader::scanFrames() {
+	uint64_t offset = kParticleCacheBlockSize;
+	while (offset + sizeof(ParticleCacheFrameHeader) <= _file->size()) {
+		ParticleCacheFrameHeader header;
+		std::memcpy(&header, _file->data() + offset, sizeof(header));
+		if (std::memcmp(header.magic, kParticleCacheFrameMagic, sizeof(header.magic)) != 0 ||
+			header.chunkSize == 0 || header.chunkSize > _file->size() - offset) {
+			break;
+		}
+		ParticleCacheFrameEntry entry;
+		entry.frameIndex = header.frameIndex;
+		entry.offset = offset;
+		entry.chunkSize = header.chunkSize;
+		entry.particleCount = header.particleCount;
+		_frames.push_back(entry);
+		offset += header.chunkSize;
+	}
+	std::stable_sort(_frames.begin(), _frames.end(),
+		[](const ParticleCacheFrameEntry& a, const ParticleCacheFrameEntry& b) {
+			return a.frameIndex < b.frameIndex;
+		});
+}
+
+int ParticleCacheReader::firstFrameIndex() const {
+	return _frames.empty() ? 0 : static_cast<int>(_frames.front().frameIndex);
+}
+
+int ParticleCacheReader::lastFrameIndex() const {
+	return _frames.empty() ? -1 : static_cast<int>(_frames.back().frameIndex);
+}
+
+int ParticleCacheReader::findFrame(int frameIndex) const {
+	if (_frames.empty() || frameIndex < _frames.front().frameIndex || frameIndex > _frames.back().frameIndex) {
+		return -1;
+	}
+	if (_contiguous) {
+		return static_cast<int>(frameIndex - _frames.front().frameIndex);
+	}
+	auto it = std::lower_bound(_frames.begin(), _frames.end(), frameIndex,
+		[](const ParticleCacheFrameEntry& entry, int index) { return entry.frameIndex < index; });
+	if (it == _frames.end() || it->frameIndex != frameIndex) {
+		return -1;
+	}
+	return static_cast<int>(it - _frames.begin());
+}
+
+int ParticleCacheReader::findChannel(const std::string& name) const {
+	for (size_t i = 0; i < _channels.size(); ++i) {
+		if (_channels[i].name == name) {
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
+
+const char* ParticleCacheReader::channelData(size_t slot, size_t channelIndex) const {
+	// same layout as particleCacheChannelOffsets, without allocating on the playback path
+	const ParticleCacheFrameEntry& frame = _frames[slot];
+	size_t offset = sizeof(ParticleCacheFrameHeader);
+	for (size_t i = 0; i < channelIndex; ++i) {
+		offset = alignUp(offset, kParticleCacheChannelAlignment);
+		offset += static_cast<size_t>(frame.particleCount) * _channels[i].elementSize();
+	}
+	offset = alignUp(offset, kParticleCacheChannelAlignment);
+	return _file->data() + frame.offset + offset;
+}
+
+void ParticleCacheReader::prefetch(size_t slot) const {
+	_file->prefetch(static_cast<size_t>(_frames[slot].offset), static_cast<size_t>(_frames[slot].chunkSize));
+}
+
+void ParticleCacheReader::release(size_t slot) const {
+	_file->release(static_cast<size_t>(_frames[slot].offset), static_cast<size_t>(_frames[slot].chunkSize));
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "particle_cache.h"
+#include "span.h"
+
+/*
+ * Random access to a particle cache written by ParticleCacheWriter. The file
+ * is memory mapped, frame data is handed out as spans into the mapping.
+ */
+class ParticleCacheReader {
+public:
+	ParticleCacheReader(const std::string& path);
+
+	size_t numberOfFrames() const { return _frames.size(); }
+
+	int firstFrameIndex() const;
+
+	int lastFrameIndex() const;
+
+	/*
+	 * @brief position of frameIndex in the frame table, -1 if it was not cached
+	 */
+	int findFrame(int frameIndex) const;
+
+	int frameIndex(size_t slot) const { return static_cast<int>(_frames[slot].frameIndex); }
+
+	size_t particleCount(size_t slot) const { return static_cast<size_t>(_frames[slot].particleCount); }
+
+	const std::vector<ParticleChannelDescription>& channels() const { return _channels; }
+
+	/*
+	 * @brief index of the channel called name, -1 if there is none
+	 */
+	int findChannel(const std::string& name) const;
+
+	/*
+	 * @brief zero-copy view of one channel of a cached frame, T must match the channel element size
+	 */
+	template <typename T>
+	Span<const T> channel(size_t slot, size_t channelIndex) const {
+		if (sizeof(T) != _channels[channelIndex].elementSize()) {
+			throw std::invalid_argument("element type does not match channel " + _channels[channelIndex].name);
+		}
+		const char* data = channelData(slot, channelIndex);
+		return Span<const T>(reinterpret_cast<const T*>(data), particleCount(slot));
+	}
+
+	/*
+	 * @brief ask the kernel to start reading a frame ahead of its use
+	 */
+	void prefetch(size_t slot) const;
+
+	/*
+	 * @brief let the kernel drop the pages of a frame that is no longer shown
+	 */
+	void release(size_t slot) const;
+
+private:
+	std::unique_ptr<MappedFile> _file;
+	std::vector<ParticleChannelDescription> _channels;
+	std::vector<ParticleCacheFrameEntry> _frames;
+	// the frame table covers consecutive frame indices, so lookups are a subtraction
+	bool _contiguous = false;
+
+	const char* channelData(size_t slot, size_t channelIndex) const;
+
+	void scanFrames();
+};
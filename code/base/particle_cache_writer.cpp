@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "particle_cache_writer.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+int openForWriting(const std::string& path, bool direct) {
+#ifdef _WIN32
+	(void)direct;
+	return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+	if (direct) {
+		flags |= O_DIRECT;
+	}
+#else
+	if (direct) {
+		return -1;
+	}
+#endif
+	return ::open(path.c_str(), flags, 0644);
+#endif
+}
+
+bool writeAt(int fd, const char* data, size_t size, uint64_t offset) {
+#ifdef _WIN32
+	if (_lseeki64(fd, static_cast<__int64>(offset), SEEK_SET) < 0) {
+		return false;
+	}
+	while (size > 0) {
+		int n = _write(fd, data, static_cast<unsigned int>(std::min<size_t>(size, 1u << 30)));
+		if (n <= 0) {
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+#else
+	while (size > 0) {
+		ssize_t n = pwrite(fd, data, size, static_cast<off_t>(offset));
+		if (n <= 0) {
+			return false;
+		}
+		data += n;
+		size -= n;
+		offset += n;
+	}
+	return true;
+#endif
+}
+
+void closeFile(int fd) {
+#ifdef _WIN32
+	_close(fd);
+#else
+	::close(fd);
+#endif
+}
+
+}
+
+ParticleCacheWriter::ParticleCacheWriter(const std::string& path,
+	const std::vector<ParticleChannelDescription>& channels)
+	: ParticleCacheWriter(path, channels, Options()) {
+}
+
+ParticleCacheWriter::ParticleCacheWriter(const std::string& path,
+	const std::vector<ParticleChannelDescription>& channels, const Options& options)
+	: _path(path), _channels(channels), _options(options) {
+	if (_channels.empty() || _channels.size() > kParticleCacheMaxChannels) {
+		throw std::invalid_argument("particle cache needs 1 to " +
+			std::to_string(kParticleCacheMaxChannels) + " channels");
+	}
+	for (const auto& channel : _channels) {
+		if (channel.name.size() >= sizeof(ParticleCacheChannel::name) || channel.components == 0) {
+			throw std::invalid_argument("invalid particle cache channel " + channel.name);
+		}
+	}
+	_options.queueCapacity = std::max<size_t>(1, _options.queueCapacity);
+
+	open();
+
+	_buffers.resize(_options.queueCapacity);
+	for (size_t i = 0; i < _buffers.size(); ++i) {
+		_freeBuffers.push_back(i);
+	}
+	_thread = std::thread(&ParticleCacheWriter::writeLoop, this);
+}
+
+ParticleCacheWriter::~ParticleCacheWriter() {
+	try {
+		close();
+	} catch (...) {
+		// destructors must not throw, call close() to observe errors
+	}
+	for (auto& buffer : _buffers) {
+		if (buffer.data != nullptr) {
+			alignedFree(buffer.data);
+		}
+	}
+}
+
+void ParticleCacheWriter::open() {
+	_fd = -1;
+	if (_options.directIO) {
+		_fd = openForWriting(_path, true);
+	}
+	// O_DIRECT is not available on every file system, fall back to buffered writes
+	_statistics.directIO = _fd >= 0;
+	if (_fd < 0) {
+		_fd = openForWriting(_path, false);
+	}
+	if (_fd < 0) {
+		throw std::runtime_error("open " + _path + " failure");
+	}
+	writeHeader(0, 0);
+	_fileOffset = kParticleCacheBlockSize;
+}
+
+void ParticleCacheWriter::writeHeader(uint64_t frameCount, uint64_t frameTableOffset) {
+	char* block = static_cast<char*>(alignedAlloc(kParticleCacheBlockSize, kParticleCacheBlockSize));
+	std::memset(block, 0, kParticleCacheBlockSize);
+
+	ParticleCacheHeader header = {};
+	std::memcpy(header.magic, kParticleCacheMagic, sizeof(header.magic));
+	header.version = kParticleCacheVersion;
+	header.blockSize = kParticleCacheBlockSize;
+	header.channelCount = static_cast<uint32_t>(_channels.size());
+	header.frameCount = frameCount;
+	header.frameTableOffset = frameTableOffset;
+	std::memcpy(block, &header, sizeof(header));
+
+	for (size_t i = 0; i < _channels.size(); ++i) {
+		ParticleCacheChannel channel = {};
+		std::memcpy(channel.name, _channels[i].name.c_str(), _channels[i].name.size());
+		channel.type = static_cast<uint32_t>(_channels[i].type);
+		channel.components = _channels[i].components;
+		std::memcpy(block + sizeof(header) + i * sizeof(channel), &channel, sizeof(channel));
+	}
+
+	bool ok = writeAt(_fd, block, kParticleCacheBlockSize, 0);
+	alignedFree(block);
+	if (!ok) {
+		throw std::runtime_error("write " + _path + " failure");
+	}
+}
+
+void ParticleCacheWriter::writeBlock(const char* data, size_t size) {
+	if (!writeAt(_fd, data, size, _fileOffset)) {
+		throw std::runtime_error("write " + _path + " failure");
+	}
+	_fileOffset += size;
+}
+
+bool ParticleCacheWriter::writeFrame(int frameIndex, size_t particleCount,
+	const std::vector<const void*>& channels) {
+	if (channels.size() != _channels.size()) {
+		throw std::invalid_argument("expected " + std::to_string(_channels.size()) + " channels");
+	}
+
+	size_t index = 0;
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		if (_closing) {
+			throw std::logic_error("particle cache " + _path + " is closed");
+		}
+		if (_error) {
+			std::rethrow_exception(_error);
+		}
+		if (_freeBuffers.empty() && _options.dropWhenFull) {
+			_statistics.framesDropped++;
+			return false;
+		}
+		_bufferFreed.wait(lock, [this] { return !_freeBuffers.empty(); });
+		index = _freeBuffers.front();
+		_freeBuffers.pop_front();
+	}
+
+	// the copy happens outside the lock, the buffer belongs to this thread now
+	Buffer& buffer = _buffers[index];
+	std::vector<size_t> offsets = particleCacheChannelOffsets(_channels, particleCount);
+	size_t chunkSize = alignUp(offsets.back(), kParticleCacheBlockSize);
+	if (buffer.capacity < chunkSize) {
+		if (buffer.data != nullptr) {
+			alignedFree(buffer.data);
+		}
+		buffer.data = static_cast<char*>(alignedAlloc(chunkSize, kParticleCacheBlockSize));
+		buffer.capacity = chunkSize;
+	}
+	buffer.size = chunkSize;
+
+	ParticleCacheFrameHeader header = {};
+	std::memcpy(header.magic, kParticleCacheFrameMagic, sizeof(header.magic));
+	header.frameIndex = frameIndex;
+	header.particleCount = particleCount;
+	header.chunkSize = chunkSize;
+	std::memset(buffer.data, 0, offsets[0]);
+	std::memcpy(buffer.data, &header, sizeof(header));
+	for (size_t i = 0; i < _channels.size(); ++i) {
+		size_t bytes = particleCount * _channels[i].elementSize();
+		if (bytes > 0) {
+			std::memcpy(buffer.data + offsets[i], channels[i], bytes);
+		}
+		size_t end = i + 1 < _channels.size() ? offsets[i + 1] : chunkSize;
+		std::memset(buffer.data + offsets[i] + bytes, 0, end - offsets[i] - bytes);
+	}
+	buffer.entry.frameIndex = frameIndex;
+	buffer.entry.chunkSize = chunkSize;
+	buffer.entry.particleCount = particleCount;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_pendingBuffers.push_back(index);
+		_statistics.maxQueueLength = std::max(_statistics.maxQueueLength, _pendingBuffers.size());
+	}
+	_bufferQueued.notify_one();
+	return true;
+}
+
+void ParticleCacheWriter::writeLoop() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true) {
+		_bufferQueued.wait(lock, [this] { return _closing || !_pendingBuffers.empty(); });
+		if (_pendingBuffers.empty()) {
+			return;
+		}
+		size_t index = _pendingBuffers.front();
+		_pendingBuffers.pop_front();
+		lock.unlock();
+
+		Buffer& buffer = _buffers[index];
+		std::exception_ptr error;
+		try {
+			buffer.entry.offset = _fileOffset;
+			writeBlock(buffer.data, buffer.size);
+		} catch (...) {
+			error = std::current_exception();
+		}
+
+		lock.lock();
+		if (error) {
+			if (!_error) {
+				_error = error;
+			}
+		} else {
+			_frameTable.push_back(buffer.entry);
+			_statistics.framesWritten++;
+			_statistics.bytesWritten += buffer.size;
+		}
+		_freeBuffers.push_back(index);
+		_bufferFreed.notify_one();
+	}
+}
+
+void ParticleCacheWriter::close() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_closed) {
+			return;
+		}
+		_closing = true;
+		_closed = true;
+	}
+	_bufferQueued.notify_all();
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+
+	std::exception_ptr error = _error;
+	if (!error) {
+		try {
+			std::stable_sort(_frameTable.begin(), _frameTable.end(),
+				[](const ParticleCacheFrameEntry& a, const ParticleCacheFrameEntry& b) {
+					return a.frameIndex < b.frameIndex;
+				});
+
+			size_t tableSize = alignUp(_frameTable.size() * sizeof(ParticleCacheFrameEntry), kParticleCacheBlockSize);
+			char* table = static_cast<char*>(alignedAlloc(tableSize, kParticleCacheBlockSize));
+			std::memset(table, 0, tableSize);
+			if (!_frameTable.empty()) {
+				std::memcpy(table, _frameTable.data(), _frameTable.size() * sizeof(ParticleCacheFrameEntry));
+			}
+			uint64_t tableOffset = _fileOffset;
+			try {
+				writeBlock(table, tableSize);
+			} catch (...) {
+				alignedFree(table);
+				throw;
+			}
+			alignedFree(table);
+			writeHeader(_frameTable.size(), tableOffset);
+		} catch (...) {
+			error = std::current_exception();
+		}
+	}
+	closeFile(_fd);
+	_fd = -1;
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+ParticleCacheWriter::Statistics ParticleCacheWriter::statistics() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _statistics;
+}
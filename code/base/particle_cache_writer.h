@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "particle_cache.h"
+
+/*
+ * Streams frames into a particle cache file. writeFrame copies the particle
+ * data into one of a bounded set of buffers, a background thread writes them
+ * out in order and the frame table is appended on close.
+ */
+class ParticleCacheWriter {
+public:
+	struct Options {
+		// number of frames that may wait for the disk
+		size_t queueCapacity = 8;
+		// bypass the page cache with O_DIRECT where supported
+		bool directIO = false;
+		// drop frames instead of blocking when the queue is full
+		bool dropWhenFull = false;
+	};
+
+	struct Statistics {
+		uint64_t framesWritten = 0;
+		uint64_t framesDropped = 0;
+		uint64_t bytesWritten = 0;
+		size_t maxQueueLength = 0;
+		bool directIO = false;
+	};
+
+	ParticleCacheWriter(const std::string& path,
+		const std::vector<ParticleChannelDescription>& channels);
+
+	ParticleCacheWriter(const std::string& path,
+		const std::vector<ParticleChannelDescription>& channels, const Options& options);
+
+	~ParticleCacheWriter();
+
+	ParticleCacheWriter(const ParticleCacheWriter&) = delete;
+
+	ParticleCacheWriter& operator=(const ParticleCacheWriter&) = delete;
+
+	/*
+	 * @brief queue one frame, channels[i] points to particleCount elements of channel i
+	 * @return false if the frame was dropped because the queue was full
+	 */
+	bool writeFrame(int frameIndex, size_t particleCount, const std::vector<const void*>& channels);
+
+	/*
+	 * @brief flush every queued frame, write the frame table and close the file
+	 */
+	void close();
+
+	Statistics statistics();
+
+	const std::vector<ParticleChannelDescription>& channels() const { return _channels; }
+
+private:
+	struct Buffer {
+		char* data = nullptr;
+		size_t capacity = 0;
+		size_t size = 0;
+		ParticleCacheFrameEntry entry = {};
+	};
+
+	std::string _path;
+	std::vector<ParticleChannelDescription> _channels;
+	Options _options;
+	int _fd = -1;
+	uint64_t _fileOffset = 0;
+	std::vector<ParticleCacheFrameEntry> _frameTable;
+
+	std::vector<Buffer> _buffers;
+	std::deque<size_t> _freeBuffers;
+	std::deque<size_t> _pendingBuffers;
+	std::mutex _mutex;
+	std::condition_variable _bufferFreed;
+	std::condition_variable _bufferQueued;
+	bool _closing = false;
+	bool _closed = false;
+	std::exception_ptr _error;
+	Statistics _statistics;
+	std::thread _thread;
+
+	void open();
+
+	void writeHeader(uint64_t frameCount, uint64_t frameTableOffset);
+
+	void writeBlock(const char* data, size_t size);
+
+	void writeLoop();
+};
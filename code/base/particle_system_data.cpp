@@ -0,0 +1,136 @@
+#include <stdexcept>
+
+#include "particle_system_data.h"
+#include "thread_pool.h"
+
+ParticleSystemData::ParticleSystemData(size_t numberOfParticles) {
+	addVectorChannel("position");
+	addVectorChannel("velocity");
+	addVectorChannel("force");
+	resize(numberOfParticles);
+}
+
+void ParticleSystemData::resize(size_t numberOfParticles) {
+	for (auto& channel : _scalarChannels) {
+		channel.data.resize(numberOfParticles, channel.initialValue);
+	}
+	for (auto& channel : _vectorChannels) {
+		for (int c = 0; c < 3; ++c) {
+			channel.data[c].resize(numberOfParticles, channel.initialValue[c]);
+		}
+	}
+	_numberOfParticles = numberOfParticles;
+}
+
+size_t ParticleSystemData::addParticles(size_t count) {
+	size_t first = _numberOfParticles;
+	resize(_numberOfParticles + count);
+	return first;
+}
+
+size_t ParticleSystemData::addScalarChannel(const std::string& name, float initialValue) {
+	int existing = findScalarChannel(name);
+	if (existing >= 0) {
+		return static_cast<size_t>(existing);
+	}
+	ScalarChannel channel;
+	channel.name = name;
+	channel.initialValue = initialValue;
+	channel.data.resize(_numberOfParticles, initialValue);
+	_scalarChannels.push_back(std::move(channel));
+	return _scalarChannels.size() - 1;
+}
+
+size_t ParticleSystemData::addVectorChannel(const std::string& name, const glm::vec3& initialValue) {
+	int existing = findVectorChannel(name);
+	if (existing >= 0) {
+		return static_cast<size_t>(existing);
+	}
+	VectorChannel channel;
+	channel.name = name;
+	channel.initialValue = initialValue;
+	for (int c = 0; c < 3; ++c) {
+		channel.data[c].resize(_numberOfParticles, initialValue[c]);
+	}
+	_vectorChannels.push_back(std::move(channel));
+	return _vectorChannels.size() - 1;
+}
+
+int ParticleSystemData::findScalarChannel(const std::string& name) const {
+	for (size_t i = 0; i < _scalarChannels.size(); ++i) {
+		if (_scalarChannels[i].name == name) {
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
+
+int ParticleSystemData::findVectorChannel(const std::string& name) const {
+	for (size_t i = 0; i < _vectorChannels.size(); ++i) {
+		if (_vectorChannels[i].name == name) {
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
+
+Span<float> ParticleSystemData::scalarChannel(size_t index) {
+	return Span<float>(_scalarChannels[index].data.data(), _numberOfParticles);
+}
+
+Span<const float> ParticleSystemData::scalarChannel(size_t index) const {
+	return Span<const float>(_scalarChannels[index].data.data(), _numberOfParticles);
+}
+
+VectorChannelView<float> ParticleSystemData::vectorChannel(size_t index) {
+	auto& data = _vectorChannels[index].data;
+	return VectorChannelView<float>{data[0].data(), data[1].data(), data[2].data(), _numberOfParticles};
+}
+
+VectorChannelView<const float> ParticleSystemData::vectorChannel(size_t index) const {
+	const auto& data = _vectorChannels[index].data;
+	return VectorChannelView<const float>{data[0].data(), data[1].data(), data[2].data(), _numberOfParticles};
+}
+
+void ParticleSystemData::copyVectorChannelTo(size_t index, glm::vec3* output) const {
+	VectorChannelView<const float> view = vectorChannel(index);
+	parallelFor(0, view.size, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			output[i] = glm::vec3(view.x[i], view.y[i], view.z[i]);
+		}
+	}, 1 << 14);
+}
+
+void ParticleSystemData::copyVectorChannelFrom(size_t index, const glm::vec3* input) {
+	VectorChannelView<float> view = vectorChannel(index);
+	parallelFor(0, view.size, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			view.x[i] = input[i].x;
+			view.y[i] = input[i].y;
+			view.z[i] = input[i].z;
+		}
+	}, 1 << 14);
+}
+
+void ParticleSystemData::permute(const std::vector<uint32_t>& order) {
+	if (order.size() != _numberOfParticles) {
+		throw std::invalid_argument("permutation does not match the number of particles");
+	}
+	AlignedArray<float> scratch(_numberOfParticles);
+	auto gather = [&](AlignedArray<float>& data) {
+		parallelFor(0, _numberOfParticles, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				scratch[i] = data[order[i]];
+			}
+		}, 1 << 14);
+		data.swap(scratch);
+	};
+	for (auto& channel : _scalarChannels) {
+		gather(channel.data);
+	}
+	for (auto& channel : _vectorChannels) {
+		for (auto& component : channel.data) {
+			gather(component);
+		}
+	}
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "aligned_memory.h"
+#include "span.h"
+
+/*
+ * @brief structure-of-arrays view of a vector channel, x, y and z live in separate arrays
+ */
+template <typename T>
+struct VectorChannelView {
+	T* x = nullptr;
+	T* y = nullptr;
+	T* z = nullptr;
+	size_t size = 0;
+
+	glm::vec3 get(size_t i) const { return glm::vec3(x[i], y[i], z[i]); }
+
+	void set(size_t i, const glm::vec3& v) const {
+		x[i] = v.x;
+		y[i] = v.y;
+		z[i] = v.z;
+	}
+
+	VectorChannelView subview(size_t offset, size_t count) const {
+		return VectorChannelView{x + offset, y + offset, z + offset, count};
+	}
+
+	operator VectorChannelView<const T>() const { return VectorChannelView<const T>{x, y, z, size}; }
+};
+
+/*
+ * Particle attributes shared by the solvers, stored as 64-byte aligned float
+ * arrays so per-particle loops vectorize. Positions, velocities and forces
+ * always exist, solvers add their own named scalar and vector channels.
+ */
+class ParticleSystemData {
+public:
+	static const size_t kPositionChannel = 0;
+	static const size_t kVelocityChannel = 1;
+	static const size_t kForceChannel = 2;
+
+	explicit ParticleSystemData(size_t numberOfParticles = 0);
+
+	size_t numberOfParticles() const { return _numberOfParticles; }
+
+	/*
+	 * @brief resize every channel, new particles get each channel's initial value
+	 */
+	void resize(size_t numberOfParticles);
+
+	/*
+	 * @brief append count particles and return the index of the first one
+	 */
+	size_t addParticles(size_t count);
+
+	/*
+	 * @brief add a scalar channel or return the existing one with that name
+	 */
+	size_t addScalarChannel(const std::string& name, float initialValue = 0.0f);
+
+	/*
+	 * @brief add a vector channel or return the existing one with that name
+	 */
+	size_t addVectorChannel(const std::string& name, const glm::vec3& initialValue = glm::vec3(0.0f));
+
+	/*
+	 * @brief index of the channel called name, -1 if there is none
+	 */
+	int findScalarChannel(const std::string& name) const;
+
+	int findVectorChannel(const std::string& name) const;
+
+	size_t numberOfScalarChannels() const { return _scalarChannels.size(); }
+
+	size_t numberOfVectorChannels() const { return _vectorChannels.size(); }
+
+	const std::string& scalarChannelName(size_t index) const { return _scalarChannels[index].name; }
+
+	const std::string& vectorChannelName(size_t index) const { return _vectorChannels[index].name; }
+
+	Span<float> scalarChannel(size_t index);
+
+	Span<const float> scalarChannel(size_t index) const;
+
+	VectorChannelView<float> vectorChannel(size_t index);
+
+	VectorChannelView<const float> vectorChannel(size_t index) const;
+
+	VectorChannelView<float> positions() { return vectorChannel(kPositionChannel); }
+
+	VectorChannelView<const float> positions() const { return vectorChannel(kPositionChannel); }
+
+	VectorChannelView<float> velocities() { return vectorChannel(kVelocityChannel); }
+
+	VectorChannelView<const float> velocities() const { return vectorChannel(kVelocityChannel); }
+
+	VectorChannelView<float> forces() { return vectorChannel(kForceChannel); }
+
+	VectorChannelView<const float> forces() const { return vectorChannel(kForceChannel); }
+
+	/*
+	 * @brief interleave a vector channel, e.g. for uploading to a vertex buffer
+	 */
+	void copyVectorChannelTo(size_t index, glm::vec3* output) const;
+
+	void copyVectorChannelFrom(size_t index, const glm::vec3* input);
+
+	/*
+	 * @brief reorder every channel, order[newIndex] is the old index of the particle moving there
+	 */
+	void permute(const std::vector<uint32_t>& order);
+
+private:
+	struct ScalarChannel {
+		std::string name;
+		float initialValue;
+		AlignedArray<float> data;
+	};
+
+	struct VectorChannel {
+		std::string name;
+		glm::vec3 initialValue;
+		std::array<AlignedArray<float>, 3> data;
+	};
+
+	size_t _numberOfParticles = 0;
+	std::vector<ScalarChannel> _scalarChannels;
+	std::vector<VectorChannel> _vectorChannels;
+};
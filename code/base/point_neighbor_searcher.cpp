@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+#include "point_neighbor_searcher.h"
+#include "thread_pool.h"
+
+PointNeighborSearcher::PointNeighborSearcher(float gridSpacing) {
+	setGridSpacing(gridSpacing);
+}
+
+void PointNeighborSearcher::setGridSpacing(float gridSpacing) {
+	if (!(gridSpacing > 0.0f)) {
+		throw std::invalid_argument("grid spacing must be positive");
+	}
+	_gridSpacing = gridSpacing;
+	_inverseGridSpacing = 1.0f / gridSpacing;
+}
+
+void PointNeighborSearcher::build(Span<const glm::vec3> points) {
+	_points.resize(points.size());
+	parallelFor(0, points.size(), [&](size_t begin, size_t end) {
+		std::copy(points.begin() + begin, points.begin() + end, _points.begin() + begin);
+	}, 1 << 14);
+	buildFromPoints();
+}
+
+void PointNeighborSearcher::build(VectorChannelView<const float> points) {
+	_points.resize(points.size);
+	parallelFor(0, points.size, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			_points[i] = points.get(i);
+		}
+	}, 1 << 14);
+	buildFromPoints();
+}
+
+void PointNeighborSearcher::buildFromPoints() {
+	const size_t n = _points.size();
+	if (n >= UINT32_MAX) {
+		throw std::length_error("too many points for the neighbor searcher");
+	}
+
+	// about two buckets per point keeps collisions between occupied cells rare
+	size_t numberOfBuckets = 1;
+	while (numberOfBuckets < 2 * n) {
+		numberOfBuckets <<= 1;
+	}
+	_bucketMask = static_cast<uint32_t>(numberOfBuckets - 1);
+
+	// counting sort: histogram, exclusive scan, scatter
+	std::unique_ptr<std::atomic<uint32_t>[]> counts(new std::atomic<uint32_t>[numberOfBuckets]);
+	parallelFor(0, numberOfBuckets, [&](size_t begin, size_t end) {
+		for (size_t b = begin; b < end; ++b) {
+			counts[b].store(0, std::memory_order_relaxed);
+		}
+	}, 1 << 16);
+
+	_bucketOfPoint.resize(n);
+	parallelFor(0, n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			uint32_t bucket = bucketOf(cellOf(_points[i]));
+			_bucketOfPoint[i] = bucket;
+			counts[bucket].fetch_add(1, std::memory_order_relaxed);
+		}
+	}, 1 << 14);
+
+	_bucketStart.resize(numberOfBuckets + 1);
+	uint32_t sum = 0;
+	for (size_t b = 0; b < numberOfBuckets; ++b) {
+		_bucketStart[b] = sum;
+		uint32_t count = counts[b].load(std::memory_order_relaxed);
+		// reuse the counter as the scatter cursor
+		counts[b].store(sum, std::memory_order_relaxed);
+		sum += count;
+	}
+	_bucketStart[numberOfBuckets] = sum;
+
+	_sortedIndices.resize(n);
+	parallelFor(0, n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			uint32_t slot = counts[_bucketOfPoint[i]].fetch_add(1, std::memory_order_relaxed);
+			_sortedIndices[slot] = static_cast<uint32_t>(i);
+		}
+	}, 1 << 14);
+
+	// the parallel scatter leaves buckets in arbitrary order, sort them so results are reproducible
+	_sortedPoints.resize(n);
+	parallelFor(0, numberOfBuckets, [&](size_t begin, size_t end) {
+		for (size_t b = begin; b < end; ++b) {
+			uint32_t first = _bucketStart[b], last = _bucketStart[b + 1];
+			if (last - first > 1) {
+				std::sort(_sortedIndices.begin() + first, _sortedIndices.begin() + last);
+			}
+			for (uint32_t j = first; j < last; ++j) {
+				_sortedPoints[j] = _points[_sortedIndices[j]];
+			}
+		}
+	}, 1 << 14);
+}
+
+bool PointNeighborSearcher::hasNearbyPoint(const glm::vec3& origin, float radius) const {
+	bool found = false;
+	forEachNearbyPoint(origin, radius, [&found](size_t, const glm::vec3&) { found = true; });
+	return found;
+}
+
+void PointNeighborSearcher::buildNeighborLists(float radius, NeighborLists& lists, bool includeSelf) const {
+	const size_t n = _points.size();
+	lists.offsets.assign(n + 1, 0);
+
+	// count, scan, then fill, both passes run the same query so the lists come out in order
+	parallelFor(0, n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			uint32_t count = 0;
+			forEachNearbyPoint(_points[i], radius, [&](size_t j, const glm::vec3&) {
+				if (includeSelf || j != i) {
+					count++;
+				}
+			});
+			lists.offsets[i + 1] = count;
+		}
+	}, 1024);
+
+	for (size_t i = 0; i < n; ++i) {
+		lists.offsets[i + 1] += lists.offsets[i];
+	}
+	lists.indices.resize(lists.offsets[n]);
+
+	parallelFor(0, n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			uint32_t cursor = lists.offsets[i];
+			forEachNearbyPoint(_points[i], radius, [&](size_t j, const glm::vec3&) {
+				if (includeSelf || j != i) {
+					lists.indices[cursor++] = static_cast<uint32_t>(j);
+				}
+			});
+		}
+	}, 1024);
+}
+
+VerletNeighborLists::VerletNeighborLists(float searchRadius, float skin)
+	: _searchRadius(searchRadius), _skin(skin), _searcher(searchRadius + skin) {
+	setRadius(searchRadius, skin);
+}
+
+void VerletNeighborLists::setRadius(float searchRadius, float skin) {
+	if (!(searchRadius > 0.0f) || !(skin >= 0.0f)) {
+		throw std::invalid_argument("invalid neighbor list radius");
+	}
+	_searchRadius = searchRadius;
+	_skin = skin;
+	_searcher.setGridSpacing(searchRadius + skin);
+	_valid = false;
+}
+
+template <typename Points>
+bool VerletNeighborLists::updateFrom(const Points& points, size_t n) {
+	_numberOfUpdates++;
+
+	bool rebuild = !_valid || n != _referencePositions.size();
+	if (!rebuild) {
+		// any point beyond half the skin could close the gap to another one moving the other way
+		const float limit = 0.25f * _skin * _skin;
+		std::atomic<bool> exceeded(false);
+		parallelFor(0, n, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end && !exceeded.load(std::memory_order_relaxed); ++i) {
+				glm::vec3 d = points(i) - _referencePositions[i];
+				if (glm::dot(d, d) > limit) {
+					exceeded.store(true, std::memory_order_relaxed);
+				}
+			}
+		}, 1 << 14);
+		rebuild = exceeded.load();
+	}
+	if (!rebuild) {
+		return false;
+	}
+
+	_referencePositions.resize(n);
+	parallelFor(0, n, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			_referencePositions[i] = points(i);
+		}
+	}, 1 << 14);
+	_searcher.build(Span<const glm::vec3>(_referencePositions));
+	_searcher.buildNeighborLists(_searchRadius + _skin, _lists);
+	_valid = true;
+	_numberOfRebuilds++;
+	return true;
+}
+
+bool VerletNeighborLists::update(Span<const glm::vec3> points) {
+	return updateFrom([&points](size_t i) { return points[i]; }, points.size());
+}
+
+bool VerletNeighborLists::update(VectorChannelView<const float> points) {
+	return updateFrom([&points](size_t i) { return points.get(i); }, points.size);
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "particle_system_data.h"
+#include "span.h"
+
+/*
+ * @brief neighbors of every point in compressed sparse row form,
+ * the neighbors of point i are indices[offsets[i] .. offsets[i + 1])
+ */
+struct NeighborLists {
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> indices;
+
+	size_t numberOfPoints() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+
+	Span<const uint32_t> neighbors(size_t i) const {
+		return Span<const uint32_t>(indices.data() + offsets[i], offsets[i + 1] - offsets[i]);
+	}
+};
+
+/*
+ * Uniform grid neighbor search. Points are bucketed by hashing their grid
+ * cell and sorted into cell lists with a parallel counting sort, so a build is
+ * linear in the number of points and memory does not depend on the domain size.
+ */
+class PointNeighborSearcher {
+public:
+	/*
+	 * @brief gridSpacing is normally the search radius
+	 */
+	explicit PointNeighborSearcher(float gridSpacing);
+
+	float gridSpacing() const { return _gridSpacing; }
+
+	void setGridSpacing(float gridSpacing);
+
+	void build(Span<const glm::vec3> points);
+
+	void build(VectorChannelView<const float> points);
+
+	size_t numberOfPoints() const { return _sortedPoints.size(); }
+
+	/*
+	 * @brief call callback(index, position) for every point within radius of origin
+	 */
+	template <typename Callback>
+	void forEachNearbyPoint(const glm::vec3& origin, float radius, Callback callback) const;
+
+	/*
+	 * @brief true if any point lies within radius of origin
+	 */
+	bool hasNearbyPoint(const glm::vec3& origin, float radius) const;
+
+	/*
+	 * @brief neighbors of every built point within radius, in parallel
+	 */
+	void buildNeighborLists(float radius, NeighborLists& lists, bool includeSelf = false) const;
+
+private:
+	float _gridSpacing;
+	float _inverseGridSpacing;
+	uint32_t _bucketMask = 0;
+	std::vector<uint32_t> _bucketStart;
+	std::vector<uint32_t> _sortedIndices;
+	std::vector<glm::vec3> _sortedPoints;
+	// scratch, kept between builds to avoid reallocation
+	std::vector<glm::vec3> _points;
+	std::vector<uint32_t> _bucketOfPoint;
+
+	void buildFromPoints();
+
+	glm::ivec3 cellOf(const glm::vec3& p) const {
+		return glm::ivec3(std::floor(p.x * _inverseGridSpacing), std::floor(p.y * _inverseGridSpacing),
+			std::floor(p.z * _inverseGridSpacing));
+	}
+
+	uint32_t bucketOf(const glm::ivec3& cell) const {
+		uint32_t h = static_cast<uint32_t>(cell.x) * 73856093u ^ static_cast<uint32_t>(cell.y) * 19349663u ^
+			static_cast<uint32_t>(cell.z) * 83492791u;
+		return h & _bucketMask;
+	}
+};
+
+/*
+ * Neighbor lists built with a skin margin around the search radius and reused
+ * across steps. They are rebuilt only once some point moved more than half the
+ * skin since the last build, before that no pair can have entered the radius
+ * unnoticed. The lists are a superset, users still test the real distance.
+ */
+class VerletNeighborLists {
+public:
+	VerletNeighborLists(float searchRadius, float skin);
+
+	float searchRadius() const { return _searchRadius; }
+
+	float skin() const { return _skin; }
+
+	void setRadius(float searchRadius, float skin);
+
+	/*
+	 * @brief rebuild if needed, returns true if the lists were rebuilt
+	 */
+	bool update(Span<const glm::vec3> points);
+
+	bool update(VectorChannelView<const float> points);
+
+	/*
+	 * @brief force a rebuild on the next update, e.g. after particles were reordered
+	 */
+	void invalidate() { _valid = false; }
+
+	const NeighborLists& lists() const { return _lists; }
+
+	const PointNeighborSearcher& searcher() const { return _searcher; }
+
+	unsigned long long numberOfUpdates() const { return _numberOfUpdates; }
+
+	unsigned long long numberOfRebuilds() const { return _numberOfRebuilds; }
+
+	/*
+	 * @brief fraction of updates that had to rebuild the lists
+	 */
+	double rebuildRate() const {
+		return _numberOfUpdates > 0 ? static_cast<double>(_numberOfRebuilds) / _numberOfUpdates : 0.0;
+	}
+
+private:
+	float _searchRadius;
+	float _skin;
+	bool _valid = false;
+	PointNeighborSearcher _searcher;
+	NeighborLists _lists;
+	std::vector<glm::vec3> _referencePositions;
+	unsigned long long _numberOfUpdates = 0;
+	unsigned long long _numberOfRebuilds = 0;
+
+	template <typename Points>
+	bool updateFrom(const Points& points, size_t n);
+};
+
+template <typename Callback>
+void PointNeighborSearcher::forEachNearbyPoint(const glm::vec3& origin, float radius, Callback callback) const {
+	if (_sortedPoints.empty()) {
+		return;
+	}
+	const glm::ivec3 lower = cellOf(origin - glm::vec3(radius));
+	const glm::ivec3 upper = cellOf(origin + glm::vec3(radius));
+	const float radiusSquared = radius * radius;
+
+	// different cells may hash to the same bucket, visit every bucket once
+	uint32_t visited[64];
+	int numberOfVisited = 0;
+	// extents in 64 bits and each capped before multiplying, a large radius over a small
+	// spacing would overflow int and could wrap to a small cell count
+	const int64_t extentX = static_cast<int64_t>(upper.x) - lower.x + 1;
+	const int64_t extentY = static_cast<int64_t>(upper.y) - lower.y + 1;
+	const int64_t extentZ = static_cast<int64_t>(upper.z) - lower.z + 1;
+	bool trackVisited = extentX <= 64 && extentY <= 64 && extentZ <= 64 && extentX * extentY * extentZ <= 64;
+
+	for (int z = lower.z; z <= upper.z; ++z) {
+		for (int y = lower.y; y <= upper.y; ++y) {
+			for (int x = lower.x; x <= upper.x; ++x) {
+				uint32_t bucket = bucketOf(glm::ivec3(x, y, z));
+				if (trackVisited) {
+					bool seen = false;
+					for (int i = 0; i < numberOfVisited; ++i) {
+						if (visited[i] == bucket) {
+							seen = true;
+							break;
+						}
+					}
+					if (seen) {
+						continue;
+					}
+					visited[numberOfVisited++] = bucket;
+				}
+				for (uint32_t j = _bucketStart[bucket]; j < _bucketStart[bucket + 1]; ++j) {
+					const glm::vec3& p = _sortedPoints[j];
+					glm::vec3 d = p - origin;
+					if (glm::dot(d, d) <= radiusSquared) {
+						// too many cells to track buckets, report a point only while visiting its own cell
+						if (!trackVisited) {
+							glm::ivec3 c = cellOf(p);
+							if (c.x != x || c.y != y || c.z != z) {
+								continue;
+							}
+						}
+						callback(static_cast<size_t>(_sortedIndices[j]), p);
+					}
+				}
+			}
+		}
+	}
+}
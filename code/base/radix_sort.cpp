@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <array>
+
+#include "radix_sort.h"
+#include "thread_pool.h"
+
+void parallelRadixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values) {
+	const size_t n = keys.size();
+	if (n <= 1) {
+		return;
+	}
+	values.resize(n);
+
+	uint32_t maxKey = *std::max_element(keys.begin(), keys.end());
+	int numberOfPasses = 0;
+	while (numberOfPasses < 4 && (maxKey >> (8 * numberOfPasses)) != 0) {
+		numberOfPasses++;
+	}
+
+	ThreadPool& pool = ThreadPool::global();
+	const size_t numberOfChunks = std::max<size_t>(1, std::min<size_t>(pool.size() * 4, n / 4096));
+	const size_t chunkSize = (n + numberOfChunks - 1) / numberOfChunks;
+	std::vector<std::array<size_t, 256>> histograms(numberOfChunks);
+
+	std::vector<uint32_t> keysOut(n), valuesOut(n);
+	for (int pass = 0; pass < numberOfPasses; ++pass) {
+		const int shift = 8 * pass;
+
+		pool.parallelFor(0, numberOfChunks, [&](size_t first, size_t last) {
+			for (size_t c = first; c < last; ++c) {
+				std::array<size_t, 256>& histogram = histograms[c];
+				histogram.fill(0);
+				size_t end = std::min(n, (c + 1) * chunkSize);
+				for (size_t i = c * chunkSize; i < end; ++i) {
+					histogram[(keys[i] >> shift) & 0xff]++;
+				}
+			}
+		}, 1);
+
+		// offsets ordered by digit first and chunk second keep the sort stable
+		size_t sum = 0;
+		for (int digit = 0; digit < 256; ++digit) {
+			for (size_t c = 0; c < numberOfChunks; ++c) {
+				size_t count = histograms[c][digit];
+				histograms[c][digit] = sum;
+				sum += count;
+			}
+		}
+
+		pool.parallelFor(0, numberOfChunks, [&](size_t first, size_t last) {
+			for (size_t c = first; c < last; ++c) {
+				std::array<size_t, 256>& cursor = histograms[c];
+				size_t end = std::min(n, (c + 1) * chunkSize);
+				for (size_t i = c * chunkSize; i < end; ++i) {
+					size_t slot = cursor[(keys[i] >> shift) & 0xff]++;
+					keysOut[slot] = keys[i];
+					valuesOut[slot] = values[i];
+				}
+			}
+		}, 1);
+
+		keys.swap(keysOut);
+		values.swap(valuesOut);
+	}
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * @brief stable parallel LSD radix sort of keys, values are permuted along with them
+ */
+void parallelRadixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+ * non-owning view of a contiguous array, used to hand out data without copying it
+ */
+template <typename T>
+class Span {
+public:
+	Span() = default;
+
+	Span(T* data, size_t size): _data(data), _size(size) {}
+
+	template <typename Container>
+	Span(Container& container): _data(container.data()), _size(container.size()) {}
+
+	template <typename U>
+	Span(const Span<U>& other): _data(other.data()), _size(other.size()) {}
+
+	T* data() const { return _data; }
+
+	size_t size() const { return _size; }
+
+	bool empty() const { return _size == 0; }
+
+	T* begin() const { return _data; }
+
+	T* end() const { return _data + _size; }
+
+	T& operator[](size_t i) const { return _data[i]; }
+
+	Span subspan(size_t offset, size_t count) const { return Span(_data + offset, count); }
+
+private:
+	T* _data = nullptr;
+	size_t _size = 0;
+};
@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+#include "sparse_cholesky.h"
+
+namespace {
+
+void checkPattern(const SparseMatrix& matrix) {
+	if (matrix.offsets.size() != matrix.size + 1 || matrix.offsets.back() != matrix.indices.size()) {
+		throw std::invalid_argument("malformed sparse matrix");
+	}
+	for (uint32_t column : matrix.indices) {
+		if (column >= matrix.size) {
+			throw std::invalid_argument("sparse matrix column out of range");
+		}
+	}
+}
+
+}
+
+std::vector<uint32_t> minimumDegreeOrdering(const SparseMatrix& matrix) {
+	checkPattern(matrix);
+	const size_t n = matrix.size;
+	std::vector<std::vector<uint32_t>> adjacency(n);
+	for (size_t i = 0; i < n; i++) {
+		for (uint32_t p = matrix.offsets[i]; p < matrix.offsets[i + 1]; p++) {
+			if (matrix.indices[p] != i) {
+				adjacency[i].push_back(matrix.indices[p]);
+			}
+		}
+		std::sort(adjacency[i].begin(), adjacency[i].end());
+		adjacency[i].erase(std::unique(adjacency[i].begin(), adjacency[i].end()), adjacency[i].end());
+	}
+
+	// degrees only change for the neighbors of an eliminated vertex, they are pushed
+	// again and the outdated entries skipped when they come up
+	using Entry = std::pair<size_t, uint32_t>;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+	for (size_t i = 0; i < n; i++) {
+		queue.push(Entry(adjacency[i].size(), static_cast<uint32_t>(i)));
+	}
+	std::vector<char> eliminated(n, 0);
+	std::vector<uint32_t> order;
+	order.reserve(n);
+	std::vector<uint32_t> merged;
+	while (!queue.empty()) {
+		const Entry top = queue.top();
+		queue.pop();
+		const uint32_t v = top.second;
+		if (eliminated[v] || top.first != adjacency[v].size()) {
+			continue;
+		}
+		eliminated[v] = 1;
+		order.push_back(v);
+		// eliminating v joins its neighbors into a clique
+		const std::vector<uint32_t>& clique = adjacency[v];
+		for (uint32_t u : clique) {
+			merged.clear();
+			std::set_union(adjacency[u].begin(), adjacency[u].end(), clique.begin(), clique.end(),
+				std::back_inserter(merged));
+			merged.erase(std::remove_if(merged.begin(), merged.end(), [u, v](uint32_t w) {
+				return w == u || w == v;
+			}), merged.end());
+			adjacency[u].swap(merged);
+			queue.push(Entry(adjacency[u].size(), u));
+		}
+		std::vector<uint32_t>().swap(adjacency[v]);
+	}
+	return order;
+}
+
+void SparseCholesky::analyze(const SparseMatrix& matrix) {
+	_permutation = minimumDegreeOrdering(matrix);
+	const size_t n = matrix.size;
+	_inversePermutation.resize(n);
+	for (size_t k = 0; k < n; k++) {
+		_inversePermutation[_permutation[k]] = static_cast<uint32_t>(k);
+	}
+
+	// row k of L is the union of the paths from the entries of row k of the
+	// permuted matrix up the elimination tree, which is built along the way
+	_parent.assign(n, -1);
+	std::vector<size_t> counts(n, 0);
+	std::vector<size_t> flag(n);
+	for (size_t k = 0; k < n; k++) {
+		flag[k] = k;
+		const uint32_t row = _permutation[k];
+		for (uint32_t p = matrix.offsets[row]; p < matrix.offsets[row + 1]; p++) {
+			size_t i = _inversePermutation[matrix.indices[p]];
+			for (; i < k && flag[i] != k; i = static_cast<size_t>(_parent[i])) {
+				if (_parent[i] < 0) {
+					_parent[i] = static_cast<int64_t>(k);
+				}
+				counts[i]++;
+				flag[i] = k;
+			}
+		}
+	}
+	_columnOffsets.assign(n + 1, 0);
+	for (size_t k = 0; k < n; k++) {
+		_columnOffsets[k + 1] = _columnOffsets[k] + counts[k];
+	}
+	_rowIndices.resize(_columnOffsets[n]);
+	_lowerValues.resize(_columnOffsets[n]);
+	_diagonal.resize(n);
+	_matrixNonZeros = matrix.indices.size();
+	_factorized = false;
+}
+
+void SparseCholesky::factorize(const SparseMatrix& matrix) {
+	const size_t n = size();
+	if (!analyzed() || matrix.size != n || matrix.indices.size() != _matrixNonZeros ||
+		matrix.values.size() != _matrixNonZeros) {
+		throw std::invalid_argument("matrix does not match the analyzed pattern");
+	}
+	_factorized = false;
+	// up looking: row k of L comes from a sparse triangular solve with the rows above,
+	// its pattern is the reach of row k of A in the elimination tree
+	std::vector<double> y(n, 0.0);
+	std::vector<size_t> pattern(n);
+	std::vector<size_t> flag(n);
+	std::vector<size_t> filled(n, 0);
+	for (size_t k = 0; k < n; k++) {
+		size_t top = n;
+		flag[k] = k;
+		const uint32_t row = _permutation[k];
+		for (uint32_t p = matrix.offsets[row]; p < matrix.offsets[row + 1]; p++) {
+			size_t i = _inversePermutation[matrix.indices[p]];
+			if (i > k) {
+				continue;
+			}
+			y[i] += matrix.values[p];
+			size_t length = 0;
+			for (; flag[i] != k; i = static_cast<size_t>(_parent[i])) {
+				pattern[length++] = i;
+				flag[i] = k;
+			}
+			while (length > 0) {
+				pattern[--top] = pattern[--length];
+			}
+		}
+		double diagonal = y[k];
+		y[k] = 0.0;
+		for (; top < n; top++) {
+			const size_t i = pattern[top];
+			const double yi = y[i];
+			y[i] = 0.0;
+			const size_t end = _columnOffsets[i] + filled[i];
+			for (size_t p = _columnOffsets[i]; p < end; p++) {
+				y[_rowIndices[p]] -= _lowerValues[p] * yi;
+			}
+			const double lki = yi / _diagonal[i];
+			diagonal -= lki * yi;
+			_rowIndices[end] = static_cast<uint32_t>(k);
+			_lowerValues[end] = lki;
+			filled[i]++;
+		}
+		if (!(diagonal > 0.0)) {
+			throw std::runtime_error("matrix is not positive definite");
+		}
+		_diagonal[k] = diagonal;
+	}
+	_factorized = true;
+}
+
+void SparseCholesky::solve(Span<double> values, size_t columns) const {
+	const size_t n = size();
+	if (!_factorized) {
+		throw std::logic_error("solve before factorize");
+	}
+	if (values.size() != n * columns) {
+		throw std::invalid_argument("right hand side does not match the matrix");
+	}
+	_work.resize(values.size());
+	double* x = _work.data();
+	for (size_t k = 0; k < n; k++) {
+		std::copy_n(values.data() + _permutation[k] * columns, columns, x + k * columns);
+	}
+	// L y = b
+	for (size_t j = 0; j < n; j++) {
+		const double* xj = x + j * columns;
+		for (size_t p = _columnOffsets[j]; p < _columnOffsets[j + 1]; p++) {
+			double* xi = x + _rowIndices[p] * columns;
+			for (size_t c = 0; c < columns; c++) {
+				xi[c] -= _lowerValues[p] * xj[c];
+			}
+		}
+	}
+	// D z = y
+	for (size_t j = 0; j < n; j++) {
+		const double inverse = 1.0 / _diagonal[j];
+		for (size_t c = 0; c < columns; c++) {
+			x[j * columns + c] *= inverse;
+		}
+	}
+	// L^T x = z
+	for (size_t j = n; j-- > 0;) {
+		double* xj = x + j * columns;
+		for (size_t p = _columnOffsets[j]; p < _columnOffsets[j + 1]; p++) {
+			const double* xi = x + _rowIndices[p] * columns;
+			for (size_t c = 0; c < columns; c++) {
+				xj[c] -= _lowerValues[p] * xi[c];
+			}
+		}
+	}
+	for (size_t k = 0; k < n; k++) {
+		std::copy_n(x + k * columns, columns, values.data() + _permutation[k] * columns);
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "span.h"
+
+/*
+ * square matrix in compressed sparse row form, row i holds the columns
+ * indices[offsets[i] .. offsets[i + 1]) with the matching values
+ */
+struct SparseMatrix {
+	size_t size = 0;
+	std::vector<uint32_t> offsets;
+	std::vector<uint32_t> indices;
+	std::vector<double> values;
+};
+
+/*
+ * @brief fill reducing elimination order of a structurally symmetric matrix, the
+ * minimum degree vertex of the elimination graph goes first. order[k] is the row
+ * eliminated k-th.
+ */
+std::vector<uint32_t> minimumDegreeOrdering(const SparseMatrix& matrix);
+
+/*
+ * Sparse LDL^T factorization of a symmetric positive definite matrix
+ * (the square root free Cholesky of Davis' LDL). The work is split so that
+ * a matrix with a fixed pattern is analyzed once and refactorized cheaply
+ * whenever only its values change:
+ *   analyze    ordering, elimination tree and pattern of L
+ *   factorize  values of L and D
+ *   solve      two triangular and one diagonal solve
+ * Both triangles of the matrix must be stored.
+ */
+class SparseCholesky {
+public:
+	/*
+	 * @brief order the rows with minimumDegreeOrdering and lay out L, the values are not used
+	 */
+	void analyze(const SparseMatrix& matrix);
+
+	/*
+	 * @brief numeric factorization of a matrix with the analyzed pattern, throws
+	 * std::invalid_argument for another pattern and std::runtime_error if the matrix
+	 * is not positive definite
+	 */
+	void factorize(const SparseMatrix& matrix);
+
+	/*
+	 * @brief solve A x = values in place for columns right hand sides stored row by row,
+	 * values[i * columns + c] is row i of column c. Uses a scratch buffer, so two solves
+	 * with the same factor must not run at once.
+	 */
+	void solve(Span<double> values, size_t columns = 1) const;
+
+	bool analyzed() const { return !_columnOffsets.empty(); }
+
+	bool factorized() const { return _factorized; }
+
+	size_t size() const { return _permutation.size(); }
+
+	/*
+	 * @brief entries of L below the diagonal, a measure of the fill the ordering left
+	 */
+	size_t numberOfNonZeros() const { return _rowIndices.size(); }
+
+	const std::vector<uint32_t>& permutation() const { return _permutation; }
+
+private:
+	// pattern of the analyzed matrix, factorize checks against it
+	size_t _matrixNonZeros = 0;
+	std::vector<uint32_t> _permutation;
+	std::vector<uint32_t> _inversePermutation;
+	// elimination tree of the permuted matrix, -1 at the roots
+	std::vector<int64_t> _parent;
+	// L column by column without the unit diagonal, rows of column j are
+	// _rowIndices[_columnOffsets[j] .. _columnOffsets[j + 1])
+	std::vector<size_t> _columnOffsets;
+	std::vector<uint32_t> _rowIndices;
+	std::vector<double> _lowerValues;
+	std::vector<double> _diagonal;
+	bool _factorized = false;
+	mutable std::vector<double> _work;
+};
@@ -0,0 +1,105 @@
+#include <functional>
+
+#include "sparse_grid3.h"
+
+BlockAllocator::BlockAllocator(size_t blockSize, size_t alignment, size_t blocksPerPage)
+	: _blockSize(alignUp(blockSize, alignment)), _alignment(alignment), _blocksPerPage(blocksPerPage) {}
+
+BlockAllocator::~BlockAllocator() {
+	clear();
+}
+
+void* BlockAllocator::allocate() {
+	if (_freeBlocks.empty()) {
+		char* page = static_cast<char*>(alignedAlloc(_blocksPerPage * _blockSize, _alignment));
+		_pages.push_back(page);
+		// handed out from the front of the page first
+		for (size_t b = _blocksPerPage; b-- > 0;) {
+			_freeBlocks.push_back(page + b * _blockSize);
+		}
+	}
+	void* block = _freeBlocks.back();
+	_freeBlocks.pop_back();
+	_numberOfBlocks++;
+	return block;
+}
+
+void BlockAllocator::free(void* block) {
+	_freeBlocks.push_back(block);
+	_numberOfBlocks--;
+}
+
+size_t BlockAllocator::releaseUnusedPages() {
+	if (_freeBlocks.size() < _blocksPerPage) {
+		return 0;
+	}
+	// count the free blocks of every page, found by address among the sorted pages
+	std::vector<char*> pages(_pages.size());
+	std::transform(_pages.begin(), _pages.end(), pages.begin(), [](void* page) { return static_cast<char*>(page); });
+	std::sort(pages.begin(), pages.end(), std::less<char*>());
+	auto pageOf = [&](void* block) {
+		return std::upper_bound(pages.begin(), pages.end(), static_cast<char*>(block), std::less<char*>()) -
+			pages.begin() - 1;
+	};
+	std::vector<size_t> freeCount(pages.size(), 0);
+	for (void* block : _freeBlocks) {
+		freeCount[pageOf(block)]++;
+	}
+
+	// the remaining free blocks keep their order, so pages still fill from the front
+	std::vector<void*> freeBlocks;
+	for (void* block : _freeBlocks) {
+		if (freeCount[pageOf(block)] < _blocksPerPage) {
+			freeBlocks.push_back(block);
+		}
+	}
+	_freeBlocks.swap(freeBlocks);
+	_pages.clear();
+	size_t released = 0;
+	for (size_t p = 0; p < pages.size(); p++) {
+		if (freeCount[p] == _blocksPerPage) {
+			alignedFree(pages[p]);
+			released++;
+		} else {
+			_pages.push_back(pages[p]);
+		}
+	}
+	return released;
+}
+
+void BlockAllocator::clear() {
+	for (void* page : _pages) {
+		alignedFree(page);
+	}
+	_pages.clear();
+	_freeBlocks.clear();
+	_numberOfBlocks = 0;
+}
+
+void SparseScalarGrid3::sample(Span<const glm::vec3> points, Span<double> values) const {
+	SparseGrid3<float>::ConstAccessor accessor = _grid.constAccessor();
+	for (size_t i = 0; i < points.size(); i++) {
+		values[i] = accessor.sampleLinear(points[i]);
+	}
+}
+
+void SparseScalarGrid3::sample(VectorChannelView<const float> points, Span<double> values) const {
+	SparseGrid3<float>::ConstAccessor accessor = _grid.constAccessor();
+	for (size_t i = 0; i < points.size; i++) {
+		values[i] = accessor.sampleLinear(points.get(i));
+	}
+}
+
+void SparseVectorGrid3::sample(Span<const glm::vec3> points, Span<glm::vec3> values) const {
+	SparseGrid3<glm::vec3>::ConstAccessor accessor = _grid.constAccessor();
+	for (size_t i = 0; i < points.size(); i++) {
+		values[i] = accessor.sampleLinear(points[i]);
+	}
+}
+
+void SparseVectorGrid3::sample(VectorChannelView<const float> points, VectorChannelView<float> values) const {
+	SparseGrid3<glm::vec3>::ConstAccessor accessor = _grid.constAccessor();
+	for (size_t i = 0; i < points.size; i++) {
+		values.set(i, accessor.sampleLinear(points.get(i)));
+	}
+}
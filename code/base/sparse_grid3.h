@@ -0,0 +1,450 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "aligned_memory.h"
+#include "field.h"
+#include "particle_system_data.h"
+#include "span.h"
+#include "thread_pool.h"
+
+/*
+ * @brief fixed size blocks carved out of large aligned pages, freed blocks are reused before new pages
+ */
+class BlockAllocator {
+public:
+	explicit BlockAllocator(size_t blockSize, size_t alignment = 64, size_t blocksPerPage = 64);
+
+	~BlockAllocator();
+
+	BlockAllocator(const BlockAllocator&) = delete;
+
+	BlockAllocator& operator=(const BlockAllocator&) = delete;
+
+	void* allocate();
+
+	void free(void* block);
+
+	/*
+	 * @brief return the pages none of whose blocks are in use to the system, returns how many
+	 */
+	size_t releaseUnusedPages();
+
+	/*
+	 * @brief release every page, all blocks handed out become invalid
+	 */
+	void clear();
+
+	size_t blockSize() const { return _blockSize; }
+
+	size_t numberOfBlocks() const { return _numberOfBlocks; }
+
+	size_t reservedBytes() const { return _pages.size() * _blocksPerPage * _blockSize; }
+
+private:
+	size_t _blockSize;
+	size_t _alignment;
+	size_t _blocksPerPage;
+	std::vector<void*> _pages;
+	std::vector<void*> _freeBlocks;
+	size_t _numberOfBlocks = 0;
+};
+
+/*
+ * @brief largest per component difference, used to find blocks that hold only the background
+ */
+inline float valueDifference(float a, float b) {
+	return std::abs(a - b);
+}
+
+inline float valueDifference(const glm::vec3& a, const glm::vec3& b) {
+	glm::vec3 d = glm::abs(a - b);
+	return glm::max(d.x, glm::max(d.y, d.z));
+}
+
+/*
+ * Sparse cell-centered grid made of 8x8x8 voxel blocks found through a hash
+ * map. Only allocated (active) blocks cost memory, every other voxel reads as
+ * the background value, so memory follows the region that is actually used
+ * instead of the bounding box. Voxel (i, j, k) is centered at
+ * origin + (i + 0.5, j + 0.5, k + 0.5) * voxelSize and indices may be negative.
+ *
+ * Activating and pruning blocks is not thread safe. Reading, and writing voxels
+ * of active blocks, is, as long as the structure doesn't change meanwhile.
+ */
+template <typename T>
+class SparseGrid3 {
+public:
+	static constexpr int kBlockBits = 3;
+	static constexpr int kBlockWidth = 1 << kBlockBits;
+	static constexpr int kBlockMask = kBlockWidth - 1;
+	static constexpr int kBlockVoxels = kBlockWidth * kBlockWidth * kBlockWidth;
+
+	explicit SparseGrid3(float voxelSize = 1.0f, const glm::vec3& origin = glm::vec3(0.0f),
+		const T& background = T())
+		: _voxelSize(voxelSize), _inverseVoxelSize(1.0f / voxelSize), _origin(origin), _background(background),
+		_allocator(sizeof(T) * kBlockVoxels) {}
+
+	SparseGrid3(const SparseGrid3&) = delete;
+
+	SparseGrid3& operator=(const SparseGrid3&) = delete;
+
+	float voxelSize() const { return _voxelSize; }
+
+	const glm::vec3& origin() const { return _origin; }
+
+	const T& background() const { return _background; }
+
+	size_t numberOfBlocks() const { return _blocks.size(); }
+
+	size_t numberOfActiveVoxels() const { return _blocks.size() * kBlockVoxels; }
+
+	const glm::ivec3& blockCoordinate(size_t block) const { return _blockCoordinates[block]; }
+
+	T* blockData(size_t block) { return _blocks[block]; }
+
+	const T* blockData(size_t block) const { return _blocks[block]; }
+
+	/*
+	 * @brief bytes held by the blocks, the block table and the hash map
+	 */
+	size_t memoryUsage() const {
+		return _allocator.reservedBytes() + _blocks.capacity() * (sizeof(T*) + sizeof(glm::ivec3)) +
+			_blockIndices.bucket_count() * sizeof(void*) + _blockIndices.size() * (sizeof(uint64_t) + 2 * sizeof(void*));
+	}
+
+	/*
+	 * @brief floor division by the block width, right shifts of negative integers are arithmetic on every target we build for
+	 */
+	static glm::ivec3 blockOf(int i, int j, int k) {
+		return glm::ivec3(i >> kBlockBits, j >> kBlockBits, k >> kBlockBits);
+	}
+
+	static int localIndex(int i, int j, int k) {
+		return (i & kBlockMask) | ((j & kBlockMask) << kBlockBits) | ((k & kBlockMask) << (2 * kBlockBits));
+	}
+
+	glm::ivec3 voxelOf(const glm::vec3& x) const {
+		glm::vec3 g = glm::floor((x - _origin) * _inverseVoxelSize);
+		return glm::ivec3(g);
+	}
+
+	glm::vec3 voxelCenter(int i, int j, int k) const {
+		return _origin + (glm::vec3(i, j, k) + 0.5f) * _voxelSize;
+	}
+
+	/*
+	 * @brief voxels of an active block, nullptr if the block is not allocated
+	 */
+	T* findBlock(const glm::ivec3& block) const {
+		auto it = _blockIndices.find(key(block));
+		return it != _blockIndices.end() ? _blocks[it->second] : nullptr;
+	}
+
+	/*
+	 * @brief voxels of a block, allocated and set to the background on first use
+	 */
+	T* touchBlock(const glm::ivec3& block) {
+		auto inserted = _blockIndices.emplace(key(block), static_cast<uint32_t>(_blocks.size()));
+		if (!inserted.second) {
+			return _blocks[inserted.first->second];
+		}
+		T* values = static_cast<T*>(_allocator.allocate());
+		std::fill(values, values + kBlockVoxels, _background);
+		_blocks.push_back(values);
+		_blockCoordinates.push_back(block);
+		return values;
+	}
+
+	T value(int i, int j, int k) const {
+		const T* block = findBlock(blockOf(i, j, k));
+		return block != nullptr ? block[localIndex(i, j, k)] : _background;
+	}
+
+	void setValue(int i, int j, int k, const T& value) {
+		touchBlock(blockOf(i, j, k))[localIndex(i, j, k)] = value;
+	}
+
+	/*
+	 * @brief activate the blocks covering every voxel within radius of the points, e.g. the particles
+	 */
+	void activate(VectorChannelView<const float> points, float radius) {
+		uint64_t lastKey = ~uint64_t(0);
+		for (size_t p = 0; p < points.size; p++) {
+			glm::vec3 x = points.get(p);
+			glm::ivec3 lower = blockOf(voxelOf(x - radius)), upper = blockOf(voxelOf(x + radius));
+			// neighboring particles mostly cover the same single block
+			if (lower == upper && key(lower) == lastKey) {
+				continue;
+			}
+			for (int k = lower.z; k <= upper.z; k++) {
+				for (int j = lower.y; j <= upper.y; j++) {
+					for (int i = lower.x; i <= upper.x; i++) {
+						touchBlock(glm::ivec3(i, j, k));
+					}
+				}
+			}
+			lastKey = key(upper);
+		}
+	}
+
+	/*
+	 * @brief free the blocks whose voxels all lie within tolerance of the background, returns how many.
+	 * Pages left without active blocks go back to the system
+	 */
+	size_t prune(float tolerance = 0.0f) {
+		size_t removed = 0;
+		for (size_t b = _blocks.size(); b-- > 0;) {
+			const T* values = _blocks[b];
+			bool empty = true;
+			for (int v = 0; v < kBlockVoxels && empty; v++) {
+				empty = valueDifference(values[v], _background) <= tolerance;
+			}
+			if (empty) {
+				removeBlock(b);
+				removed++;
+			}
+		}
+		if (removed > 0) {
+			_allocator.releaseUnusedPages();
+		}
+		return removed;
+	}
+
+	void clear() {
+		_blockIndices.clear();
+		_blocks.clear();
+		_blockCoordinates.clear();
+		_allocator.clear();
+	}
+
+	/*
+	 * @brief run function(blockCoordinate, values) for every active block, in parallel
+	 */
+	template <typename Function>
+	void forEachBlock(const Function& function) {
+		parallelFor(0, _blocks.size(), [&](size_t begin, size_t end) {
+			for (size_t b = begin; b < end; b++) {
+				function(_blockCoordinates[b], _blocks[b]);
+			}
+		}, 1);
+	}
+
+	/*
+	 * @brief run function(i, j, k, value) for every voxel of the active blocks, in parallel over blocks
+	 */
+	template <typename Function>
+	void forEachVoxel(const Function& function) {
+		forEachBlock([&](const glm::ivec3& block, T* values) {
+			const glm::ivec3 first = block * kBlockWidth;
+			for (int v = 0; v < kBlockVoxels; v++) {
+				function(first.x + (v & kBlockMask), first.y + ((v >> kBlockBits) & kBlockMask),
+					first.z + (v >> (2 * kBlockBits)), values[v]);
+			}
+		});
+	}
+
+	/*
+	 * @brief set every active voxel to function(voxel center)
+	 */
+	template <typename Function>
+	void fill(const Function& function) {
+		forEachVoxel([&](int i, int j, int k, T& value) { value = function(voxelCenter(i, j, k)); });
+	}
+
+	/*
+	 * Reads voxels through the block of the previous lookup, so coherent access
+	 * skips the hash map. Missing blocks are cached too, an accessor must not be
+	 * kept across activate, prune or clear. Each thread uses its own.
+	 */
+	class ConstAccessor {
+	public:
+		explicit ConstAccessor(const SparseGrid3& grid) : _grid(&grid) {}
+
+		T value(int i, int j, int k) {
+			const T* values = block(blockOf(i, j, k));
+			return values != nullptr ? values[localIndex(i, j, k)] : _grid->_background;
+		}
+
+		const T* block(const glm::ivec3& coordinate) {
+			if (coordinate != _cachedBlock || !_valid) {
+				_cachedBlock = coordinate;
+				_cachedValues = _grid->findBlock(coordinate);
+				_valid = true;
+			}
+			return _cachedValues;
+		}
+
+		/*
+		 * @brief trilinear interpolation between the voxel centers
+		 */
+		T sampleLinear(const glm::vec3& x) {
+			glm::vec3 g = (x - _grid->_origin) * _grid->_inverseVoxelSize - 0.5f;
+			glm::vec3 lower = glm::floor(g);
+			glm::vec3 t = g - lower;
+			glm::ivec3 v(lower);
+			T c[8];
+			glm::ivec3 local = v & kBlockMask;
+			if (local.x < kBlockMask && local.y < kBlockMask && local.z < kBlockMask) {
+				// the whole stencil sits in one block, a single lookup
+				const T* values = block(blockOf(v.x, v.y, v.z));
+				if (values == nullptr) {
+					return _grid->_background;
+				}
+				const int base = localIndex(v.x, v.y, v.z);
+				const int dy = kBlockWidth, dz = kBlockWidth * kBlockWidth;
+				c[0] = values[base];
+				c[1] = values[base + 1];
+				c[2] = values[base + dy];
+				c[3] = values[base + 1 + dy];
+				c[4] = values[base + dz];
+				c[5] = values[base + 1 + dz];
+				c[6] = values[base + dy + dz];
+				c[7] = values[base + 1 + dy + dz];
+			} else {
+				for (int corner = 0; corner < 8; corner++) {
+					c[corner] = value(v.x + (corner & 1), v.y + ((corner >> 1) & 1), v.z + (corner >> 2));
+				}
+			}
+			T c00 = c[0] + t.x * (c[1] - c[0]);
+			T c10 = c[2] + t.x * (c[3] - c[2]);
+			T c01 = c[4] + t.x * (c[5] - c[4]);
+			T c11 = c[6] + t.x * (c[7] - c[6]);
+			T c0 = c00 + t.y * (c10 - c00);
+			T c1 = c01 + t.y * (c11 - c01);
+			return c0 + t.z * (c1 - c0);
+		}
+
+	private:
+		const SparseGrid3* _grid;
+		glm::ivec3 _cachedBlock{0};
+		const T* _cachedValues = nullptr;
+		bool _valid = false;
+	};
+
+	/*
+	 * @brief cached writes, blocks are activated on first write
+	 */
+	class Accessor {
+	public:
+		explicit Accessor(SparseGrid3& grid) : _grid(&grid) {}
+
+		T& operator()(int i, int j, int k) {
+			glm::ivec3 coordinate = blockOf(i, j, k);
+			if (coordinate != _cachedBlock || _cachedValues == nullptr) {
+				_cachedBlock = coordinate;
+				_cachedValues = _grid->touchBlock(coordinate);
+			}
+			return _cachedValues[localIndex(i, j, k)];
+		}
+
+		void setValue(int i, int j, int k, const T& value) { (*this)(i, j, k) = value; }
+
+	private:
+		SparseGrid3* _grid;
+		glm::ivec3 _cachedBlock{0};
+		T* _cachedValues = nullptr;
+	};
+
+	ConstAccessor constAccessor() const { return ConstAccessor(*this); }
+
+	Accessor accessor() { return Accessor(*this); }
+
+	T sampleLinear(const glm::vec3& x) const { return constAccessor().sampleLinear(x); }
+
+private:
+	struct KeyHash {
+		size_t operator()(uint64_t key) const {
+			return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 24);
+		}
+	};
+
+	static glm::ivec3 blockOf(const glm::ivec3& voxel) { return blockOf(voxel.x, voxel.y, voxel.z); }
+
+	/*
+	 * @brief 21 bits per axis, block coordinates within +-2^20 (8 million voxels per axis)
+	 */
+	static uint64_t key(const glm::ivec3& block) {
+		const uint64_t bias = uint64_t(1) << 20, mask = (uint64_t(1) << 21) - 1;
+		return ((static_cast<uint64_t>(block.x) + bias) & mask) | (((static_cast<uint64_t>(block.y) + bias) & mask) << 21) |
+			(((static_cast<uint64_t>(block.z) + bias) & mask) << 42);
+	}
+
+	/*
+	 * @brief swap the last block into slot b
+	 */
+	void removeBlock(size_t b) {
+		_blockIndices.erase(key(_blockCoordinates[b]));
+		_allocator.free(_blocks[b]);
+		size_t last = _blocks.size() - 1;
+		if (b != last) {
+			_blocks[b] = _blocks[last];
+			_blockCoordinates[b] = _blockCoordinates[last];
+			_blockIndices[key(_blockCoordinates[b])] = static_cast<uint32_t>(b);
+		}
+		_blocks.pop_back();
+		_blockCoordinates.pop_back();
+	}
+
+	float _voxelSize;
+	float _inverseVoxelSize;
+	glm::vec3 _origin;
+	T _background;
+	BlockAllocator _allocator;
+	std::unordered_map<uint64_t, uint32_t, KeyHash> _blockIndices;
+	std::vector<T*> _blocks;
+	std::vector<glm::ivec3> _blockCoordinates;
+};
+
+/*
+ * @brief sparse scalar field, e.g. a narrow band level set around the fluid
+ */
+class SparseScalarGrid3 : public ScalarField {
+public:
+	explicit SparseScalarGrid3(float voxelSize = 1.0f, const glm::vec3& origin = glm::vec3(0.0f),
+		float background = 0.0f)
+		: _grid(voxelSize, origin, background) {}
+
+	SparseGrid3<float>& grid() { return _grid; }
+
+	const SparseGrid3<float>& grid() const { return _grid; }
+
+	double sample(const glm::vec3 x) const override { return _grid.sampleLinear(x); }
+
+	void sample(Span<const glm::vec3> points, Span<double> values) const override;
+
+	void sample(VectorChannelView<const float> points, Span<double> values) const override;
+
+private:
+	SparseGrid3<float> _grid;
+};
+
+/*
+ * @brief sparse vector field, e.g. wind or fluid velocity over a large open domain
+ */
+class SparseVectorGrid3 : public VectorField {
+public:
+	explicit SparseVectorGrid3(float voxelSize = 1.0f, const glm::vec3& origin = glm::vec3(0.0f),
+		const glm::vec3& background = glm::vec3(0.0f))
+		: _grid(voxelSize, origin, background) {}
+
+	SparseGrid3<glm::vec3>& grid() { return _grid; }
+
+	const SparseGrid3<glm::vec3>& grid() const { return _grid; }
+
+	glm::vec3 sample(const glm::vec3& x) const override { return _grid.sampleLinear(x); }
+
+	void sample(Span<const glm::vec3> points, Span<glm::vec3> values) const override;
+
+	void sample(VectorChannelView<const float> points, VectorChannelView<float> values) const override;
+
+private:
+	SparseGrid3<glm::vec3> _grid;
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+
+/*
+ * SPH smoothing kernels with compact support radius h. Every kernel is a literal
+ * type with constexpr evaluation, templated on the floating point type and the
+ * dimension, so the normalization folds into a constant and the polynomial
+ * inlines into the loops that call it. Distances passed in must not be negative.
+ */
+
+/*
+ * @brief x^n for a non-negative integer n, usable in constant expressions
+ */
+template <typename T>
+constexpr T integerPower(T x, int n) {
+	T result = T(1);
+	for (int i = 0; i < n; i++) {
+		result *= x;
+	}
+	return result;
+}
+
+template <typename T>
+constexpr T kernelPi() {
+	return T(3.14159265358979323846);
+}
+
+/*
+ * @brief poly6 kernel, (h^2 - r^2)^3, smooth at the center and cheap from a squared distance
+ */
+template <typename T, int Dimension = 3>
+class Poly6Kernel {
+	static_assert(Dimension >= 1 && Dimension <= 3, "kernels are defined for 1, 2 and 3 dimensions");
+
+public:
+	constexpr explicit Poly6Kernel(T radius = T(1))
+		: _radius(radius), _radiusSquared(radius * radius), _normalization(normalization(radius)) {}
+
+	constexpr T radius() const { return _radius; }
+
+	constexpr T operator()(T distance) const { return fromSquared(distance * distance); }
+
+	constexpr T fromSquared(T distanceSquared) const {
+		if (distanceSquared >= _radiusSquared) {
+			return T(0);
+		}
+		T x = _radiusSquared - distanceSquared;
+		return _normalization * x * x * x;
+	}
+
+	/*
+	 * @brief dW/dr
+	 */
+	constexpr T derivative(T distance) const { return distance * derivativeOverDistance(distance * distance); }
+
+	/*
+	 * @brief dW/dr / r, the gradient is this times the vector between the particles, no square root needed
+	 */
+	constexpr T derivativeOverDistance(T distanceSquared) const {
+		if (distanceSquared >= _radiusSquared) {
+			return T(0);
+		}
+		T x = _radiusSquared - distanceSquared;
+		return T(-6) * _normalization * x * x;
+	}
+
+	static constexpr T normalization(T h) {
+		return Dimension == 3 ? T(315) / (T(64) * kernelPi<T>() * integerPower(h, 9))
+			: Dimension == 2 ? T(4) / (kernelPi<T>() * integerPower(h, 8))
+			: T(35) / (T(32) * integerPower(h, 7));
+	}
+
+private:
+	T _radius;
+	T _radiusSquared;
+	T _normalization;
+};
+
+/*
+ * @brief spiky kernel, (h - r)^3, its gradient doesn't vanish at the center so close particles keep repelling
+ */
+template <typename T, int Dimension = 3>
+class SpikyKernel {
+	static_assert(Dimension >= 1 && Dimension <= 3, "kernels are defined for 1, 2 and 3 dimensions");
+
+public:
+	constexpr explicit SpikyKernel(T radius = T(1))
+		: _radius(radius), _normalization(normalization(radius)) {}
+
+	constexpr T radius() const { return _radius; }
+
+	constexpr T operator()(T distance) const {
+		if (distance >= _radius) {
+			return T(0);
+		}
+		T x = _radius - distance;
+		return _normalization * x * x * x;
+	}
+
+	/*
+	 * @brief dW/dr, negative inside the support
+	 */
+	constexpr T derivative(T distance) const {
+		if (distance >= _radius) {
+			return T(0);
+		}
+		T x = _radius - distance;
+		return T(-3) * _normalization * x * x;
+	}
+
+	constexpr T secondDerivative(T distance) const {
+		if (distance >= _radius) {
+			return T(0);
+		}
+		return T(6) * _normalization * (_radius - distance);
+	}
+
+	static constexpr T normalization(T h) {
+		return Dimension == 3 ? T(15) / (kernelPi<T>() * integerPower(h, 6))
+			: Dimension == 2 ? T(10) / (kernelPi<T>() * integerPower(h, 5))
+			: T(2) / integerPower(h, 4);
+	}
+
+private:
+	T _radius;
+	T _normalization;
+};
+
+/*
+ * @brief cubic B-spline kernel on q = r / h, the usual choice of DFSPH and other implicit solvers
+ */
+template <typename T, int Dimension = 3>
+class CubicSplineKernel {
+	static_assert(Dimension >= 1 && Dimension <= 3, "kernels are defined for 1, 2 and 3 dimensions");
+
+public:
+	constexpr explicit CubicSplineKernel(T radius = T(1))
+		: _radius(radius), _inverseRadius(T(1) / radius), _normalization(normalization(radius)) {}
+
+	constexpr T radius() const { return _radius; }
+
+	constexpr T operator()(T distance) const {
+		T q = distance * _inverseRadius;
+		if (q >= T(1)) {
+			return T(0);
+		}
+		if (q <= T(0.5)) {
+			return _normalization * (T(6) * q * q * (q - T(1)) + T(1));
+		}
+		T x = T(1) - q;
+		return _normalization * T(2) * x * x * x;
+	}
+
+	constexpr T derivative(T distance) const {
+		T q = distance * _inverseRadius;
+		if (q >= T(1)) {
+			return T(0);
+		}
+		if (q <= T(0.5)) {
+			return _normalization * _inverseRadius * T(6) * q * (T(3) * q - T(2));
+		}
+		T x = T(1) - q;
+		return _normalization * _inverseRadius * T(-6) * x * x;
+	}
+
+	static constexpr T normalization(T h) {
+		return Dimension == 3 ? T(8) / (kernelPi<T>() * h * h * h)
+			: Dimension == 2 ? T(40) / (T(7) * kernelPi<T>() * h * h)
+			: T(4) / (T(3) * h);
+	}
+
+private:
+	T _radius;
+	T _inverseRadius;
+	T _normalization;
+};
+
+/*
+ * @brief Wendland C2 kernel, (1 - q)^4 (1 + 4q), free of the pairing instability at large neighbor counts
+ */
+template <typename T, int Dimension = 3>
+class WendlandKernel {
+	static_assert(Dimension >= 1 && Dimension <= 3, "kernels are defined for 1, 2 and 3 dimensions");
+
+public:
+	constexpr explicit WendlandKernel(T radius = T(1))
+		: _radius(radius), _inverseRadius(T(1) / radius), _normalization(normalization(radius)) {}
+
+	constexpr T radius() const { return _radius; }
+
+	constexpr T operator()(T distance) const {
+		T q = distance * _inverseRadius;
+		if (q >= T(1)) {
+			return T(0);
+		}
+		T x = T(1) - q;
+		return _normalization * x * x * x * x * (T(1) + T(4) * q);
+	}
+
+	constexpr T derivative(T distance) const {
+		T q = distance * _inverseRadius;
+		if (q >= T(1)) {
+			return T(0);
+		}
+		T x = T(1) - q;
+		return _normalization * _inverseRadius * T(-20) * q * x * x * x;
+	}
+
+	static constexpr T normalization(T h) {
+		return Dimension == 3 ? T(21) / (T(2) * kernelPi<T>() * h * h * h)
+			: Dimension == 2 ? T(7) / (kernelPi<T>() * h * h)
+			: T(3) / (T(2) * h);
+	}
+
+private:
+	T _radius;
+	T _inverseRadius;
+	T _normalization;
+};
+
+/*
+ * @brief a kernel sampled uniformly on s = r^2 / h^2 and interpolated linearly, so neither the value
+ * nor the gradient needs a square root or the polynomial in the inner loop. The gradient is
+ * derivativeOverDistance times the vector between the particles.
+ */
+template <typename Kernel, size_t Samples = 1024, typename T = float>
+class TabulatedKernel {
+public:
+	TabulatedKernel() = default;
+
+	explicit TabulatedKernel(const Kernel& kernel) { tabulate(kernel); }
+
+	void tabulate(const Kernel& kernel) {
+		_radius = static_cast<T>(kernel.radius());
+		_scale = T(Samples) / (_radius * _radius);
+		for (size_t i = 0; i <= Samples; i++) {
+			T distance = _radius * std::sqrt(T(i) / T(Samples));
+			_values[i] = static_cast<T>(kernel(distance));
+			// dW/dr / r diverges at the center for kernels with a cusp, sample half a step out instead
+			T sampled = i > 0 ? distance : _radius * std::sqrt(T(0.5) / T(Samples));
+			_derivativesOverDistance[i] = static_cast<T>(kernel.derivative(sampled)) / sampled;
+		}
+		_values[Samples] = T(0);
+		_derivativesOverDistance[Samples] = T(0);
+	}
+
+	T radius() const { return _radius; }
+
+	T operator()(T distanceSquared) const { return interpolate(_values, distanceSquared); }
+
+	T derivativeOverDistance(T distanceSquared) const { return interpolate(_derivativesOverDistance, distanceSquared); }
+
+private:
+	T interpolate(const std::array<T, Samples + 1>& table, T distanceSquared) const {
+		T u = distanceSquared * _scale;
+		if (u >= T(Samples)) {
+			return T(0);
+		}
+		size_t i = static_cast<size_t>(u);
+		T w = u - static_cast<T>(i);
+		return table[i] + w * (table[i + 1] - table[i]);
+	}
+
+	T _radius = T(0);
+	T _scale = T(0);
+	std::array<T, Samples + 1> _values{};
+	std::array<T, Samples + 1> _derivativesOverDistance{};
+};
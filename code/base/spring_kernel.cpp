@@ -0,0 +1,207 @@
+#include <cmath>
+#include <stdexcept>
+
+#include "spring_kernel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPRING_KERNEL_SSE2
+#include <emmintrin.h>
+#endif
+
+// the wider kernels are compiled for their own instruction set whatever the
+// build targets and only called when detectSimdLevel found it
+#if defined(_MSC_VER) && !defined(__clang__) && (defined(_M_X64) || defined(_M_IX86))
+#define SPRING_KERNEL_AVX
+#define SPRING_KERNEL_TARGET(isa)
+#include <immintrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SPRING_KERNEL_AVX
+#define SPRING_KERNEL_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#endif
+
+namespace {
+
+struct SpringArrays {
+	const uint32_t* first;
+	const uint32_t* second;
+	VectorChannelView<const float> positions;
+	VectorChannelView<const float> velocities;
+	VectorChannelView<float> forces;
+	SpringKernelParameters parameters;
+};
+
+void evaluateScalar(const SpringArrays& s, size_t begin, size_t end) {
+	const SpringKernelParameters& p = s.parameters;
+	for (size_t k = begin; k < end; k++) {
+		const uint32_t i = s.first[k], j = s.second[k];
+		const float rx = s.positions.x[i] - s.positions.x[j];
+		const float ry = s.positions.y[i] - s.positions.y[j];
+		const float rz = s.positions.z[i] - s.positions.z[j];
+		const float squaredLength = rx * rx + ry * ry + rz * rz;
+		// -k (l - L) r / l
+		const float coefficient = squaredLength > 0.0f ?
+			p.stiffness * (p.restLength / std::sqrt(squaredLength) - 1.0f) : 0.0f;
+		s.forces.x[k] = coefficient * rx - p.damping * (s.velocities.x[i] - s.velocities.x[j]);
+		s.forces.y[k] = coefficient * ry - p.damping * (s.velocities.y[i] - s.velocities.y[j]);
+		s.forces.z[k] = coefficient * rz - p.damping * (s.velocities.z[i] - s.velocities.z[j]);
+	}
+}
+
+#ifdef SPRING_KERNEL_SSE2
+/*
+ * @brief springs in groups of 4, SSE2 has no gather so the lanes are loaded one by one,
+ * returns how many springs were done
+ */
+size_t evaluateSse2(const SpringArrays& s, size_t count) {
+	const SpringKernelParameters& p = s.parameters;
+	const __m128 stiffness = _mm_set1_ps(p.stiffness);
+	const __m128 restLength = _mm_set1_ps(p.restLength);
+	const __m128 damping = _mm_set1_ps(p.damping);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 threeHalves = _mm_set1_ps(1.5f);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const size_t end = count & ~size_t(3);
+	for (size_t k = 0; k < end; k += 4) {
+		const uint32_t* i = s.first + k;
+		const uint32_t* j = s.second + k;
+		auto difference = [i, j](const float* channel) {
+			return _mm_sub_ps(_mm_setr_ps(channel[i[0]], channel[i[1]], channel[i[2]], channel[i[3]]),
+				_mm_setr_ps(channel[j[0]], channel[j[1]], channel[j[2]], channel[j[3]]));
+		};
+		const __m128 rx = difference(s.positions.x);
+		const __m128 ry = difference(s.positions.y);
+		const __m128 rz = difference(s.positions.z);
+		const __m128 squaredLength = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_mul_ps(rz, rz));
+		// 12 bit estimate, one Newton step brings it to about 22 bits
+		__m128 inverse = _mm_rsqrt_ps(squaredLength);
+		inverse = _mm_mul_ps(inverse, _mm_sub_ps(threeHalves,
+			_mm_mul_ps(_mm_mul_ps(half, squaredLength), _mm_mul_ps(inverse, inverse))));
+		// a zero length gives an infinite or NaN coefficient, the mask clears it
+		__m128 coefficient = _mm_mul_ps(stiffness, _mm_sub_ps(_mm_mul_ps(restLength, inverse), one));
+		coefficient = _mm_and_ps(coefficient, _mm_cmpgt_ps(squaredLength, _mm_setzero_ps()));
+		_mm_storeu_ps(s.forces.x + k, _mm_sub_ps(_mm_mul_ps(coefficient, rx), _mm_mul_ps(damping, difference(s.velocities.x))));
+		_mm_storeu_ps(s.forces.y + k, _mm_sub_ps(_mm_mul_ps(coefficient, ry), _mm_mul_ps(damping, difference(s.velocities.y))));
+		_mm_storeu_ps(s.forces.z + k, _mm_sub_ps(_mm_mul_ps(coefficient, rz), _mm_mul_ps(damping, difference(s.velocities.z))));
+	}
+	return end;
+}
+#endif
+
+#ifdef SPRING_KERNEL_AVX
+/*
+ * @brief masked gathers with a zeroed source, the plain intrinsics leave the source
+ * undefined and GCC warns that it may be used uninitialized. The AVX-512 kernel
+ * takes its rsqrt14 zero masked for the same reason.
+ */
+SPRING_KERNEL_TARGET("avx2")
+inline __m256 gather8(const float* base, __m256i index) {
+	return _mm256_mask_i32gather_ps(_mm256_setzero_ps(), base, index, _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 4);
+}
+
+SPRING_KERNEL_TARGET("avx512f")
+inline __m512 gather16(const float* base, __m512i index) {
+	return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, index, base, 4);
+}
+
+/*
+ * @brief springs in groups of 8 with hardware gathers, returns how many springs were done
+ */
+SPRING_KERNEL_TARGET("avx2")
+size_t evaluateAvx2(const SpringArrays& s, size_t count) {
+	const SpringKernelParameters& p = s.parameters;
+	const __m256 stiffness = _mm256_set1_ps(p.stiffness);
+	const __m256 restLength = _mm256_set1_ps(p.restLength);
+	const __m256 damping = _mm256_set1_ps(p.damping);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 threeHalves = _mm256_set1_ps(1.5f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const size_t end = count & ~size_t(7);
+	for (size_t k = 0; k < end; k += 8) {
+		const __m256i i = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s.first + k));
+		const __m256i j = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s.second + k));
+		const __m256 rx = _mm256_sub_ps(gather8(s.positions.x, i), gather8(s.positions.x, j));
+		const __m256 ry = _mm256_sub_ps(gather8(s.positions.y, i), gather8(s.positions.y, j));
+		const __m256 rz = _mm256_sub_ps(gather8(s.positions.z, i), gather8(s.positions.z, j));
+		const __m256 squaredLength = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rx, rx), _mm256_mul_ps(ry, ry)),
+			_mm256_mul_ps(rz, rz));
+		__m256 inverse = _mm256_rsqrt_ps(squaredLength);
+		inverse = _mm256_mul_ps(inverse, _mm256_sub_ps(threeHalves,
+			_mm256_mul_ps(_mm256_mul_ps(half, squaredLength), _mm256_mul_ps(inverse, inverse))));
+		__m256 coefficient = _mm256_mul_ps(stiffness, _mm256_sub_ps(_mm256_mul_ps(restLength, inverse), one));
+		coefficient = _mm256_and_ps(coefficient, _mm256_cmp_ps(squaredLength, _mm256_setzero_ps(), _CMP_GT_OQ));
+		const __m256 vx = _mm256_sub_ps(gather8(s.velocities.x, i), gather8(s.velocities.x, j));
+		const __m256 vy = _mm256_sub_ps(gather8(s.velocities.y, i), gather8(s.velocities.y, j));
+		const __m256 vz = _mm256_sub_ps(gather8(s.velocities.z, i), gather8(s.velocities.z, j));
+		_mm256_storeu_ps(s.forces.x + k, _mm256_sub_ps(_mm256_mul_ps(coefficient, rx), _mm256_mul_ps(damping, vx)));
+		_mm256_storeu_ps(s.forces.y + k, _mm256_sub_ps(_mm256_mul_ps(coefficient, ry), _mm256_mul_ps(damping, vy)));
+		_mm256_storeu_ps(s.forces.z + k, _mm256_sub_ps(_mm256_mul_ps(coefficient, rz), _mm256_mul_ps(damping, vz)));
+	}
+	return end;
+}
+
+/*
+ * @brief springs in groups of 16, rsqrt14 is accurate enough that the Newton step
+ * reaches full single precision
+ */
+SPRING_KERNEL_TARGET("avx512f")
+size_t evaluateAvx512(const SpringArrays& s, size_t count) {
+	const SpringKernelParameters& p = s.parameters;
+	const __m512 stiffness = _mm512_set1_ps(p.stiffness);
+	const __m512 restLength = _mm512_set1_ps(p.restLength);
+	const __m512 damping = _mm512_set1_ps(p.damping);
+	const __m512 half = _mm512_set1_ps(0.5f);
+	const __m512 threeHalves = _mm512_set1_ps(1.5f);
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const size_t end = count & ~size_t(15);
+	for (size_t k = 0; k < end; k += 16) {
+		const __m512i i = _mm512_loadu_si512(s.first + k);
+		const __m512i j = _mm512_loadu_si512(s.second + k);
+		const __m512 rx = _mm512_sub_ps(gather16(s.positions.x, i), gather16(s.positions.x, j));
+		const __m512 ry = _mm512_sub_ps(gather16(s.positions.y, i), gather16(s.positions.y, j));
+		const __m512 rz = _mm512_sub_ps(gather16(s.positions.z, i), gather16(s.positions.z, j));
+		const __m512 squaredLength = _mm512_fmadd_ps(rz, rz, _mm512_fmadd_ps(ry, ry, _mm512_mul_ps(rx, rx)));
+		__m512 inverse = _mm512_maskz_rsqrt14_ps(0xFFFF, squaredLength);
+		inverse = _mm512_mul_ps(inverse, _mm512_fnmadd_ps(_mm512_mul_ps(half, squaredLength),
+			_mm512_mul_ps(inverse, inverse), threeHalves));
+		const __mmask16 nonZero = _mm512_cmp_ps_mask(squaredLength, _mm512_setzero_ps(), _CMP_GT_OQ);
+		const __m512 coefficient = _mm512_maskz_mul_ps(nonZero, stiffness, _mm512_fmsub_ps(restLength, inverse, one));
+		const __m512 vx = _mm512_sub_ps(gather16(s.velocities.x, i), gather16(s.velocities.x, j));
+		const __m512 vy = _mm512_sub_ps(gather16(s.velocities.y, i), gather16(s.velocities.y, j));
+		const __m512 vz = _mm512_sub_ps(gather16(s.velocities.z, i), gather16(s.velocities.z, j));
+		_mm512_storeu_ps(s.forces.x + k, _mm512_fnmadd_ps(damping, vx, _mm512_mul_ps(coefficient, rx)));
+		_mm512_storeu_ps(s.forces.y + k, _mm512_fnmadd_ps(damping, vy, _mm512_mul_ps(coefficient, ry)));
+		_mm512_storeu_ps(s.forces.z + k, _mm512_fnmadd_ps(damping, vz, _mm512_mul_ps(coefficient, rz)));
+	}
+	return end;
+}
+#endif
+
+}
+
+void evaluateSpringForces(Span<const uint32_t> first, Span<const uint32_t> second,
+	VectorChannelView<const float> positions, VectorChannelView<const float> velocities,
+	const SpringKernelParameters& parameters, VectorChannelView<float> forces, SimdLevel level) {
+	const size_t count = first.size();
+	if (second.size() != count || forces.size != count) {
+		throw std::invalid_argument("spring arrays differ in size");
+	}
+	const SpringArrays springs{first.data(), second.data(), positions, velocities, forces, parameters};
+	size_t done = 0;
+#ifdef SPRING_KERNEL_AVX
+	if (level == SimdLevel::AVX512) {
+		done = evaluateAvx512(springs, count);
+	} else if (level == SimdLevel::AVX2) {
+		done = evaluateAvx2(springs, count);
+	}
+#endif
+#ifdef SPRING_KERNEL_SSE2
+	if (level != SimdLevel::Scalar) {
+		// the tail of the wider kernels, or everything at SSE2
+		const SpringArrays rest{first.data() + done, second.data() + done, positions, velocities,
+			forces.subview(done, count - done), parameters};
+		done += evaluateSse2(rest, count - done);
+	}
+#endif
+	evaluateScalar(springs, done, count);
+}
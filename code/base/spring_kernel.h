@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+#include "cpu_features.h"
+#include "particle_system_data.h"
+#include "span.h"
+
+/*
+ * linear springs with relative velocity damping, all sharing one stiffness,
+ * rest length and damping coefficient
+ */
+struct SpringKernelParameters {
+	float stiffness = 0.0f;
+	float restLength = 0.0f;
+	float damping = 0.0f;
+};
+
+/*
+ * @brief force of spring k on particle first[k], particle second[k] gets its negative.
+ * Endpoints are gathered from the structure of arrays positions and velocities and the
+ * forces are stored the same way, one entry per spring. Runs 16, 8 or 4 springs at a time
+ * with AVX-512, AVX2 or SSE2 up to level, the inverse length comes from rsqrt and one
+ * Newton step. Springs of zero length only damp.
+ */
+void evaluateSpringForces(Span<const uint32_t> first, Span<const uint32_t> second,
+	VectorChannelView<const float> positions, VectorChannelView<const float> velocities,
+	const SpringKernelParameters& parameters, VectorChannelView<float> forces, SimdLevel level = detectSimdLevel());
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+#include "thread_pool.h"
+
+namespace {
+
+/* chunks of one parallel call, shared with helpers that may start after it returned */
+struct ParallelJob {
+	std::function<void(size_t)> chunk;
+	size_t numberOfChunks = 0;
+	std::atomic<size_t> next{0};
+	std::atomic<size_t> finished{0};
+	std::mutex mutex;
+	std::condition_variable done;
+	std::exception_ptr error;
+
+	void work() {
+		size_t i;
+		while ((i = next.fetch_add(1)) < numberOfChunks) {
+			try {
+				chunk(i);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!error) {
+					error = std::current_exception();
+				}
+			}
+			if (finished.fetch_add(1) + 1 == numberOfChunks) {
+				std::lock_guard<std::mutex> lock(mutex);
+				done.notify_all();
+			}
+		}
+	}
+
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return finished.load() == numberOfChunks; });
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+};
+
+}
+
+ThreadPool::ThreadPool(unsigned int numberOfThreads) {
+	if (numberOfThreads == 0) {
+		numberOfThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	for (unsigned int i = 1; i < numberOfThreads; ++i) {
+		_workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+	}
+	_wakeup.notify_all();
+	for (auto& worker : _workers) {
+		worker.join();
+	}
+}
+
+ThreadPool& ThreadPool::global() {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::enqueue(std::function<void()> task, size_t copies) {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for (size_t i = 0; i < copies; ++i) {
+			_queue.push_back(task);
+		}
+	}
+	if (copies == 1) {
+		_wakeup.notify_one();
+	} else {
+		_wakeup.notify_all();
+	}
+}
+
+void ThreadPool::workerLoop() {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wakeup.wait(lock, [this] { return _quit || !_queue.empty(); });
+			if (_queue.empty()) {
+				return;
+			}
+			task = std::move(_queue.front());
+			_queue.pop_front();
+		}
+		task();
+	}
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, const std::function<void(size_t, size_t)>& body,
+	size_t grainSize) {
+	if (end <= begin) {
+		return;
+	}
+	grainSize = std::max<size_t>(1, grainSize);
+	size_t count = end - begin;
+	// a few chunks per thread balance uneven work without much scheduling overhead
+	size_t numberOfChunks = std::min((count + grainSize - 1) / grainSize, size_t(size()) * 4);
+	if (numberOfChunks <= 1 || _workers.empty()) {
+		body(begin, end);
+		return;
+	}
+
+	size_t chunkSize = (count + numberOfChunks - 1) / numberOfChunks;
+	numberOfChunks = (count + chunkSize - 1) / chunkSize;
+	auto job = std::make_shared<ParallelJob>();
+	job->numberOfChunks = numberOfChunks;
+	job->chunk = [&body, begin, end, chunkSize](size_t i) {
+		size_t first = begin + i * chunkSize;
+		body(first, std::min(end, first + chunkSize));
+	};
+
+	enqueue([job] { job->work(); }, std::min(numberOfChunks - 1, _workers.size()));
+	job->work();
+	job->wait();
+}
+
+void ThreadPool::run(const std::vector<std::function<void()>>& tasks) {
+	parallelFor(0, tasks.size(), [&tasks](size_t first, size_t last) {
+		for (size_t i = first; i < last; ++i) {
+			tasks[i]();
+		}
+	}, 1);
+}
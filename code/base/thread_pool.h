@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed set of worker threads. The calling thread always takes part in the
+ * work it submits, so nested parallel calls from inside a task can't deadlock.
+ */
+class ThreadPool {
+public:
+	/*
+	 * @brief numberOfThreads includes the calling thread, 0 picks the hardware concurrency
+	 */
+	explicit ThreadPool(unsigned int numberOfThreads = 0);
+
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/*
+	 * @brief pool shared by the solvers
+	 */
+	static ThreadPool& global();
+
+	/*
+	 * @brief threads available to a parallel call, including the caller
+	 */
+	unsigned int size() const { return static_cast<unsigned int>(_workers.size()) + 1; }
+
+	/*
+	 * @brief run body(begin, end) over chunks of [begin, end) and wait for all of them
+	 */
+	void parallelFor(size_t begin, size_t end, const std::function<void(size_t, size_t)>& body,
+		size_t grainSize = 1024);
+
+	/*
+	 * @brief run independent tasks concurrently and wait for all of them
+	 */
+	void run(const std::vector<std::function<void()>>& tasks);
+
+private:
+	std::vector<std::thread> _workers;
+	std::deque<std::function<void()>> _queue;
+	std::mutex _mutex;
+	std::condition_variable _wakeup;
+	bool _quit = false;
+
+	void enqueue(std::function<void()> task, size_t copies);
+
+	void workerLoop();
+};
+
+/*
+ * @brief parallelFor on the global pool
+ */
+inline void parallelFor(size_t begin, size_t end, const std::function<void(size_t, size_t)>& body,
+	size_t grainSize = 1024) {
+	ThreadPool::global().parallelFor(begin, end, body, grainSize);
+}
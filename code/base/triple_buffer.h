@@ -0,0 +1,50 @@
+#ifndef _TRIPLE_BUFFER_H_
+#define _TRIPLE_BUFFER_H_
+
+#include <atomic>
+#include <cstdint>
+
+/*
+ * Lock-free single producer / single consumer triple buffer.
+ * The producer fills writeBuffer() and publishes it, the consumer fetches the
+ * most recently published buffer. Neither side ever waits on the other, a
+ * consumer that falls behind simply skips the intermediate states.
+ */
+template <typename T>
+class TripleBuffer
+{
+public:
+    /* producer side */
+    T &writeBuffer() { return _buffers[_writeIndex]; }
+
+    void publish()
+    {
+        uint8_t previous = _middle.exchange(_writeIndex | kFreshBit, std::memory_order_acq_rel);
+        _writeIndex = previous & kIndexMask;
+    }
+
+    /* consumer side, returns true if a newer buffer was picked up */
+    bool fetch()
+    {
+        if ((_middle.load(std::memory_order_relaxed) & kFreshBit) == 0)
+        {
+            return false;
+        }
+        uint8_t previous = _middle.exchange(_readIndex, std::memory_order_acq_rel);
+        _readIndex = previous & kIndexMask;
+        return true;
+    }
+
+    const T &readBuffer() const { return _buffers[_readIndex]; }
+
+private:
+    static constexpr uint8_t kIndexMask = 0x3;
+    static constexpr uint8_t kFreshBit = 0x4;
+
+    T _buffers[3];
+    // index of the buffer in the middle slot, plus a flag telling it has not been fetched yet
+    alignas(64) std::atomic<uint8_t> _middle{1};
+    alignas(64) uint8_t _writeIndex = 0;
+    alignas(64) uint8_t _readIndex = 2;
+};
+#endif
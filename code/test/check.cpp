@@ -0,0 +1,1018 @@
+#include "animation_stages.h"
+#include "block_tridiagonal.h"
+#include "checkpoint.h"
+#include "dfsph_solver.h"
+#include "grid3.h"
+#include "mass_spring_animation.h"
+#include "particle_cache_reader.h"
+#include "point_neighbor_searcher.h"
+#include "radix_sort.h"
+#include "sparse_cholesky.h"
+#include "sparse_grid3.h"
+#include "spring_kernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* compares the numeric kernels against brute force or dense references, returns nonzero on a mismatch */
+
+static int failures = 0;
+
+static void expect(bool condition, const std::string &message)
+{
+    if (!condition)
+    {
+        std::printf("  FAILED: %s\n", message.c_str());
+        failures++;
+    }
+}
+
+static std::vector<glm::vec3> randomPoints(size_t count, float extent, std::mt19937 &random)
+{
+    // negative coordinates too, cells on both sides of the origin hash differently
+    std::uniform_real_distribution<float> coordinate(-extent, extent);
+    std::vector<glm::vec3> points(count);
+    for (glm::vec3 &p : points)
+    {
+        p = glm::vec3(coordinate(random), coordinate(random), coordinate(random));
+    }
+    return points;
+}
+
+static NeighborLists bruteForceNeighbors(const std::vector<glm::vec3> &points, float radius, bool includeSelf)
+{
+    NeighborLists lists;
+    lists.offsets.push_back(0);
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        for (size_t j = 0; j < points.size(); j++)
+        {
+            glm::vec3 d = points[j] - points[i];
+            if ((includeSelf || i != j) && glm::dot(d, d) <= radius * radius)
+            {
+                lists.indices.push_back(static_cast<uint32_t>(j));
+            }
+        }
+        lists.offsets.push_back(static_cast<uint32_t>(lists.indices.size()));
+    }
+    return lists;
+}
+
+static std::vector<uint32_t> sortedNeighbors(const NeighborLists &lists, size_t i)
+{
+    Span<const uint32_t> neighbors = lists.neighbors(i);
+    std::vector<uint32_t> sorted(neighbors.begin(), neighbors.end());
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+}
+
+/* x = A^-1 b by Gaussian elimination with partial pivoting, A is n x n row major */
+static std::vector<double> denseSolve(std::vector<double> a, std::vector<double> b)
+{
+    const size_t n = b.size();
+    for (size_t k = 0; k < n; k++)
+    {
+        size_t pivot = k;
+        for (size_t i = k + 1; i < n; i++)
+        {
+            if (std::abs(a[i * n + k]) > std::abs(a[pivot * n + k]))
+            {
+                pivot = i;
+            }
+        }
+        for (size_t j = 0; j < n; j++)
+        {
+            std::swap(a[k * n + j], a[pivot * n + j]);
+        }
+        std::swap(b[k], b[pivot]);
+        for (size_t i = k + 1; i < n; i++)
+        {
+            double factor = a[i * n + k] / a[k * n + k];
+            for (size_t j = k; j < n; j++)
+            {
+                a[i * n + j] -= factor * a[k * n + j];
+            }
+            b[i] -= factor * b[k];
+        }
+    }
+    for (size_t k = n; k-- > 0;)
+    {
+        for (size_t j = k + 1; j < n; j++)
+        {
+            b[k] -= a[k * n + j] * b[j];
+        }
+        b[k] /= a[k * n + k];
+    }
+    return b;
+}
+
+static double relativeError(const std::vector<double> &x, const std::vector<double> &expected)
+{
+    double error = 0.0;
+    double norm = 0.0;
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        error = std::max(error, std::abs(x[i] - expected[i]));
+        norm = std::max(norm, std::abs(expected[i]));
+    }
+    return norm > 0.0 ? error / norm : error;
+}
+
+static void checkRadixSort()
+{
+    std::mt19937 random(1);
+    // sizes around the serial cutoff and keys that only differ in the high digits
+    for (size_t count : {0u, 1u, 1000u, 100000u})
+    {
+        for (uint32_t keyMask : {0xffffffffu, 0xff000000u, 0x0000000fu})
+        {
+            std::vector<uint32_t> keys(count);
+            for (uint32_t &key : keys)
+            {
+                key = random() & keyMask;
+            }
+            std::vector<uint32_t> values(count);
+            std::iota(values.begin(), values.end(), 0u);
+
+            std::vector<std::pair<uint32_t, uint32_t>> expected(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                expected[i] = std::make_pair(keys[i], values[i]);
+            }
+            std::stable_sort(expected.begin(), expected.end(),
+                             [](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b) {
+                                 return a.first < b.first;
+                             });
+
+            parallelRadixSort(keys, values);
+            bool same = keys.size() == count && values.size() == count;
+            for (size_t i = 0; same && i < count; i++)
+            {
+                same = keys[i] == expected[i].first && values[i] == expected[i].second;
+            }
+            expect(same, "radix sort of " + std::to_string(count) + " keys differs from std::stable_sort");
+        }
+    }
+}
+
+static void checkNeighborSearch()
+{
+    std::mt19937 random(2);
+    for (float spacing : {0.1f, 0.25f, 1.0f})
+    {
+        std::vector<glm::vec3> points = randomPoints(2000, 1.0f, random);
+        const float radius = 0.15f;
+        PointNeighborSearcher searcher(spacing);
+        searcher.build(points);
+        for (bool includeSelf : {false, true})
+        {
+            NeighborLists lists;
+            searcher.buildNeighborLists(radius, lists, includeSelf);
+            NeighborLists expected = bruteForceNeighbors(points, radius, includeSelf);
+            bool same = lists.numberOfPoints() == points.size();
+            for (size_t i = 0; same && i < points.size(); i++)
+            {
+                same = sortedNeighbors(lists, i) == sortedNeighbors(expected, i);
+            }
+            expect(same, "hash grid neighbor lists with spacing " + std::to_string(spacing) + " differ from brute force");
+        }
+
+        // a large radius visits more cells than the bucket tracking covers
+        for (float queryRadius : {radius, 4.0f * spacing})
+        {
+            bool same = true;
+            for (size_t i = 0; same && i < points.size(); i += 37)
+            {
+                std::vector<uint32_t> found;
+                searcher.forEachNearbyPoint(points[i], queryRadius, [&](size_t j, const glm::vec3 &) {
+                    found.push_back(static_cast<uint32_t>(j));
+                });
+                std::sort(found.begin(), found.end());
+                std::vector<uint32_t> expected;
+                for (size_t j = 0; j < points.size(); j++)
+                {
+                    glm::vec3 d = points[j] - points[i];
+                    if (glm::dot(d, d) <= queryRadius * queryRadius)
+                    {
+                        expected.push_back(static_cast<uint32_t>(j));
+                    }
+                }
+                same = found == expected;
+            }
+            expect(same, "forEachNearbyPoint with radius " + std::to_string(queryRadius) + " differs from brute force");
+        }
+    }
+}
+
+static void checkVerletNeighborLists()
+{
+    std::mt19937 random(3);
+    std::vector<glm::vec3> points = randomPoints(2000, 1.0f, random);
+    const float radius = 0.15f;
+    const float skin = 0.05f;
+    VerletNeighborLists verlet(radius, skin);
+    expect(verlet.update(points), "first Verlet list update did not build");
+
+    // random walk, the lists must hold every pair within the radius whether or not they were rebuilt
+    std::uniform_real_distribution<float> step(-0.004f, 0.004f);
+    unsigned long long rebuilds = verlet.numberOfRebuilds();
+    bool superset = true;
+    for (int s = 0; s < 40; s++)
+    {
+        for (glm::vec3 &p : points)
+        {
+            p += glm::vec3(step(random), step(random), step(random));
+        }
+        verlet.update(points);
+        NeighborLists expected = bruteForceNeighbors(points, radius, false);
+        for (size_t i = 0; superset && i < points.size(); i++)
+        {
+            std::vector<uint32_t> listed = sortedNeighbors(verlet.lists(), i);
+            std::vector<uint32_t> needed = sortedNeighbors(expected, i);
+            superset = std::includes(listed.begin(), listed.end(), needed.begin(), needed.end());
+        }
+    }
+    expect(superset, "Verlet lists miss a pair within the search radius");
+    unsigned long long walkRebuilds = verlet.numberOfRebuilds() - rebuilds;
+    expect(walkRebuilds > 0 && walkRebuilds < 40, "Verlet lists rebuilt " + std::to_string(walkRebuilds) +
+                                                       " times in 40 small steps");
+
+    // a changed point count must rebuild even without motion
+    points.resize(1500);
+    expect(verlet.update(points) && verlet.lists().numberOfPoints() == points.size(),
+           "Verlet lists were not rebuilt after the point count changed");
+    verlet.invalidate();
+    expect(verlet.update(points), "Verlet lists were not rebuilt after invalidate");
+}
+
+static void checkBlockTridiagonal()
+{
+    std::mt19937 random(4);
+    std::uniform_real_distribution<float> entry(-1.0f, 1.0f);
+    auto randomBlock = [&]() {
+        glm::mat3 m;
+        for (int c = 0; c < 3; c++)
+        {
+            for (int r = 0; r < 3; r++)
+            {
+                m[c][r] = entry(random);
+            }
+        }
+        return m;
+    };
+    for (size_t n : {1u, 2u, 50u})
+    {
+        // block diagonally dominant but not symmetric, so swapped or transposed
+        // off-diagonal blocks show up
+        std::vector<glm::mat3> lower(n, glm::mat3(0.0f));
+        std::vector<glm::mat3> diagonal(n);
+        std::vector<glm::mat3> upper(n, glm::mat3(0.0f));
+        for (size_t i = 0; i + 1 < n; i++)
+        {
+            upper[i] = randomBlock();
+            lower[i + 1] = randomBlock();
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            glm::mat3 m = randomBlock();
+            diagonal[i] = 0.5f * (m + glm::transpose(m)) + glm::mat3(8.0f);
+        }
+        std::vector<glm::vec3> values(n);
+        for (glm::vec3 &v : values)
+        {
+            v = glm::vec3(entry(random), entry(random), entry(random));
+        }
+
+        const size_t size = 3 * n;
+        std::vector<double> dense(size * size, 0.0);
+        std::vector<double> rhs(size);
+        for (size_t i = 0; i < n; i++)
+        {
+            for (int r = 0; r < 3; r++)
+            {
+                rhs[3 * i + r] = values[i][r];
+                for (int c = 0; c < 3; c++)
+                {
+                    dense[(3 * i + r) * size + 3 * i + c] = diagonal[i][c][r];
+                    if (i > 0)
+                    {
+                        dense[(3 * i + r) * size + 3 * (i - 1) + c] = lower[i][c][r];
+                    }
+                    if (i + 1 < n)
+                    {
+                        dense[(3 * i + r) * size + 3 * (i + 1) + c] = upper[i][c][r];
+                    }
+                }
+            }
+        }
+        std::vector<double> expected = denseSolve(dense, rhs);
+
+        solveBlockTridiagonal(lower, diagonal, upper, values);
+        std::vector<double> x(size);
+        for (size_t i = 0; i < n; i++)
+        {
+            for (int r = 0; r < 3; r++)
+            {
+                x[3 * i + r] = values[i][r];
+            }
+        }
+        double error = relativeError(x, expected);
+        expect(error < 1e-5, "block tridiagonal solve of " + std::to_string(n) + " blocks is off by " +
+                                 std::to_string(error) + " relative to a dense solve");
+    }
+}
+
+/* weighted graph Laplacian plus shift on the diagonal, symmetric positive definite for shift > 0 */
+static SparseMatrix laplacianMatrix(size_t n, const std::vector<std::pair<uint32_t, uint32_t>> &edges,
+                                    const std::vector<double> &weights, double shift)
+{
+    std::vector<std::vector<std::pair<uint32_t, double>>> rows(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        rows[i].push_back(std::make_pair(static_cast<uint32_t>(i), shift));
+    }
+    for (size_t e = 0; e < edges.size(); e++)
+    {
+        uint32_t a = edges[e].first;
+        uint32_t b = edges[e].second;
+        rows[a][0].second += weights[e];
+        rows[b][0].second += weights[e];
+        rows[a].push_back(std::make_pair(b, -weights[e]));
+        rows[b].push_back(std::make_pair(a, -weights[e]));
+    }
+    SparseMatrix matrix;
+    matrix.size = n;
+    matrix.offsets.push_back(0);
+    for (size_t i = 0; i < n; i++)
+    {
+        for (const std::pair<uint32_t, double> &entry : rows[i])
+        {
+            matrix.indices.push_back(entry.first);
+            matrix.values.push_back(entry.second);
+        }
+        matrix.offsets.push_back(static_cast<uint32_t>(matrix.indices.size()));
+    }
+    return matrix;
+}
+
+static void checkSparseCholesky()
+{
+    std::mt19937 random(5);
+    std::uniform_real_distribution<double> weight(0.5, 2.0);
+    std::uniform_real_distribution<double> entry(-1.0, 1.0);
+
+    // a cloth-like grid with a few long range edges, which create fill
+    const size_t side = 12;
+    const size_t n = side * side;
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    for (uint32_t y = 0; y < side; y++)
+    {
+        for (uint32_t x = 0; x < side; x++)
+        {
+            uint32_t i = y * side + x;
+            if (x + 1 < side)
+            {
+                edges.push_back(std::make_pair(i, i + 1));
+            }
+            if (y + 1 < side)
+            {
+                edges.push_back(std::make_pair(i, i + static_cast<uint32_t>(side)));
+            }
+        }
+    }
+    std::uniform_int_distribution<uint32_t> vertex(0, static_cast<uint32_t>(n - 1));
+    for (int k = 0; k < 10; k++)
+    {
+        uint32_t a = vertex(random);
+        uint32_t b = vertex(random);
+        if (a != b)
+        {
+            edges.push_back(std::make_pair(a, b));
+        }
+    }
+
+    std::vector<uint32_t> order = minimumDegreeOrdering(laplacianMatrix(n, edges, std::vector<double>(edges.size(), 1.0), 1.0));
+    std::vector<uint32_t> sortedOrder = order;
+    std::sort(sortedOrder.begin(), sortedOrder.end());
+    std::vector<uint32_t> identity(n);
+    std::iota(identity.begin(), identity.end(), 0u);
+    expect(sortedOrder == identity, "minimum degree ordering is not a permutation");
+
+    SparseCholesky cholesky;
+    const size_t columns = 3;
+    // the second round refactorizes new values on the first analysis
+    for (int round = 0; round < 2; round++)
+    {
+        std::vector<double> weights(edges.size());
+        for (double &w : weights)
+        {
+            w = weight(random);
+        }
+        SparseMatrix matrix = laplacianMatrix(n, edges, weights, 0.1 + round);
+        if (round == 0)
+        {
+            cholesky.analyze(matrix);
+        }
+        cholesky.factorize(matrix);
+
+        std::vector<double> values(n * columns);
+        for (double &v : values)
+        {
+            v = entry(random);
+        }
+        std::vector<double> dense(n * n, 0.0);
+        for (size_t i = 0; i < n; i++)
+        {
+            for (uint32_t p = matrix.offsets[i]; p < matrix.offsets[i + 1]; p++)
+            {
+                dense[i * n + matrix.indices[p]] += matrix.values[p];
+            }
+        }
+        std::vector<std::vector<double>> expected(columns);
+        for (size_t c = 0; c < columns; c++)
+        {
+            std::vector<double> rhs(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                rhs[i] = values[i * columns + c];
+            }
+            expected[c] = denseSolve(dense, rhs);
+        }
+
+        cholesky.solve(values, columns);
+        for (size_t c = 0; c < columns; c++)
+        {
+            std::vector<double> x(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                x[i] = values[i * columns + c];
+            }
+            double error = relativeError(x, expected[c]);
+            expect(error < 1e-9, "sparse Cholesky solve of column " + std::to_string(c) + " is off by " +
+                                     std::to_string(error) + " relative to a dense solve");
+        }
+    }
+
+    SparseMatrix indefinite = laplacianMatrix(n, edges, std::vector<double>(edges.size(), 1.0), -1.0);
+    bool threw = false;
+    try
+    {
+        cholesky.factorize(indefinite);
+    }
+    catch (std::runtime_error &)
+    {
+        threw = true;
+    }
+    expect(threw, "factorize accepted an indefinite matrix");
+
+    edges.pop_back();
+    SparseMatrix otherPattern = laplacianMatrix(n, edges, std::vector<double>(edges.size(), 1.0), 1.0);
+    threw = false;
+    try
+    {
+        cholesky.factorize(otherPattern);
+    }
+    catch (std::invalid_argument &)
+    {
+        threw = true;
+    }
+    expect(threw, "factorize accepted a matrix with another pattern");
+}
+
+/*
+ * The dam break of the headless scene. Before the front reaches the far wall no
+ * particle can be faster than free fall from the top of the column, sqrt(2 g H),
+ * and the fluid only loses energy. The wall impact throws a thin jet up the wall,
+ * allowed a little over twice that speed.
+ */
+static void checkSpringKernel()
+{
+    // random springs over a cloud of particles, a count that leaves a tail at every width,
+    // and a spring between coincident particles that only damps
+    std::mt19937 random(3);
+    const size_t n = 500, m = 1037;
+    std::vector<glm::vec3> points = randomPoints(n, 1.0f, random), speeds = randomPoints(n, 2.0f, random);
+    points[1] = points[0];
+    std::vector<float> x(n), y(n), z(n), vx(n), vy(n), vz(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        x[i] = points[i].x;
+        y[i] = points[i].y;
+        z[i] = points[i].z;
+        vx[i] = speeds[i].x;
+        vy[i] = speeds[i].y;
+        vz[i] = speeds[i].z;
+    }
+    std::uniform_int_distribution<uint32_t> particle(0, n - 1);
+    std::vector<uint32_t> first(m), second(m);
+    for (size_t k = 0; k < m; k++)
+    {
+        first[k] = particle(random);
+        second[k] = particle(random);
+    }
+    first[0] = 0;
+    second[0] = 1;
+    SpringKernelParameters parameters;
+    parameters.stiffness = 1000.0f;
+    parameters.restLength = 0.3f;
+    parameters.damping = 5.0f;
+    const VectorChannelView<const float> positions{x.data(), y.data(), z.data(), n};
+    const VectorChannelView<const float> velocities{vx.data(), vy.data(), vz.data(), n};
+
+    auto evaluate = [&](SimdLevel level) {
+        std::vector<glm::vec3> forces(m);
+        std::vector<float> fx(m), fy(m), fz(m);
+        evaluateSpringForces(Span<const uint32_t>(first), Span<const uint32_t>(second), positions, velocities,
+                             parameters, VectorChannelView<float>{fx.data(), fy.data(), fz.data(), m}, level);
+        for (size_t k = 0; k < m; k++)
+        {
+            forces[k] = glm::vec3(fx[k], fy[k], fz[k]);
+        }
+        return forces;
+    };
+    // the scalar path against the formula in double, the vector paths against the scalar one
+    const std::vector<glm::vec3> scalar = evaluate(SimdLevel::Scalar);
+    const double scale = parameters.stiffness * parameters.restLength;
+    double scalarError = 0.0;
+    for (size_t k = 0; k < m; k++)
+    {
+        glm::dvec3 r = glm::dvec3(points[second[k]]) - glm::dvec3(points[first[k]]);
+        glm::dvec3 v = glm::dvec3(speeds[second[k]]) - glm::dvec3(speeds[first[k]]);
+        double length = glm::length(r);
+        glm::dvec3 force = double(parameters.damping) * v;
+        if (length > 0.0)
+        {
+            force += double(parameters.stiffness) * (1.0 - parameters.restLength / length) * r;
+        }
+        scalarError = std::max(scalarError, glm::length(glm::dvec3(scalar[k]) - force) / scale);
+    }
+    expect(scalarError < 1e-5, "scalar spring kernel off by " + std::to_string(scalarError) + " of k L");
+    for (SimdLevel level = SimdLevel::SSE2; level <= detectSimdLevel();
+         level = static_cast<SimdLevel>(static_cast<int>(level) + 1))
+    {
+        const std::vector<glm::vec3> forces = evaluate(level);
+        double error = 0.0;
+        for (size_t k = 0; k < m; k++)
+        {
+            error = std::max(error, static_cast<double>(glm::length(forces[k] - scalar[k])) / scale);
+        }
+        expect(error < 1e-5, std::string(simdLevelName(level)) + " spring kernel differs from scalar by " +
+                                 std::to_string(error) + " of k L");
+    }
+}
+
+static void checkGrids()
+{
+    std::mt19937 random(11);
+    const glm::ivec3 resolution(12, 10, 9);
+    const glm::vec3 spacing(0.1f, 0.15f, 0.2f);
+    const glm::vec3 origin(-0.3f, 0.2f, 0.1f);
+    const glm::vec3 lower = origin + 0.5f * spacing;
+    const glm::vec3 upper = origin + (glm::vec3(resolution) - 0.5f) * spacing;
+    auto pointsIn = [&random](size_t count, const glm::vec3 &from, const glm::vec3 &to) {
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<glm::vec3> points(count);
+        for (glm::vec3 &x : points)
+        {
+            x = from + (to - from) * glm::vec3(unit(random), unit(random), unit(random));
+        }
+        return points;
+    };
+
+    // linear fields are reproduced exactly, Catmull-Rom needs a lattice point on each side
+    const glm::vec3 slope(0.7f, -1.3f, 2.1f);
+    auto linear = [&slope](const glm::vec3 &x) { return glm::dot(slope, x) + 0.25f; };
+    auto linearVector = [](const glm::vec3 &x) { return glm::vec3(x.y - 2.0f * x.z, 3.0f * x.x, x.x + x.y + x.z); };
+    ScalarGrid3 scalar(resolution, spacing, origin);
+    scalar.fill(linear);
+    VectorGrid3 vector(resolution, spacing, origin);
+    vector.fill(linearVector);
+    FaceCenteredGrid3 mac(resolution, spacing, origin);
+    mac.fill(linearVector);
+    double linearError = 0.0, cubicError = 0.0, vectorError = 0.0;
+    for (const glm::vec3 &x : pointsIn(2000, lower, upper))
+    {
+        linearError = std::max(linearError, std::abs(scalar.sample(x) - linear(x)));
+        vectorError = std::max(vectorError, static_cast<double>(glm::length(vector.sample(x) - linearVector(x))));
+    }
+    for (const glm::vec3 &x : pointsIn(2000, lower + spacing, upper - spacing))
+    {
+        cubicError = std::max(cubicError, static_cast<double>(std::abs(scalar.sampleCubic(x) - linear(x))));
+        cubicError = std::max(cubicError, static_cast<double>(glm::length(vector.sampleCubic(x) - linearVector(x))));
+    }
+    // faces reach half a cell beyond the cell centers along their own axis only
+    for (const glm::vec3 &x : pointsIn(2000, origin + 0.5f * spacing, origin + (glm::vec3(resolution) - 0.5f) * spacing))
+    {
+        vectorError = std::max(vectorError, static_cast<double>(glm::length(mac.sample(x) - linearVector(x))));
+    }
+    expect(linearError < 1e-5, "trilinear sample of a linear field off by " + std::to_string(linearError));
+    expect(cubicError < 1e-5, "Catmull-Rom sample of a linear field off by " + std::to_string(cubicError));
+    expect(vectorError < 1e-5, "vector sample of a linear field off by " + std::to_string(vectorError));
+
+    double stencilError = 0.0;
+    for (int k = 1; k < resolution.z - 1; k++)
+    {
+        for (int j = 1; j < resolution.y - 1; j++)
+        {
+            for (int i = 1; i < resolution.x - 1; i++)
+            {
+                stencilError = std::max(stencilError, static_cast<double>(glm::length(scalar.gradient(i, j, k) - slope)));
+                stencilError = std::max(stencilError, static_cast<double>(std::abs(scalar.laplacian(i, j, k))));
+                stencilError = std::max(stencilError, static_cast<double>(std::abs(vector.divergence(i, j, k) - 1.0f)));
+                stencilError = std::max(stencilError, static_cast<double>(glm::length(vector.curl(i, j, k) - glm::vec3(1.0f, -3.0f, 2.0f))));
+                stencilError = std::max(stencilError, static_cast<double>(std::abs(mac.divergence(i, j, k) - 1.0f)));
+            }
+        }
+    }
+    expect(stencilError < 1e-3, "difference stencils of a linear field off by " + std::to_string(stencilError));
+
+    // the SSE2 batch path against one point at a time, including points clamped to the border
+    // and a count that leaves a scalar tail
+    auto wave = [](const glm::vec3 &x) { return std::sin(3.0f * x.x) * std::cos(2.0f * x.y) + x.z; };
+    auto waveVector = [&wave](const glm::vec3 &x) { return glm::vec3(wave(x), wave(glm::vec3(x.y, x.z, x.x)), wave(glm::vec3(x.z, x.x, x.y))); };
+    scalar.fill(wave);
+    vector.fill(waveVector);
+    mac.fill(waveVector);
+    std::vector<glm::vec3> points = pointsIn(1003, origin - spacing, origin + (glm::vec3(resolution) + 1.0f) * spacing);
+    std::vector<float> px(points.size()), py(points.size()), pz(points.size());
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        px[i] = points[i].x;
+        py[i] = points[i].y;
+        pz[i] = points[i].z;
+    }
+    VectorChannelView<const float> view{px.data(), py.data(), pz.data(), points.size()};
+    std::vector<double> scalarValues(points.size());
+    scalar.sample(view, Span<double>(scalarValues));
+    std::vector<float> vx(points.size()), vy(points.size()), vz(points.size());
+    std::vector<float> mx(points.size()), my(points.size()), mz(points.size());
+    vector.sample(view, VectorChannelView<float>{vx.data(), vy.data(), vz.data(), points.size()});
+    mac.sample(view, VectorChannelView<float>{mx.data(), my.data(), mz.data(), points.size()});
+    double batchError = 0.0;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        batchError = std::max(batchError, std::abs(scalarValues[i] - scalar.sample(points[i])));
+        batchError = std::max(batchError, static_cast<double>(glm::length(glm::vec3(vx[i], vy[i], vz[i]) - vector.sample(points[i]))));
+        batchError = std::max(batchError, static_cast<double>(glm::length(glm::vec3(mx[i], my[i], mz[i]) - mac.sample(points[i]))));
+    }
+    expect(batchError < 3e-6, "batch samples differ from single samples by " + std::to_string(batchError));
+
+    // a field whose components don't vary along their own axis has no MAC divergence at all
+    mac.fill([](const glm::vec3 &x) {
+        return glm::vec3(std::sin(4.0f * x.y) + x.z, std::cos(3.0f * x.z) * x.x, x.x * x.y);
+    });
+    ScalarGrid3 divergence;
+    mac.divergence(divergence);
+    float maxDivergence = 0.0f;
+    for (int k = 0; k < resolution.z; k++)
+    {
+        for (int j = 0; j < resolution.y; j++)
+        {
+            for (int i = 0; i < resolution.x; i++)
+            {
+                maxDivergence = std::max(maxDivergence, std::abs(divergence(i, j, k)));
+            }
+        }
+    }
+    expect(maxDivergence == 0.0f, "MAC divergence of a divergence free field is " + std::to_string(maxDivergence));
+}
+
+static void checkSparseGrid()
+{
+    // a dense grid and a sparse one over the same voxels, the sparse indices run from -8 to 15,
+    // three blocks per axis, so the samples cross block borders and negative block coordinates
+    const int width = 24;
+    const float voxelSize = 0.1f;
+    const glm::vec3 origin(0.3f, -0.2f, 0.5f);
+    auto wave = [](const glm::vec3 &x) { return std::sin(3.0f * x.x) * std::cos(2.0f * x.y) + x.z; };
+    auto waveVector = [&wave](const glm::vec3 &x) {
+        return glm::vec3(wave(x), wave(glm::vec3(x.y, x.z, x.x)), -wave(glm::vec3(x.z, x.x, x.y)));
+    };
+    ScalarGrid3 dense(glm::ivec3(width), glm::vec3(voxelSize), origin);
+    dense.fill(wave);
+    VectorGrid3 denseVector(glm::ivec3(width), glm::vec3(voxelSize), origin);
+    denseVector.fill(waveVector);
+    const int shift = SparseGrid3<float>::kBlockWidth;
+    const glm::vec3 sparseOrigin = origin + glm::vec3(shift * voxelSize);
+    SparseScalarGrid3 sparse(voxelSize, sparseOrigin, 0.0f);
+    SparseVectorGrid3 sparseVector(voxelSize, sparseOrigin);
+    SparseGrid3<float>::Accessor accessor = sparse.grid().accessor();
+    SparseGrid3<glm::vec3>::Accessor vectorAccessor = sparseVector.grid().accessor();
+    for (int k = 0; k < width; k++)
+    {
+        for (int j = 0; j < width; j++)
+        {
+            for (int i = 0; i < width; i++)
+            {
+                accessor.setValue(i - shift, j - shift, k - shift, dense(i, j, k));
+                vectorAccessor.setValue(i - shift, j - shift, k - shift, denseVector(i, j, k));
+            }
+        }
+    }
+    expect(sparse.grid().numberOfBlocks() == 27, std::to_string(sparse.grid().numberOfBlocks()) + " blocks for 24^3 voxels");
+
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> inside(0.5f * voxelSize, (width - 0.5f) * voxelSize);
+    std::vector<glm::vec3> points(1000);
+    for (glm::vec3 &x : points)
+    {
+        x = origin + glm::vec3(inside(random), inside(random), inside(random));
+    }
+    std::vector<double> values(points.size());
+    std::vector<glm::vec3> vectorValues(points.size());
+    auto compare = [&](const std::string &when) {
+        sparse.sample(Span<const glm::vec3>(points), Span<double>(values));
+        sparseVector.sample(Span<const glm::vec3>(points), Span<glm::vec3>(vectorValues));
+        double error = 0.0;
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            error = std::max(error, std::abs(values[i] - dense.sample(points[i])));
+            error = std::max(error, std::abs(sparse.sample(points[i]) - dense.sample(points[i])));
+            error = std::max(error, static_cast<double>(glm::length(vectorValues[i] - denseVector.sample(points[i]))));
+        }
+        expect(error < 1e-5, "sparse samples " + when + " differ from dense ones by " + std::to_string(error));
+    };
+    compare("across block borders");
+
+    // blocks activated around far away points hold only the background and are pruned again
+    std::vector<float> farX{10.0f, -10.0f, 10.0f}, farY{10.0f, 10.0f, -10.0f}, farZ{0.0f, 0.0f, 0.0f};
+    sparse.grid().activate(VectorChannelView<const float>{farX.data(), farY.data(), farZ.data(), farX.size()}, voxelSize);
+    size_t activated = sparse.grid().numberOfBlocks() - 27;
+    expect(activated >= 3, "activate added " + std::to_string(activated) + " blocks around 3 points");
+    expect(sparse.grid().prune() == activated && sparse.grid().numberOfBlocks() == 27,
+           "pruning kept " + std::to_string(sparse.grid().numberOfBlocks()) + " blocks");
+    compare("after pruning");
+
+    // a grid back at the background everywhere releases its pages
+    size_t used = sparse.grid().memoryUsage();
+    sparse.grid().fill([](const glm::vec3 &) { return 0.0f; });
+    sparse.grid().prune();
+    size_t released = sparse.grid().memoryUsage();
+    expect(sparse.grid().numberOfBlocks() == 0 && released < used / 10,
+           "an empty sparse grid still holds " + std::to_string(released) + " of " + std::to_string(used) + " bytes");
+}
+
+static void checkDfsphDamBreak()
+{
+    DfsphSolver solver;
+    const float height = 0.5f;
+    solver.setTargetSpacing(height / 10);
+    solver.domainLower = glm::vec3(0.0f);
+    solver.domainUpper = glm::vec3(2.0f * height, 2.0f * height, height);
+    solver.addBlock(glm::vec3(0.0f), glm::vec3(height));
+    solver.setAdaptiveTimeStepping(true);
+    solver.setMaxSubstepsPerFrame(1u << 30);
+
+    auto measure = [&solver](float &peakSpeed) {
+        VectorChannelView<const float> x = solver.particles.positions();
+        VectorChannelView<const float> v = solver.particles.velocities();
+        double energy = 0.0;
+        for (size_t i = 0; i < x.size; i++)
+        {
+            glm::vec3 vi = v.get(i);
+            peakSpeed = std::max(peakSpeed, glm::length(vi));
+            energy += 0.5 * glm::dot(vi, vi) - glm::dot(solver.gravity, x.get(i));
+        }
+        return energy / x.size;
+    };
+
+    const float freeFall = std::sqrt(2.0f * glm::length(solver.gravity) * height);
+    float collapseSpeed = 0.0f;
+    float peakSpeed = 0.0f;
+    const double initialEnergy = measure(peakSpeed);
+    double maxEnergy = initialEnergy;
+    Frame frame(0, 1.0f / 60.0f);
+    for (int i = 0; i < 40; i++)
+    {
+        frame.advance();
+        solver.update(frame);
+        // the front takes about 0.2 s to cross the empty half of the box
+        maxEnergy = std::max(maxEnergy, measure(i < 12 ? collapseSpeed : peakSpeed));
+    }
+    peakSpeed = std::max(peakSpeed, collapseSpeed);
+    expect(collapseSpeed < 1.2f * freeFall, "DFSPH dam break reached " + std::to_string(collapseSpeed) +
+                                                " m/s while collapsing, free fall is " + std::to_string(freeFall));
+    expect(peakSpeed < 2.5f * freeFall, "DFSPH dam break reached " + std::to_string(peakSpeed) + " m/s");
+    expect(maxEnergy < initialEnergy + 0.01 * std::abs(initialEnergy),
+           "DFSPH dam break gained energy, " + std::to_string(initialEnergy) + " J/kg at rest, up to " +
+               std::to_string(maxEnergy));
+}
+
+static void checkFloorCollision()
+{
+    // the dam break with a jet, standing on a collision plane instead of the domain floor
+    DfsphSolver solver;
+    const float height = 0.5f;
+    const float floorHeight = 0.25f;
+    solver.setTargetSpacing(height / 8);
+    solver.domainLower = glm::vec3(0.0f);
+    solver.domainUpper = glm::vec3(2.0f * height, 2.0f * height + floorHeight, height);
+    solver.addBlock(glm::vec3(0.0f, floorHeight, 0.0f), glm::vec3(height, height + floorHeight, height));
+    solver.setAdaptiveTimeStepping(true);
+    solver.setMaxSubstepsPerFrame(1u << 30);
+    size_t initialParticles = solver.particles.numberOfParticles();
+    solver.addStage(StagePhase::PreProcessing,
+                    std::make_shared<PointEmitterStage>(solver.particles, glm::vec3(1.5f * height, 1.5f * height + floorHeight, 0.5f * height),
+                                                        glm::vec3(0.0f, -2.0f, 0.0f), 4.0f / solver.targetSpacing,
+                                                        initialParticles + 30));
+    solver.addStage(StagePhase::PostProcessing, std::make_shared<PlaneCollisionStage>(solver.particles, floorHeight, 0.0f));
+
+    // runs after the collision, sees what a cache or the viewer would see
+    float lowest = floorHeight;
+    float fastest = 0.0f;
+    solver.addStage(StagePhase::PostProcessing, std::make_shared<FunctionStage>("measure", [&](const Frame &) {
+                        VectorChannelView<const float> x = solver.particles.positions();
+                        VectorChannelView<const float> v = solver.particles.velocities();
+                        for (size_t i = 0; i < x.size; i++)
+                        {
+                            lowest = std::min(lowest, x.y[i]);
+                            fastest = std::max(fastest, glm::length(v.get(i)));
+                        }
+                    }),
+                    1);
+
+    Frame frame(0, 1.0f / 60.0f);
+    // the column has collapsed onto the plane after about 0.3 s
+    for (int i = 0; i < 30; i++)
+    {
+        frame.advance();
+        solver.update(frame);
+    }
+    const float freeFall = std::sqrt(2.0f * glm::length(solver.gravity) * height);
+    expect(solver.particles.numberOfParticles() == initialParticles + 30,
+           "emitter added " + std::to_string(solver.particles.numberOfParticles() - initialParticles) + " of 30 particles");
+    expect(lowest >= floorHeight, "a particle dropped to y = " + std::to_string(lowest) + ", the floor is at " +
+                                      std::to_string(floorHeight));
+    expect(fastest < 2.5f * freeFall, "fluid on the floor reached " + std::to_string(fastest) + " m/s");
+}
+
+static void checkReorderedCache()
+{
+    // a cloth reordered every few substeps, cached with its particle ids, against the same cloth never reordered
+    const std::string path = "check_reordered.cache";
+    MassSpringAnimation reference(10), reordered(10);
+    for (MassSpringAnimation *animation : {&reference, &reordered})
+    {
+        animation->makeCloth(10, 10);
+        animation->setMaxSubstepsPerFrame(1u << 30);
+    }
+    reordered.reorderInterval = 3;
+    std::vector<std::vector<glm::vec3>> expected;
+    {
+        ParticleCacheWriter writer(path, {{"position", ParticleChannelType::Float32, 3},
+                                          {"velocity", ParticleChannelType::Float32, 3},
+                                          {"id", ParticleChannelType::Int32, 1}});
+        reordered.addStage(StagePhase::PostProcessing,
+                           std::make_shared<CacheWriteStage>(
+                               ParticleArrays{&reordered.positions, &reordered.velocities, &reordered.particleIds}, writer));
+        Frame frame(0, 1.0f / 60.0f);
+        for (int i = 0; i < 10; i++)
+        {
+            frame.advance();
+            reference.update(frame);
+            reordered.update(frame);
+            expected.push_back(reference.positions);
+        }
+        writer.close();
+    }
+
+    ParticleCacheReader reader(path);
+    int positionChannel = reader.findChannel("position"), idChannel = reader.findChannel("id");
+    expect(reader.numberOfFrames() == expected.size() && positionChannel >= 0 && idChannel >= 0,
+           "cache holds " + std::to_string(reader.numberOfFrames()) + " frames");
+    bool moved = false;
+    double error = 0.0;
+    for (size_t slot = 0; slot < reader.numberOfFrames() && slot < expected.size(); slot++)
+    {
+        Span<const glm::vec3> positions = reader.channel<glm::vec3>(slot, positionChannel);
+        Span<const int> ids = reader.channel<int>(slot, idChannel);
+        std::vector<bool> seen(expected[slot].size(), false);
+        for (size_t p = 0; p < ids.size(); p++)
+        {
+            int id = ids[p];
+            bool valid = id >= 0 && static_cast<size_t>(id) < seen.size() && !seen[id];
+            expect(valid, "frame " + std::to_string(slot) + " repeats or misses particle ids");
+            if (!valid)
+            {
+                return;
+            }
+            seen[id] = true;
+            moved = moved || id != static_cast<int>(p);
+            // reordering changes the summation order of the spring forces, not the motion
+            error = std::max(error, static_cast<double>(glm::length(positions[p] - expected[slot][id])));
+        }
+    }
+    expect(moved, "reordering never moved a particle");
+    expect(error < 1e-3, "cached particles are off their ids by " + std::to_string(error));
+    std::remove(path.c_str());
+}
+
+static void checkCheckpointRoundTrip()
+{
+    const std::string path = "check_round_trip.ckpt";
+    for (MassSpringIntegrator integrator : {MassSpringIntegrator::SymplecticEuler, MassSpringIntegrator::BackwardEuler,
+                                            MassSpringIntegrator::ProjectiveDynamics})
+    {
+        auto makeCloth = [integrator]() {
+            std::unique_ptr<MassSpringAnimation> animation(new MassSpringAnimation(12));
+            animation->makeCloth(12, 12);
+            animation->integrator = integrator;
+            animation->reorderInterval = 7;
+            animation->setAdaptiveTimeStepping(integrator == MassSpringIntegrator::SymplecticEuler);
+            animation->setMaxSubstepsPerFrame(1u << 30);
+            CurlNoiseField::Parameters parameters;
+            parameters.lengthScale = 5.0f;
+            animation->turbulence = std::make_shared<CurlNoiseField>(parameters);
+            return animation;
+        };
+        const std::string name = "integrator " + std::to_string(static_cast<int>(integrator));
+
+        std::unique_ptr<MassSpringAnimation> original = makeCloth();
+        Frame frame(0, 1.0f / 60.0f);
+        for (int i = 0; i < 10; i++)
+        {
+            frame.advance();
+            original->update(frame);
+        }
+        std::vector<char> image = makeCheckpoint(frame, *original);
+        writeCheckpointFile(path, image);
+
+        // the restored copy starts from a different scene, everything must come from the checkpoint
+        std::unique_ptr<MassSpringAnimation> restored(new MassSpringAnimation(3));
+        restored->setMaxSubstepsPerFrame(1u << 30);
+        restored->setAdaptiveTimeStepping(integrator == MassSpringIntegrator::SymplecticEuler);
+        Frame restoredFrame = loadCheckpoint(path, *restored);
+        restored->setCurrentFrame(restoredFrame);
+        expect(restoredFrame.index == frame.index, name + ": restored frame " + std::to_string(restoredFrame.index));
+        for (int i = 0; i < 20; i++)
+        {
+            frame.advance();
+            original->update(frame);
+            restored->update(frame);
+        }
+        expect(restored->positions.size() == original->positions.size() &&
+                   std::memcmp(restored->positions.data(), original->positions.data(),
+                               original->positions.size() * sizeof(glm::vec3)) == 0 &&
+                   std::memcmp(restored->velocities.data(), original->velocities.data(),
+                               original->velocities.size() * sizeof(glm::vec3)) == 0,
+               name + ": restored run diverged from the original");
+
+        // trailing bytes after the payload are rejected and leave the loaded state untouched
+        std::vector<char> padded = image;
+        padded.resize(padded.size() + 8, 0);
+        CheckpointHeader header;
+        std::memcpy(&header, padded.data(), sizeof(header));
+        header.payloadSize += 8;
+        std::memcpy(padded.data(), &header, sizeof(header));
+        writeCheckpointFile(path, padded);
+        std::vector<glm::vec3> before = restored->positions;
+        bool rejected = false;
+        try
+        {
+            loadCheckpoint(path, *restored);
+        }
+        catch (std::runtime_error &)
+        {
+            rejected = true;
+        }
+        expect(rejected, name + ": checkpoint with trailing bytes was accepted");
+        expect(restored->positions == before, name + ": rejected checkpoint changed the animation");
+    }
+    std::remove(path.c_str());
+}
+
+int main()
+{
+    const std::pair<const char *, std::function<void()>> checks[] = {
+        {"radix sort", checkRadixSort},
+        {"neighbor search", checkNeighborSearch},
+        {"verlet lists", checkVerletNeighborLists},
+        {"block tridiagonal", checkBlockTridiagonal},
+        {"sparse cholesky", checkSparseCholesky},
+        {"spring kernel", checkSpringKernel},
+        {"grids", checkGrids},
+        {"sparse grid", checkSparseGrid},
+        {"dfsph dam break", checkDfsphDamBreak},
+        {"floor collision", checkFloorCollision},
+        {"checkpoint", checkCheckpointRoundTrip},
+        {"reordered cache", checkReorderedCache},
+    };
+    for (const auto &check : checks)
+    {
+        int before = failures;
+        check.second();
+        std::printf("%-20s %s\n", check.first, failures == before ? "ok" : "FAILED");
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
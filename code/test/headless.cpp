@@ -0,0 +1,514 @@
+#include "animation.h"
+#include "animation_stages.h"
+#include "cache_animation.h"
+#include "checkpoint.h"
+#include "curl_noise_field.h"
+#include "dfsph_solver.h"
+#include "mass_spring_animation.h"
+#include "particle_cache_writer.h"
+#include "pbf_solver.h"
+#include "sph_solver.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+/* steps a scene as fast as possible without a window or GL context */
+
+struct HeadlessOptions
+{
+    std::string scene = "chain";
+    int frames = 600;
+    int points = 10;
+    int substeps = 4;
+    bool adaptive = false;
+    int checkpointInterval = 0;
+    std::string checkpointPrefix = "checkpoint";
+    std::string restorePath;
+    std::string cachePath;
+    bool directIO = false;
+    std::string playPath;
+    int reorderInterval = 0;
+    int particles = 100000;
+    float turbulence = 0.0f;
+    float emitSpeed = 0.0f;
+    float floorHeight = 0.0f;
+    bool analyticWind = false;
+    bool implicit = false;
+    bool projective = false;
+    std::string springs = "colored";
+    bool conjugateGradient = false;
+    float stiffness = 0.0f;
+};
+
+static void printUsage(const char *program)
+{
+    std::cerr << "usage: " << program << " [--scene chain|cloth|sph|dfsph|pbf] [--frames N] [--points N] [--substeps N] [--adaptive]"
+              << " [--checkpoint-every N] [--checkpoint-prefix PATH] [--restore FILE]"
+              << " [--cache FILE] [--direct-io] [--play FILE] [--reorder-every N] [--particles N]"
+              << " [--turbulence SPEED] [--analytic-wind] [--emit SPEED] [--floor HEIGHT] [--implicit] [--cg] [--projective] [--stiffness K]"
+              << " [--springs serial|colored|gather]" << std::endl;
+}
+
+static HeadlessOptions parseOptions(int argc, char **argv)
+{
+    HeadlessOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        auto nextString = [&]() -> std::string {
+            if (i + 1 >= argc)
+            {
+                throw std::invalid_argument("missing value for " + arg);
+            }
+            return argv[++i];
+        };
+        auto next = [&]() -> int {
+            return std::stoi(nextString());
+        };
+        auto nextPositive = [&]() -> int {
+            int value = next();
+            if (value < 1)
+            {
+                throw std::invalid_argument(arg + " must be at least 1");
+            }
+            return value;
+        };
+        if (arg == "--scene")
+        {
+            options.scene = nextString();
+            if (options.scene != "chain" && options.scene != "cloth" && options.scene != "sph" &&
+                options.scene != "dfsph" && options.scene != "pbf")
+            {
+                throw std::invalid_argument("unknown scene " + options.scene);
+            }
+        }
+        else if (arg == "--frames")
+        {
+            options.frames = nextPositive();
+        }
+        else if (arg == "--points")
+        {
+            options.points = nextPositive();
+        }
+        else if (arg == "--substeps")
+        {
+            options.substeps = nextPositive();
+        }
+        else if (arg == "--adaptive")
+        {
+            options.adaptive = true;
+        }
+        else if (arg == "--checkpoint-every")
+        {
+            options.checkpointInterval = next();
+        }
+        else if (arg == "--checkpoint-prefix")
+        {
+            options.checkpointPrefix = nextString();
+        }
+        else if (arg == "--restore")
+        {
+            options.restorePath = nextString();
+        }
+        else if (arg == "--cache")
+        {
+            options.cachePath = nextString();
+        }
+        else if (arg == "--direct-io")
+        {
+            options.directIO = true;
+        }
+        else if (arg == "--play")
+        {
+            options.playPath = nextString();
+        }
+        else if (arg == "--reorder-every")
+        {
+            options.reorderInterval = next();
+        }
+        else if (arg == "--particles")
+        {
+            options.particles = nextPositive();
+        }
+        else if (arg == "--turbulence")
+        {
+            options.turbulence = std::stof(nextString());
+        }
+        else if (arg == "--emit")
+        {
+            options.emitSpeed = std::stof(nextString());
+        }
+        else if (arg == "--floor")
+        {
+            options.floorHeight = std::stof(nextString());
+        }
+        else if (arg == "--analytic-wind")
+        {
+            options.analyticWind = true;
+        }
+        else if (arg == "--implicit")
+        {
+            options.implicit = true;
+        }
+        else if (arg == "--springs")
+        {
+            options.springs = nextString();
+            if (options.springs != "serial" && options.springs != "colored" && options.springs != "gather")
+            {
+                throw std::invalid_argument("unknown spring assembly " + options.springs);
+            }
+        }
+        else if (arg == "--projective")
+        {
+            options.projective = true;
+        }
+        else if (arg == "--cg")
+        {
+            options.conjugateGradient = true;
+        }
+        else if (arg == "--stiffness")
+        {
+            options.stiffness = std::stof(nextString());
+        }
+        else
+        {
+            throw std::invalid_argument("unknown option " + arg);
+        }
+    }
+    bool massSpring = options.scene == "chain" || options.scene == "cloth";
+    if (!massSpring && (options.checkpointInterval > 0 || !options.restorePath.empty() || !options.cachePath.empty()))
+    {
+        throw std::invalid_argument("checkpoints and caches are only supported by the mass spring scenes");
+    }
+    if (massSpring && options.floorHeight > 0.0f)
+    {
+        throw std::invalid_argument("--floor is only supported by the fluid scenes");
+    }
+    return options;
+}
+
+/* stream every frame of a baked cache and report playback throughput */
+static int playCache(const std::string &path)
+{
+    std::unique_ptr<CacheAnimation> cache;
+    try
+    {
+        cache.reset(new CacheAnimation(path));
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const ParticleCacheReader &reader = cache->reader();
+    Frame frame(reader.firstFrameIndex(), 1.0f / 60.0f);
+    glm::vec3 checksum(0.0f);
+    size_t particles = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (; frame.index <= reader.lastFrameIndex(); frame.advance())
+    {
+        cache->update(frame);
+        Span<const glm::vec3> positions = cache->positions();
+        for (const glm::vec3 &p : positions)
+        {
+            checksum += p;
+        }
+        particles += positions.size();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::printf("frames:     %zu\n", reader.numberOfFrames());
+    std::printf("particles:  %zu\n", particles);
+    std::printf("checksum:   %f %f %f\n", checksum.x, checksum.y, checksum.z);
+    std::printf("time:       %.3f s\n", seconds);
+    std::printf("frames/sec: %.1f\n", seconds > 0 ? reader.numberOfFrames() / seconds : 0.0);
+    return EXIT_SUCCESS;
+}
+
+/* fluids are only stable below their CFL limit, step adaptively */
+static void configureStepping(SphSolver &solver)
+{
+    solver.setAdaptiveTimeStepping(true);
+}
+
+/* position based fluids take one step per frame, like an interactive scene would */
+static void configureStepping(PbfSolver &solver)
+{
+    solver.setAdaptiveTimeStepping(false);
+    solver.setNumberOfSubsteps(1);
+}
+
+static void printPressureSolve(const SphSolver &) {}
+
+static void printPressureSolve(const DfsphSolver &solver)
+{
+    unsigned long long steps = solver.totalNumberOfSubsteps();
+    const DfsphStatistics &last = solver.lastStepStatistics();
+    std::printf("density:    %.2f iterations/step avg, last step %d iterations, %.5f error\n",
+                steps > 0 ? static_cast<double>(solver.totalDensityIterations()) / steps : 0.0,
+                last.densityIterations, last.densityError);
+    std::printf("divergence: %.2f iterations/step avg, last step %d iterations, %.5f error\n",
+                steps > 0 ? static_cast<double>(solver.totalDivergenceIterations()) / steps : 0.0,
+                last.divergenceIterations, last.divergenceError);
+}
+
+/* dam break: a cube of fluid collapsing in a box twice its width, reports solver throughput */
+template <typename Solver>
+static int runSph(const HeadlessOptions &options)
+{
+    Solver solver;
+    const int side = std::max(1, static_cast<int>(std::round(std::cbrt(static_cast<double>(options.particles)))));
+    const float height = 0.5f;
+    solver.setTargetSpacing(height / side);
+    // with a floor the scene sits on a collision plane above the bottom of the domain
+    const glm::vec3 raised(0.0f, options.floorHeight, 0.0f);
+    solver.domainLower = glm::vec3(0.0f);
+    solver.domainUpper = glm::vec3(2.0f * height, 2.0f * height, height) + raised;
+    // for the weakly compressible solver, ten times the fastest free fall velocity keeps
+    // density fluctuations within a few percent
+    solver.speedOfSound = 10.0f * std::sqrt(2.0f * 9.8f * height);
+    solver.addBlock(raised, glm::vec3(height) + raised);
+    if (options.turbulence > 0.0f)
+    {
+        CurlNoiseField::Parameters parameters;
+        parameters.amplitude = options.turbulence;
+        parameters.lengthScale = 0.5f * height;
+        auto wind = std::make_shared<CurlNoiseField>(parameters);
+        if (!options.analyticWind)
+        {
+            // a cell per particle spacing resolves the smallest octave and is baked once
+            wind->setBakeRegion(solver.domainLower, solver.domainUpper, solver.targetSpacing);
+        }
+        solver.wind = wind;
+    }
+    if (options.emitSpeed > 0.0f)
+    {
+        // a jet from above the empty half of the box, one particle spacing apart so the
+        // pressure solve doesn't see them overlap, until the fluid has doubled
+        size_t maxParticles = 2 * solver.particles.numberOfParticles();
+        float rate = options.emitSpeed / solver.targetSpacing;
+        solver.addStage(StagePhase::PreProcessing,
+                        std::make_shared<PointEmitterStage>(solver.particles, glm::vec3(1.5f * height, 1.5f * height, 0.5f * height) + raised,
+                                                            glm::vec3(0.0f, -options.emitSpeed, 0.0f), rate, maxParticles));
+    }
+    if (options.floorHeight > 0.0f)
+    {
+        solver.addStage(StagePhase::PostProcessing,
+                        std::make_shared<PlaneCollisionStage>(solver.particles, options.floorHeight, 0.0f));
+    }
+    configureStepping(solver);
+    solver.setMaxSubstepsPerFrame(1u << 30);
+
+    auto statistics = std::make_shared<StatisticsStage>(solver);
+    solver.addStage(StagePhase::PostProcessing, statistics);
+
+    Frame frame(0, 1.0f / 60.0f);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < options.frames; i++)
+    {
+        frame.advance();
+        solver.update(frame);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    unsigned long long steps = solver.totalNumberOfSubsteps();
+    size_t particles = solver.particles.numberOfParticles();
+    std::printf("frames:     %d\n", options.frames);
+    std::printf("particles:  %zu\n", particles);
+    std::printf("substeps:   %llu\n", steps);
+    std::printf("time:       %.3f s\n", seconds);
+    std::printf("steps/sec:  %.1f\n", seconds > 0 ? steps / seconds : 0.0);
+    std::printf("updates/s:  %.3g particle steps\n", seconds > 0 ? steps * particles / seconds : 0.0);
+    std::printf("solver:     %.3f ms/frame avg, %.3f ms max\n", statistics->averageSolverMilliseconds(),
+                statistics->maxSolverMilliseconds());
+    std::printf("neighbors:  %.1f%% of substeps rebuilt the lists\n", 100.0 * solver.neighborLists.rebuildRate());
+    printPressureSolve(solver);
+    for (const StageStatistics &stage : solver.stageStatistics())
+    {
+        std::printf("stage %-12s %.3f ms total, %.4f ms/frame\n", stage.name.c_str(), stage.totalMilliseconds,
+                    stage.calls > 0 ? stage.totalMilliseconds / stage.calls : 0.0);
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    HeadlessOptions options;
+    try
+    {
+        options = parseOptions(argc, argv);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!options.playPath.empty())
+    {
+        return playCache(options.playPath);
+    }
+    if (options.scene == "sph")
+    {
+        return runSph<SphSolver>(options);
+    }
+    if (options.scene == "dfsph")
+    {
+        return runSph<DfsphSolver>(options);
+    }
+    if (options.scene == "pbf")
+    {
+        return runSph<PbfSolver>(options);
+    }
+
+    MassSpringAnimation animation(options.points);
+    if (options.scene == "cloth")
+    {
+        animation.makeCloth(options.points, options.points);
+    }
+    animation.setNumberOfSubsteps(options.substeps);
+    animation.setAdaptiveTimeStepping(options.adaptive);
+    animation.reorderInterval = options.reorderInterval;
+    if (options.implicit)
+    {
+        animation.integrator = MassSpringIntegrator::BackwardEuler;
+        animation.chainSolver = !options.conjugateGradient;
+    }
+    animation.springAssembly = options.springs == "serial"   ? SpringAssembly::Serial
+                               : options.springs == "gather" ? SpringAssembly::Gather
+                                                             : SpringAssembly::Colored;
+    if (options.projective)
+    {
+        animation.integrator = MassSpringIntegrator::ProjectiveDynamics;
+    }
+    if (options.stiffness > 0.0f)
+    {
+        animation.stiffness = options.stiffness;
+    }
+    if (options.turbulence > 0.0f)
+    {
+        CurlNoiseField::Parameters parameters;
+        parameters.amplitude = options.turbulence;
+        parameters.lengthScale = 5.0f;
+        animation.turbulence = std::make_shared<CurlNoiseField>(parameters);
+    }
+    // never drop simulated time, a batch run has no frame budget
+    animation.setMaxSubstepsPerFrame(1u << 30);
+
+    Frame frame(0, 1.0f / 60.0f);
+    if (!options.restorePath.empty())
+    {
+        try
+        {
+            frame = loadCheckpoint(options.restorePath, animation);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        animation.setCurrentFrame(frame);
+        std::printf("restored:   frame %d from %s\n", frame.index, options.restorePath.c_str());
+    }
+
+    std::unique_ptr<ParticleCacheWriter> cache;
+    if (!options.cachePath.empty())
+    {
+        ParticleCacheWriter::Options cacheOptions;
+        cacheOptions.directIO = options.directIO;
+        cache.reset(new ParticleCacheWriter(options.cachePath,
+                                            {{"position", ParticleChannelType::Float32, 3},
+                                             {"velocity", ParticleChannelType::Float32, 3},
+                                             {"id", ParticleChannelType::Int32, 1}},
+                                            cacheOptions));
+        // reading the state for the cache and the statistics don't interfere, run them side by side
+        animation.addStage(StagePhase::PostProcessing,
+                           std::make_shared<CacheWriteStage>(ParticleArrays{&animation.positions, &animation.velocities, &animation.particleIds}, *cache));
+    }
+    auto statistics = std::make_shared<StatisticsStage>(animation);
+    animation.addStage(StagePhase::PostProcessing, statistics);
+
+    AsyncCheckpointWriter checkpoints;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < options.frames; i++)
+    {
+        frame.advance();
+        animation.update(frame);
+        if (options.checkpointInterval > 0 && frame.index % options.checkpointInterval == 0)
+        {
+            char suffix[32];
+            std::snprintf(suffix, sizeof(suffix), "_%06d.ckpt", frame.index);
+            checkpoints.save(options.checkpointPrefix + suffix, frame, animation);
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    try
+    {
+        checkpoints.wait();
+        if (cache != nullptr)
+        {
+            cache->close();
+            ParticleCacheWriter::Statistics cacheStatistics = cache->statistics();
+            std::printf("cached:     %llu frames, %.1f MB%s\n",
+                        static_cast<unsigned long long>(cacheStatistics.framesWritten),
+                        cacheStatistics.bytesWritten / (1024.0 * 1024.0),
+                        cacheStatistics.directIO ? " (direct I/O)" : "");
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    unsigned long long steps = animation.totalNumberOfSubsteps();
+    std::printf("frames:     %d\n", options.frames);
+    std::printf("points:     %d\n", animation.numberOfPoints);
+    std::printf("substeps:   %llu\n", steps);
+    std::printf("time:       %.3f s\n", seconds);
+    std::printf("steps/sec:  %.1f\n", seconds > 0 ? steps / seconds : 0.0);
+    std::printf("frames/sec: %.1f\n", seconds > 0 ? options.frames / seconds : 0.0);
+    std::printf("solver:     %.3f ms/frame avg, %.3f ms max, %llu frames over budget\n",
+                statistics->averageSolverMilliseconds(), statistics->maxSolverMilliseconds(),
+                statistics->framesOverBudget());
+    if (animation.numberOfImplicitSteps() > 0)
+    {
+        const ImplicitSolveStatistics &last = animation.lastSolveStatistics();
+        if (last.direct)
+        {
+            std::printf("implicit:   direct block tridiagonal solve along %zu chains\n", animation.numberOfChains());
+        }
+        else
+        {
+            std::printf("implicit:   %.2f CG iterations/step avg, last step %d iterations, %.2e residual\n",
+                        static_cast<double>(animation.totalSolverIterations()) / animation.numberOfImplicitSteps(),
+                        last.iterations, last.residual);
+        }
+    }
+    if (animation.numberOfFactorizations() > 0)
+    {
+        std::printf("projective: %d iterations/step, %zu nonzeros in L for %zu rows, %llu analyses, %llu factorizations\n",
+                    animation.projectiveIterations, animation.projectiveFactor().numberOfNonZeros(),
+                    animation.projectiveFactor().size(), animation.numberOfAnalyses(), animation.numberOfFactorizations());
+    }
+    for (const StageStatistics &stage : animation.stageStatistics())
+    {
+        std::printf("stage %-12s %.3f ms total, %.4f ms/frame\n", stage.name.c_str(), stage.totalMilliseconds,
+                    stage.calls > 0 ? stage.totalMilliseconds / stage.calls : 0.0);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,4 +1,5 @@
 #include "animation.h"
+#include "mass_spring_animation.h"
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -7,7 +8,9 @@
 #include "object3d.h"
 #include "field.h"
 #include "camera.h"
+#include "simulation_thread.h"
 
+#include <memory>
 #include <vector>
 #include "application.h"
 
@@ -16,28 +19,46 @@
 #include <imgui_impl_opengl3.h>
 using Vec3 = glm::vec3;
 
-class MassSpringAnimation : public PhysicsAnimation, public Application
+/* state handed from the simulation thread to the renderer */
+struct MassSpringSnapshot
+{
+    std::vector<Vec3> positions;
+    // creation order index of each position, reorders permute the positions
+    std::vector<int> particleIds;
+    SubstepStatistics statistics;
+};
+
+class MassSpringApplication : public Application
 {
 public:
-    MassSpringAnimation(int num = 5) : PhysicsAnimation(), Application()
+    MassSpringApplication(int num = 5) : Application(), animation(num)
     {
         frame.reset(new Frame(0, 1.0 / 60));
-        numberOfPoints = num;
-        // set parameter
-        setParameter();
-        makeChain();
+        animation.setNumberOfSubsteps(4);
+        animation.setMaxSubstepsPerFrame(32);
+        animation.setAdaptiveTimeStepping(true);
+        animation.setSubstepIntervalRange(1e-4f, 1.0f / 60.0f);
 
         // render about
         _windowTitle = "Mass Spring Animation";
 
-        floor.reset(new Plane(Vec3(0, floorPositionY - 1, 0), Vec3(0, 1, 0)));
+        floor.reset(new Plane(Vec3(0, animation.floorPositionY - 1, 0), Vec3(0, 1, 0)));
 
         sphere.reset(new Model("../data/sphere.obj"));
         sphere->scale = Vec3(1, 1, 1);
 
         camera.reset(new Camera(glm::vec3(0, 0, 30)));
 
-        modelMatrices.resize(numberOfPoints);
+        modelMatrices.resize(animation.numberOfPoints);
+
+        simulation.reset(new SimulationThread<MassSpringSnapshot>(
+            animation,
+            [this](const PhysicsAnimation &, MassSpringSnapshot &snapshot) {
+                snapshot.positions = animation.positions;
+                snapshot.particleIds = animation.particleIds;
+                snapshot.statistics = animation.lastFrameStatistics();
+            },
+            frame->timeInterval));
 
         std::string vsfile = "../test/Instanced.vs";
         std::string floorvs = "../test/floor.vs";
@@ -53,8 +74,9 @@ public:
         ImGui_ImplOpenGL3_Init();
     }
 
-    ~MassSpringAnimation()
+    ~MassSpringApplication()
     {
+        simulation->stop();
         ImGui_ImplOpenGL3_Shutdown();
         ImGui_ImplGlfw_Shutdown();
         ImGui::DestroyContext();
@@ -63,7 +85,15 @@ public:
     /* derived class can override this function to handle input */
     virtual void handleInput()
     {
-        onAdvanceTimeStep(_deltaTime);
+        // step the solver in fixed substeps for however many frames the wall clock covered,
+        // unless it runs on its own thread
+        if (!simulation->running())
+        {
+            elapsedTime += _deltaTime;
+            frame->index = static_cast<int>(elapsedTime / static_cast<double>(frame->timeInterval));
+            animation.update(*frame);
+        }
+
         float d = 50 * SPEED * _deltaTime;
         if (_keyboardInput.keyStates[GLFW_KEY_W] != GLFW_RELEASE)
         {
@@ -100,10 +130,26 @@ public:
         // update(*frame);
         // frame->advance();
 
-        for (int i = 0; i < numberOfPoints; i++)
+        // while the simulation thread runs, the animation may only be read through its snapshots
+        const std::vector<Vec3> *renderPositions;
+        SubstepStatistics statistics;
+        if (simulation->running())
+        {
+            const MassSpringSnapshot &snapshot = simulation->latest();
+            renderPositions = &snapshot.positions;
+            statistics = snapshot.statistics;
+        }
+        else
+        {
+            renderPositions = &animation.positions;
+            statistics = animation.lastFrameStatistics();
+        }
+        int numberOfInstances = static_cast<int>(renderPositions->size());
+        modelMatrices.resize(numberOfInstances);
+        for (int i = 0; i < numberOfInstances; i++)
         {
             glm::mat4 model = sphere->getModelMatrix();
-            modelMatrices[i] = glm::translate(model, positions[i]);
+            modelMatrices[i] = glm::translate(model, (*renderPositions)[i]);
         }
         showFpsInWindowTitle();
 
@@ -138,7 +184,7 @@ public:
         unsigned int instanceVBO;
         glGenBuffers(1, &instanceVBO);
         glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * numberOfPoints, &modelMatrices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * numberOfInstances, modelMatrices.data(), GL_STATIC_DRAW);
 
         GLsizei vec4Size = sizeof(glm::vec4);
         glEnableVertexAttribArray(3);
@@ -155,7 +201,7 @@ public:
         glVertexAttribDivisor(6, 1);
 
         glBindVertexArray(0);
-        sphere->instancedDraw(numberOfPoints);
+        sphere->instancedDraw(numberOfInstances);
 
         // imgui
         // draw ui elements
@@ -173,21 +219,71 @@ public:
         }
         else
         {
-            static int number = numberOfPoints;
+            static int number = animation.numberOfPoints;
             ImGui::SliderInt("Number of balls", &number, 1, 10);
             static float g = 9.8;
             ImGui::SliderFloat("Gravity", &g, 0, 20);
-            static float rl = restLength;
+            static float rl = animation.restLength;
             ImGui::SliderFloat("Rest Length", &rl, 0, 5);
             static float intensity = 100;
             ImGui::SliderFloat("Intensity of wind(horizontal)", &intensity, -100, 100);
+            static float turbulence = 0;
+            ImGui::SliderFloat("Turbulence of wind", &turbulence, 0, 50);
+            static bool threaded = simulation->running();
+            if (ImGui::Checkbox("Simulate on separate thread", &threaded))
+            {
+                if (threaded)
+                {
+                    simulation->start();
+                }
+                else
+                {
+                    simulation->stop();
+                    elapsedTime = animation.currentFrame().index * static_cast<double>(frame->timeInterval);
+                }
+            }
+            static int integrator = static_cast<int>(animation.integrator);
+            if (ImGui::Combo("Integrator", &integrator, "Symplectic Euler\0Backward Euler\0Projective dynamics\0"))
+            {
+                simulation->submit([this, selected = integrator] {
+                    animation.integrator = static_cast<MassSpringIntegrator>(selected);
+                });
+            }
+            static float stiffness = animation.stiffness;
+            if (ImGui::SliderFloat("Stiffness", &stiffness, 10, 100000, "%.0f", ImGuiSliderFlags_Logarithmic))
+            {
+                simulation->submit([this, k = stiffness] { animation.stiffness = k; });
+            }
+            static bool adaptive = animation.adaptiveTimeStepping();
+            if (ImGui::Checkbox("Adaptive time step", &adaptive))
+            {
+                simulation->submit([this, enabled = adaptive] { animation.setAdaptiveTimeStepping(enabled); });
+            }
+            static int substeps = animation.numberOfSubsteps();
+            if (ImGui::SliderInt("Substeps per frame", &substeps, 1, 32))
+            {
+                simulation->submit([this, n = substeps] { animation.setNumberOfSubsteps(n); });
+            }
+            ImGui::Text("Substeps: %u (%.3f ms)", statistics.numberOfSubsteps, statistics.elapsedMilliseconds);
+            ImGui::Text("Substep interval: %.5f - %.5f s", statistics.smallestInterval, statistics.largestInterval);
             if (ImGui::Button("Restart!"))
             {
-                restLength = rl;
-                numberOfPoints = number;
-                gravity.y = -g;
-                wind->setValue(glm::vec3(intensity, 0, 0));
-                makeChain();
+                // copy the slider values, the command may run on the simulation thread
+                simulation->submit([this, length = rl, count = number, gy = -g, windX = intensity, gusts = turbulence] {
+                    animation.restLength = length;
+                    animation.numberOfPoints = count;
+                    animation.gravity.y = gy;
+                    animation.wind->setValue(glm::vec3(windX, 0, 0));
+                    animation.turbulence = nullptr;
+                    if (gusts > 0)
+                    {
+                        CurlNoiseField::Parameters parameters;
+                        parameters.amplitude = gusts;
+                        parameters.lengthScale = 5.0f;
+                        animation.turbulence = std::make_shared<CurlNoiseField>(parameters);
+                    }
+                    animation.makeChain();
+                });
             }
             ImGui::End();
         }
@@ -214,147 +310,12 @@ public:
     }
 
 private:
-    void onAdvanceTimeStep(float timeInterval) override
-    {
-        for (int i = 0; i < positions.size(); i++)
-        {
-            // Gravity
-            forces[i] = gravity * float(mass);
-            // Air drag
-            Vec3 relativeVel = velocities[i];
-            if (wind != nullptr)
-            {
-                relativeVel -= wind->sample(positions[i]);
-            }
-            forces[i] += -dragCoefficient * relativeVel;
-        }
-
-        for (int i = 0; i < edges.size(); i++)
-        {
-            int pid0 = edges[i].first, pid1 = edges[i].second;
-
-            // spring force
-            Vec3 pos0 = positions[pid0], pos1 = positions[pid1];
-            Vec3 r = pos0 - pos1;
-            float distance = glm::length(r);
-            if (distance > 0)
-            {
-                Vec3 force = -stiffness * (distance - restLength) * glm::normalize(r);
-                forces[pid0] += force;
-                forces[pid1] -= force;
-            }
-            // damping force
-            Vec3 v0 = velocities[pid0], v1 = velocities[pid1];
-            Vec3 relativeV = v0 - v1;
-            Vec3 damping = -dampingCoefficient * relativeV;
-            forces[pid0] += damping;
-            forces[pid1] -= damping;
-        }
-        // Update states
-        for (int i = 0; i < positions.size(); ++i)
-        {
-            // Compute new states
-            Vec3 newAcceleration = forces[i] * (1.0f / mass);
-            Vec3 newVelocity = velocities[i] + timeInterval * newAcceleration;
-            Vec3 newPosition = positions[i] + timeInterval * newVelocity;
-
-            // Collision
-            if (newPosition.y < floorPositionY)
-            {
-                newPosition.y = floorPositionY;
-
-                if (newVelocity.y < 0.0)
-                {
-                    newVelocity.y *= -restitutionCoefficient;
-                    newPosition.y += timeInterval * newVelocity.y;
-                }
-            }
-
-            // Update states
-            velocities[i] = newVelocity;
-            positions[i] = newPosition;
-        }
-
-        // Apply constraints
-        for (int i = 0; i < constraints.size(); ++i)
-        {
-            size_t pointIndex = constraints[i].pointIndex;
-            positions[pointIndex] = constraints[i].fixedPosition;
-            velocities[pointIndex] = constraints[i].fixedVelocity;
-        }
-    }
-    void setParameter()
-    {
-        mass = 1.0;
-        gravity = Vec3(0.0, -9.8, 0.0);
-        stiffness = 500.0;
-        restLength = 2.0;
-        dampingCoefficient = 1.0;
-        dragCoefficient = 0.1;
-
-        floorPositionY = -10.0;
-        restitutionCoefficient = 0.3;
-
-        constraints.push_back(Constraint{0, Vec3(0), Vec3(0)});
-        wind = std::make_shared<ConstantVectorField>(Vec3(30.0, 0, 0));
-    }
-    void makeChain()
-    {
-        if (numberOfPoints == 0)
-        {
-            return;
-        }
-
-        int numberOfEdges = numberOfPoints - 1;
-
-        positions.resize(numberOfPoints);
-        velocities.resize(numberOfPoints);
-        forces.resize(numberOfPoints);
-        edges.resize(numberOfEdges);
-
-        for (int i = 0; i < numberOfPoints; ++i)
-        {
-            positions[i] = glm::vec3(-static_cast<float>(i), 0, 0);
-        }
-
-        for (int i = 0; i < numberOfEdges; ++i)
-        {
-            edges[i] = Edge{i, i + 1};
-        }
-    }
-    struct Edge
-    {
-        int first;
-        int second;
-    };
-
-    struct Constraint
-    {
-        int pointIndex;
-        Vec3 fixedPosition;
-        Vec3 fixedVelocity;
-    };
+    MassSpringAnimation animation;
 
     std::unique_ptr<Frame> frame;
-
-    int numberOfPoints;
-    float mass;
-    Vec3 gravity;
-    float stiffness;
-    float restLength;
-    float dampingCoefficient;
-    float dragCoefficient;
-
-    float floorPositionY;
-    float restitutionCoefficient;
-
-    std::vector<Vec3> positions;
-    std::vector<Vec3> velocities;
-    std::vector<Vec3> forces;
-    std::vector<Edge> edges;
-
-    std::shared_ptr<ConstantVectorField> wind;
-    std::vector<Constraint> constraints;
+    // wall clock of the stepped frames, in double so it keeps advancing at 60 Hz after hours
+    double elapsedTime = 0.0;
+    std::unique_ptr<SimulationThread<MassSpringSnapshot>> simulation;
 
     std::unique_ptr<Plane> floor;
     std::unique_ptr<Model> sphere;
@@ -368,7 +329,7 @@ int main()
 {
     try
     {
-        MassSpringAnimation app(10);
+        MassSpringApplication app(10);
         app.run();
     }
     catch (std::exception &e)